@@ -0,0 +1,191 @@
+// Load generator for BatchPredictor
+//
+// A number of client threads send single observations to a model, each
+// waiting for its answer before sending the next one. The requests are either
+// evaluated one at a time under a lock ("direct"), or combined by a
+// BatchPredictor ("batched"). The throughput and the latency percentiles of
+// the requests are reported.
+//
+// Usage: bench_batching [output.json] [--quick]
+// The results are written to the given file in JSON format, or to the
+// standard output if no file is given.
+
+#include <MiniDNN.h>
+#include <fstream>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include "bench_utils.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+
+struct LoadResult
+{
+    std::string name;
+    std::map<std::string, double> params;
+    double throughput;   // Requests per second
+    double p50;          // Latency percentiles in seconds
+    double p99;
+    double max;
+    double mean_batch;   // Average batch size, 1 without batching
+};
+
+// Each client sends nreq requests in a closed loop
+template <typename Predict>
+LoadResult run_clients(const std::string& name, Predict& predict, const Matrix& x,
+                       int nclient, int nreq)
+{
+    using internal::wall_time;
+
+    std::vector< std::vector<double> > latency(nclient, std::vector<double>(nreq));
+    std::vector<std::thread> clients;
+    const double start = wall_time();
+
+    for (int c = 0; c < nclient; c++)
+    {
+        clients.push_back(std::thread([&, c]() {
+            for (int i = 0; i < nreq; i++)
+            {
+                const Vector xi = x.col((c * nreq + i) % x.cols());
+                const double t = wall_time();
+                const Vector y = predict(xi);
+                latency[c][i] = wall_time() - t;
+            }
+        }));
+    }
+
+    for (int c = 0; c < nclient; c++)
+    {
+        clients[c].join();
+    }
+
+    const double elapsed = wall_time() - start;
+    std::vector<double> all;
+
+    for (int c = 0; c < nclient; c++)
+    {
+        all.insert(all.end(), latency[c].begin(), latency[c].end());
+    }
+
+    std::sort(all.begin(), all.end());
+    const int n = all.size();
+    LoadResult res;
+    res.name = name;
+    res.params["clients"] = nclient;
+    res.params["requests"] = n;
+    res.throughput = n / elapsed;
+    res.p50 = all[n / 2];
+    res.p99 = all[std::min(n - 1, int(0.99 * n))];
+    res.max = all.back();
+    res.mean_batch = 1.0;
+    return res;
+}
+
+// One request at a time, serialized by a lock as a Network is not reentrant
+struct DirectPredict
+{
+    Network& net;
+    std::mutex mutex;
+    explicit DirectPredict(Network& net_) : net(net_) {}
+    Vector operator()(const Vector& x)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return net.predict(x);
+    }
+};
+
+struct BatchedPredict
+{
+    BatchPredictor<Network>& batcher;
+    explicit BatchedPredict(BatchPredictor<Network>& batcher_) : batcher(batcher_) {}
+    Vector operator()(const Vector& x) { return batcher.predict(x); }
+};
+
+void write_json(std::ostream& os, const std::vector<LoadResult>& results)
+{
+    os.precision(6);
+    os << "{\n  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const LoadResult& r = results[i];
+        os << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << r.name << "\", \"params\": {";
+
+        for (std::map<std::string, double>::const_iterator it = r.params.begin();
+             it != r.params.end(); it++)
+        {
+            os << (it == r.params.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+        }
+
+        os << "}, \"requests_per_sec\": " << r.throughput
+           << ", \"latency_sec\": {\"p50\": " << r.p50 << ", \"p99\": " << r.p99
+           << ", \"max\": " << r.max << "}, \"mean_batch\": " << r.mean_batch << "}";
+    }
+
+    os << "\n  ]\n}" << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    bool quick = false;
+    const char* output = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            quick = true;
+        }
+        else
+        {
+            output = argv[i];
+        }
+    }
+
+    std::srand(123);
+    Network net;
+    net.add_layer(new FullyConnected<ReLU>(256, 512));
+    net.add_layer(new FullyConnected<ReLU>(512, 512));
+    net.add_layer(new FullyConnected<Softmax>(512, 10));
+    net.set_output(new MultiClassEntropy());
+    net.init(0, 0.01, 123);
+
+    const Matrix x = Matrix::Random(256, 1000);
+    const int nreq = quick ? 200 : 2000;
+    const int max_batch = 16;
+    const double max_delay = 0.0005;
+    std::vector<LoadResult> results;
+    const int clients[] = { 1, 16, 64 };
+
+    for (int k = 0; k < 3; k++)
+    {
+        const int nclient = clients[k];
+        DirectPredict direct(net);
+        results.push_back(run_clients("direct", direct, x, nclient, nreq));
+
+        BatchPredictor<Network> batcher(net, max_batch, max_delay);
+        BatchedPredict batched(batcher);
+        LoadResult res = run_clients("batched", batched, x, nclient, nreq);
+        res.params["max_batch"] = max_batch;
+        res.params["max_delay"] = max_delay;
+        res.mean_batch = batcher.stats().mean_batch();
+        results.push_back(res);
+    }
+
+    if (output)
+    {
+        std::ofstream ofs(output);
+        write_json(ofs, results);
+    }
+    else
+    {
+        write_json(std::cout, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Latency of the code generated by Network::export_cpp() compared with
+// Network::predict()
+//
+// The benchmark is built in two stages, as "make bench_codegen" does:
+//
+// 1. Compiled with -DBENCH_CODEGEN_EXPORT, the program builds the networks,
+//    and writes them to model files and to the generated headers
+//    codegen_small.h, codegen_mlp.h and codegen_cnn.h.
+// 2. Compiled without it, the program includes the generated headers, reads
+//    the same networks from the model files, checks that both give the same
+//    predictions, and times the prediction of a single observation.
+//
+// Usage: bench_codegen [output.json]
+// The results are written to the given file in JSON format, or to the
+// standard output if no file is given. The program exits with status 1 if the
+// predictions differ.
+
+#include <MiniDNN.h>
+#include <fstream>
+#include "bench_utils.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+
+#ifdef BENCH_CODEGEN_EXPORT
+
+int main()
+{
+    // Small regression model, for which the overhead of Network::predict()
+    // dominates
+    Network small;
+    small.add_layer(new FullyConnected<Tanh>(16, 32));
+    small.add_layer(new FullyConnected<Tanh>(32, 32));
+    small.add_layer(new FullyConnected<Identity>(32, 4));
+    small.set_output(new RegressionMSE());
+    small.init(0, 0.1, 123);
+    small.export_net("codegen_small.mdnn");
+    small.export_cpp("codegen_small.h", "codegen_small");
+
+    // Multilayer perceptron
+    Network mlp;
+    mlp.add_layer(new FullyConnected<ReLU>(64, 128));
+    mlp.add_layer(new FullyConnected<ReLU>(128, 128));
+    mlp.add_layer(new FullyConnected<Softmax>(128, 10));
+    mlp.set_output(new MultiClassEntropy());
+    mlp.init(0, 0.1, 123);
+    mlp.export_net("codegen_mlp.mdnn");
+    mlp.export_cpp("codegen_mlp.h", "codegen_mlp");
+
+    // Small convolutional network on 28x28 images
+    Network cnn;
+    cnn.add_layer(new Convolutional<ReLU>(28, 28, 1, 6, 5, 5));
+    cnn.add_layer(new MaxPooling<Identity>(24, 24, 6, 2, 2));
+    cnn.add_layer(new Convolutional<ReLU>(12, 12, 6, 16, 5, 5));
+    cnn.add_layer(new MaxPooling<Identity>(8, 8, 16, 2, 2));
+    cnn.add_layer(new FullyConnected<Softmax>(4 * 4 * 16, 10));
+    cnn.set_output(new MultiClassEntropy());
+    cnn.init(0, 0.1, 123);
+    cnn.export_net("codegen_cnn.mdnn");
+    cnn.export_cpp("codegen_cnn.h", "codegen_cnn");
+
+    return 0;
+}
+
+#else
+
+#include "codegen_small.h"
+#include "codegen_mlp.h"
+#include "codegen_cnn.h"
+
+// Network::predict() on one observation
+struct NetworkPredict
+{
+    Network& net;
+    const Matrix& x;
+    NetworkPredict(Network& net_, const Matrix& x_) : net(net_), x(x_) {}
+    void operator()() { net.predict(x); }
+};
+
+// Generated predict() on one observation
+struct GeneratedPredict
+{
+    typedef void (*Function)(const Scalar*, Scalar*);
+    Function f;
+    const Scalar* x;
+    Scalar* y;
+    GeneratedPredict(Function f_, const Scalar* x_, Scalar* y_) : f(f_), x(x_), y(y_) {}
+    void operator()() { f(x, y); }
+};
+
+// Check the generated code against the network, and time both
+bool bench_model(const std::string& name, GeneratedPredict::Function f, int in_size, int out_size,
+                 const bench::Settings& settings, std::vector<bench::Result>& results)
+{
+    Network net;
+    net.read_net("codegen_" + name + ".mdnn");
+
+    const int nobs = 100;
+    Matrix x = Matrix::Random(in_size, nobs);
+    Matrix expected = net.predict(x);
+    Matrix y(out_size, nobs);
+
+    for (int j = 0; j < nobs; j++)
+    {
+        f(x.col(j).data(), y.col(j).data());
+    }
+
+    const double diff = (expected - y).cwiseAbs().maxCoeff();
+    const double tol = 100 * Eigen::NumTraits<Scalar>::epsilon();
+    std::cerr << name << ": maximum difference " << diff << std::endl;
+
+    Matrix x1 = x.col(0);
+    NetworkPredict network(net, x1);
+    bench::Result res = bench::run(name + "_network_predict", network, settings, 1);
+    res.params["in_size"] = in_size;
+    results.push_back(res);
+
+    GeneratedPredict generated(f, x.col(0).data(), y.col(0).data());
+    res = bench::run(name + "_generated_predict", generated, settings, 1);
+    res.params["in_size"] = in_size;
+    results.push_back(res);
+
+    return diff <= tol;
+}
+
+int main(int argc, char* argv[])
+{
+    std::srand(123);
+    bench::Settings settings;
+    std::vector<bench::Result> results;
+    bool ok = bench_model("small", codegen_small::predict, codegen_small::in_size,
+                          codegen_small::out_size, settings, results);
+    ok = bench_model("mlp", codegen_mlp::predict, codegen_mlp::in_size, codegen_mlp::out_size,
+                     settings, results) && ok;
+    ok = bench_model("cnn", codegen_cnn::predict, codegen_cnn::in_size, codegen_cnn::out_size,
+                     settings, results) && ok;
+
+    if (argc > 1)
+    {
+        std::ofstream ofs(argv[1]);
+        bench::write_json(ofs, settings, results);
+    }
+    else
+    {
+        bench::write_json(std::cout, settings, results);
+    }
+
+    return ok ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,464 @@
+// Microbenchmarks of the computational kernels of MiniDNN
+//
+// Usage: bench_kernels [output.json] [--quick]
+// The results are written to the given file in JSON format, or to the
+// standard output if no file is given.
+
+#include <MiniDNN.h>
+#include <fstream>
+#include <cstring>
+#include "bench_utils.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+typedef Vector::AlignedMapType AlignedMapVec;
+
+
+// Layer::forward() with a fixed input
+struct LayerForward
+{
+    Layer& layer;
+    const Matrix& x;
+    LayerForward(Layer& layer_, const Matrix& x_) : layer(layer_), x(x_) {}
+    void operator()() { layer.forward(x); }
+};
+
+// Layer::backprop() with a fixed input and a fixed gradient from the next layer
+struct LayerBackprop
+{
+    Layer& layer;
+    const Matrix& x;
+    const Matrix& grad;
+    LayerBackprop(Layer& layer_, const Matrix& x_, const Matrix& grad_) :
+        layer(layer_), x(x_), grad(grad_) {}
+    void operator()() { layer.backprop(x, grad); }
+};
+
+struct ConvolveValid
+{
+    const internal::ConvDims& dim;
+    const Matrix& src;
+    const Vector& filter;
+    Matrix& dest;
+    ConvolveValid(const internal::ConvDims& dim_, const Matrix& src_, const Vector& filter_, Matrix& dest_) :
+        dim(dim_), src(src_), filter(filter_), dest(dest_) {}
+    void operator()()
+    {
+        internal::convolve_valid(dim, src.data(), true, src.cols(), filter.data(), dest.data());
+    }
+};
+
+struct ConvolveFull
+{
+    const internal::ConvDims& dim;
+    const Matrix& src;
+    const Vector& filter;
+    Matrix& dest;
+    ConvolveFull(const internal::ConvDims& dim_, const Matrix& src_, const Vector& filter_, Matrix& dest_) :
+        dim(dim_), src(src_), filter(filter_), dest(dest_) {}
+    void operator()()
+    {
+        internal::convolve_full(dim, src.data(), src.cols(), filter.data(), dest.data());
+    }
+};
+
+template <typename Activation>
+struct Activate
+{
+    const Matrix& z;
+    Matrix& a;
+    Activate(const Matrix& z_, Matrix& a_) : z(z_), a(a_) {}
+    void operator()() { Activation::activate(z, a); }
+};
+
+template <typename Activation>
+struct ApplyJacobian
+{
+    const Matrix& z;
+    const Matrix& a;
+    const Matrix& f;
+    Matrix& g;
+    ApplyJacobian(const Matrix& z_, const Matrix& a_, const Matrix& f_, Matrix& g_) :
+        z(z_), a(a_), f(f_), g(g_) {}
+    void operator()() { Activation::apply_jacobian(z, a, f, g); }
+};
+
+struct OptimizerUpdate
+{
+    Optimizer& opt;
+    ConstAlignedMapVec dvec;
+    AlignedMapVec vec;
+    OptimizerUpdate(Optimizer& opt_, const Vector& dvec_, Vector& vec_) :
+        opt(opt_), dvec(dvec_.data(), dvec_.size()), vec(vec_.data(), vec_.size()) {}
+    void operator()() { opt.update(dvec, vec); }
+};
+
+struct ShuffledBatches
+{
+    const Matrix& x;
+    const Matrix& y;
+    int batch_size;
+    RNG rng;
+    std::vector<Matrix> x_batches, y_batches;
+    ShuffledBatches(const Matrix& x_, const Matrix& y_, int batch_size_) :
+        x(x_), y(y_), batch_size(batch_size_), rng(1) {}
+    void operator()()
+    {
+        internal::create_shuffled_batches(x, y, batch_size, rng, x_batches, y_batches);
+    }
+};
+
+struct GatherBatch
+{
+    const Matrix& x;
+    const Matrix& y;
+    Eigen::VectorXi id;
+    int batch_size;
+    Matrix x_batch, y_batch;
+    GatherBatch(const Matrix& x_, const Matrix& y_, int batch_size_) :
+        x(x_), y(y_), id(Eigen::VectorXi::LinSpaced(x_.cols(), 0, x_.cols() - 1)),
+        batch_size(batch_size_)
+    {
+        RNG rng(1);
+        internal::shuffle(id.data(), id.size(), rng);
+    }
+    void operator()()
+    {
+        internal::gather_batch(x, y, id.data(), batch_size, x_batch, y_batch);
+    }
+};
+
+// Network::predict() on one observation
+struct NetworkPredict
+{
+    Network& net;
+    const Matrix& x;
+    NetworkPredict(Network& net_, const Matrix& x_) : net(net_), x(x_) {}
+    void operator()() { net.predict(x); }
+};
+
+// StaticNetwork::predict() on one observation
+template <typename Net>
+struct StaticNetworkPredict
+{
+    Net& net;
+    const typename Net::InputVector& x;
+    typename Net::OutputVector y;
+    StaticNetworkPredict(Net& net_, const typename Net::InputVector& x_) : net(net_), x(x_) {}
+    void operator()() { y = net.predict(x); }
+};
+
+
+void bench_fully_connected(const bench::Settings& settings, bool quick,
+                           std::vector<bench::Result>& results)
+{
+    const int sizes[] = { 64, 256, 1024 };
+    const int batches[] = { 1, 32, 256 };
+    const int nsize = quick ? 2 : 3;
+
+    for (int i = 0; i < nsize; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            const int size = sizes[i], nobs = batches[j];
+            FullyConnected<Identity> layer(size, size);
+            layer.init();
+            Matrix x = Matrix::Random(size, nobs);
+            Matrix grad = Matrix::Random(size, nobs);
+            LayerForward fwd(layer, x);
+            fwd();
+            LayerBackprop bwd(layer, x, grad);
+            bench::Result res = bench::run("FullyConnected::forward", fwd, settings, nobs,
+                                           layer.forward_cost(nobs).flops);
+            res.params["in_size"] = size;
+            res.params["out_size"] = size;
+            res.params["nobs"] = nobs;
+            results.push_back(res);
+            res = bench::run("FullyConnected::backprop", bwd, settings, nobs,
+                             layer.backprop_cost(nobs).flops);
+            res.params["in_size"] = size;
+            res.params["out_size"] = size;
+            res.params["nobs"] = nobs;
+            results.push_back(res);
+        }
+    }
+}
+
+// Inputs with a given proportion of exact zeros, as produced by a ReLU layer,
+// which let FullyConnected take the sparse path when the threshold is reached
+void bench_fully_connected_sparse(const bench::Settings& settings, bool quick,
+                                  std::vector<bench::Result>& results)
+{
+    const int size = quick ? 256 : 1024, nobs = 256;
+    const Scalar sparsity[] = { 0.5, 0.9, 0.95, 0.99 };
+
+    for (int i = 0; i < 4; i++)
+    {
+        FullyConnected<Identity> layer(size, size);
+        layer.init();
+        Matrix x = Matrix::Random(size, nobs);
+        x = (x.array().abs() < sparsity[i]).select(Scalar(0), x);
+        Matrix grad = Matrix::Random(size, nobs);
+        LayerForward fwd(layer, x);
+        fwd();
+        LayerBackprop bwd(layer, x, grad);
+        bench::Result res = bench::run("FullyConnected::forward(sparse input)", fwd, settings, nobs,
+                                       layer.forward_cost(nobs).flops);
+        res.params["in_size"] = size;
+        res.params["out_size"] = size;
+        res.params["nobs"] = nobs;
+        res.params["sparsity"] = sparsity[i];
+        results.push_back(res);
+        res = bench::run("FullyConnected::backprop(sparse input)", bwd, settings, nobs,
+                         layer.backprop_cost(nobs).flops);
+        res.params["in_size"] = size;
+        res.params["out_size"] = size;
+        res.params["nobs"] = nobs;
+        res.params["sparsity"] = sparsity[i];
+        results.push_back(res);
+    }
+}
+
+void bench_convolution(const bench::Settings& settings, bool quick,
+                       std::vector<bench::Result>& results)
+{
+    // in_channels, out_channels, rows, cols, filter_rows, filter_cols
+    const int dims[][6] = {
+        { 1,  6, 28, 28, 5, 5 },
+        { 6, 16, 12, 12, 5, 5 },
+        { 3, 16, 32, 32, 3, 3 }
+    };
+    const int nobs = quick ? 16 : 64;
+    RNG rng(123);
+
+    for (int i = 0; i < 3; i++)
+    {
+        internal::ConvDims dim(dims[i][0], dims[i][1], dims[i][2], dims[i][3], dims[i][4], dims[i][5]);
+        const int in_size = dim.in_channels * dim.channel_rows * dim.channel_cols;
+        const int out_size = dim.out_channels * dim.conv_rows * dim.conv_cols;
+        const int nfilter = dim.in_channels * dim.out_channels * dim.filter_rows * dim.filter_cols;
+        const double flops = 2.0 * nfilter * dim.conv_rows * dim.conv_cols * nobs;
+        Matrix src = Matrix::Random(in_size, nobs);
+        Vector filter = Vector::Random(nfilter);
+        Matrix dest(out_size, nobs);
+        ConvolveValid valid(dim, src, filter, dest);
+        bench::Result res = bench::run("internal::convolve_valid", valid, settings, nobs, flops);
+        res.params["in_channels"] = dim.in_channels;
+        res.params["out_channels"] = dim.out_channels;
+        res.params["channel_rows"] = dim.channel_rows;
+        res.params["channel_cols"] = dim.channel_cols;
+        res.params["filter_rows"] = dim.filter_rows;
+        res.params["filter_cols"] = dim.filter_cols;
+        res.params["nobs"] = nobs;
+        results.push_back(res);
+        // The "full" rule as used in back-propagation: from the output channels back to the input
+        internal::ConvDims full_dim(dim.out_channels, dim.in_channels, dim.conv_rows, dim.conv_cols,
+                                    dim.filter_rows, dim.filter_cols);
+        Matrix grad = Matrix::Random(out_size, nobs);
+        Matrix din(in_size, nobs);
+        ConvolveFull full(full_dim, grad, filter, din);
+        res = bench::run("internal::convolve_full", full, settings, nobs, flops);
+        res.params["in_channels"] = full_dim.in_channels;
+        res.params["out_channels"] = full_dim.out_channels;
+        res.params["channel_rows"] = full_dim.channel_rows;
+        res.params["channel_cols"] = full_dim.channel_cols;
+        res.params["filter_rows"] = full_dim.filter_rows;
+        res.params["filter_cols"] = full_dim.filter_cols;
+        res.params["nobs"] = nobs;
+        results.push_back(res);
+        // A single observation, which takes the path of latency-bound prediction
+        Convolutional<Identity> layer(dim.channel_cols, dim.channel_rows, dim.in_channels,
+                                      dim.out_channels, dim.filter_cols, dim.filter_rows);
+        layer.init(0, 0.01, rng);
+        Matrix x = Matrix::Random(in_size, 1);
+        LayerForward fwd(layer, x);
+        res = bench::run("Convolutional::forward", fwd, settings, 1, flops / nobs);
+        res.params["in_channels"] = dim.in_channels;
+        res.params["out_channels"] = dim.out_channels;
+        res.params["channel_rows"] = dim.channel_rows;
+        res.params["channel_cols"] = dim.channel_cols;
+        res.params["filter_rows"] = dim.filter_rows;
+        res.params["filter_cols"] = dim.filter_cols;
+        res.params["nobs"] = 1;
+        results.push_back(res);
+    }
+}
+
+void bench_max_pooling(const bench::Settings& settings, bool quick,
+                       std::vector<bench::Result>& results)
+{
+    const int windows[] = { 2, 3, 4 };
+    const int size = 24, channels = 8;
+    const int nobs = quick ? 16 : 64;
+
+    for (int i = 0; i < 3; i++)
+    {
+        MaxPooling<Identity> layer(size, size, channels, windows[i], windows[i]);
+        layer.init();
+        Matrix x = Matrix::Random(layer.in_size(), nobs);
+        Matrix grad = Matrix::Random(layer.out_size(), nobs);
+        LayerForward fwd(layer, x);
+        fwd();
+        LayerBackprop bwd(layer, x, grad);
+        bench::Result res = bench::run("MaxPooling::forward", fwd, settings, nobs);
+        res.params["channel_size"] = size;
+        res.params["channels"] = channels;
+        res.params["window"] = windows[i];
+        res.params["nobs"] = nobs;
+        results.push_back(res);
+        res = bench::run("MaxPooling::backprop", bwd, settings, nobs);
+        res.params["channel_size"] = size;
+        res.params["channels"] = channels;
+        res.params["window"] = windows[i];
+        res.params["nobs"] = nobs;
+        results.push_back(res);
+    }
+}
+
+template <typename Activation>
+void bench_activation(const bench::Settings& settings, const Matrix& z,
+                      std::vector<bench::Result>& results)
+{
+    Matrix a(z.rows(), z.cols()), g(z.rows(), z.cols());
+    Matrix f = Matrix::Random(z.rows(), z.cols());
+    Activation::activate(z, a);
+    Activate<Activation> act(z, a);
+    ApplyJacobian<Activation> jac(z, a, f, g);
+    const std::string name = Activation::return_type();
+    bench::Result res = bench::run(name + "::activate", act, settings, z.cols());
+    res.params["rows"] = z.rows();
+    res.params["nobs"] = z.cols();
+    results.push_back(res);
+    res = bench::run(name + "::apply_jacobian", jac, settings, z.cols());
+    res.params["rows"] = z.rows();
+    res.params["nobs"] = z.cols();
+    results.push_back(res);
+}
+
+void bench_optimizer(const std::string& name, Optimizer& opt, const bench::Settings& settings,
+                     int size, std::vector<bench::Result>& results)
+{
+    Vector dvec = Vector::Random(size) * Scalar(1e-3);
+    Vector vec = Vector::Random(size);
+    OptimizerUpdate update(opt, dvec, vec);
+    bench::Result res = bench::run(name + "::update", update, settings, size);
+    res.params["size"] = size;
+    results.push_back(res);
+}
+
+void bench_batches(const bench::Settings& settings, bool quick,
+                   std::vector<bench::Result>& results)
+{
+    const int nobs = quick ? 2000 : 10000, dimx = 100, dimy = 10, batch_size = 100;
+    Matrix x = Matrix::Random(dimx, nobs);
+    Matrix y = Matrix::Random(dimy, nobs);
+    ShuffledBatches shuffled(x, y, batch_size);
+    bench::Result res = bench::run("internal::create_shuffled_batches", shuffled, settings, nobs);
+    res.params["dimx"] = dimx;
+    res.params["dimy"] = dimy;
+    res.params["nobs"] = nobs;
+    res.params["batch_size"] = batch_size;
+    results.push_back(res);
+    GatherBatch gather(x, y, batch_size);
+    res = bench::run("internal::gather_batch", gather, settings, batch_size);
+    res.params["dimx"] = dimx;
+    res.params["dimy"] = dimy;
+    res.params["nobs"] = nobs;
+    res.params["batch_size"] = batch_size;
+    results.push_back(res);
+}
+
+// Single-observation prediction of a small model with Network and StaticNetwork
+void bench_static_network(const bench::Settings& settings, std::vector<bench::Result>& results)
+{
+    typedef StaticNetwork< FullyConnectedStatic<16, 32, ReLU>,
+                           FullyConnectedStatic<32, 32, ReLU>,
+                           FullyConnectedStatic<32, 1, Identity> > Net;
+    Network net;
+    net.add_layer(new FullyConnected<ReLU>(16, 32));
+    net.add_layer(new FullyConnected<ReLU>(32, 32));
+    net.add_layer(new FullyConnected<Identity>(32, 1));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.1, 123);
+    Net snet;
+    snet.set_parameters(net.get_parameters());
+
+    Matrix x = Matrix::Random(16, 1);
+    NetworkPredict dynamic_predict(net, x);
+    bench::Result res = bench::run("Network::predict", dynamic_predict, settings, 1);
+    res.params["nobs"] = 1;
+    results.push_back(res);
+    Net::InputVector xs = x;
+    StaticNetworkPredict<Net> static_predict(snet, xs);
+    res = bench::run("StaticNetwork::predict", static_predict, settings, 1);
+    res.params["nobs"] = 1;
+    results.push_back(res);
+}
+
+
+int main(int argc, char* argv[])
+{
+    bool quick = false;
+    const char* output = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            quick = true;
+        }
+        else
+        {
+            output = argv[i];
+        }
+    }
+
+    std::srand(123);
+    bench::Settings settings;
+
+    if (quick)
+    {
+        settings.warmup = 1;
+        settings.reps = 5;
+        settings.min_time = 0.002;
+    }
+
+    std::vector<bench::Result> results;
+    bench_fully_connected(settings, quick, results);
+    bench_fully_connected_sparse(settings, quick, results);
+    bench_convolution(settings, quick, results);
+    bench_max_pooling(settings, quick, results);
+    Matrix z = Matrix::Random(256, quick ? 32 : 256);
+    bench_activation<Identity>(settings, z, results);
+    bench_activation<ReLU>(settings, z, results);
+    bench_activation<Sigmoid>(settings, z, results);
+    bench_activation<Softmax>(settings, z, results);
+    bench_activation<Tanh>(settings, z, results);
+    bench_activation<Mish>(settings, z, results);
+    const int param_size = quick ? 10000 : 1000000;
+    SGD sgd;
+    AdaGrad adagrad;
+    RMSProp rmsprop;
+    Adam adam;
+    bench_optimizer("SGD", sgd, settings, param_size, results);
+    bench_optimizer("AdaGrad", adagrad, settings, param_size, results);
+    bench_optimizer("RMSProp", rmsprop, settings, param_size, results);
+    bench_optimizer("Adam", adam, settings, param_size, results);
+    bench_batches(settings, quick, results);
+    bench_static_network(settings, results);
+
+    if (output)
+    {
+        std::ofstream ofs(output);
+        bench::write_json(ofs, settings, results);
+    }
+    else
+    {
+        bench::write_json(std::cout, settings, results);
+    }
+
+    return 0;
+}
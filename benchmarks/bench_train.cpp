@@ -0,0 +1,368 @@
+// End-to-end training benchmark of MiniDNN
+//
+// Usage: bench_train [--workload NAME] [--output FILE]
+//                    [--baseline FILE] [--threshold T] [--save-baseline FILE]
+//
+// Trains representative models on synthetic data and reports the training
+// throughput (samples/sec), the time to reach a target training loss, and the
+// peak resident set size of the process. NAME is one of "mlp", "lenet" and
+// "sparse", and all workloads are run if it is not given. Since the peak RSS
+// is measured for the whole process, run each workload in its own process to
+// obtain per-workload memory figures, as "make check" does.
+//
+// With --baseline, the throughput of each workload is compared with the value
+// stored in the baseline file, and the program exits with status 1 if it is
+// lower than the baseline by more than the fraction T (default 0.1). The
+// baseline file has one "name samples_per_sec" pair per line, and can be
+// generated on the target hardware by --save-baseline.
+
+#include <MiniDNN.h>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include "bench_utils.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+
+// Description and results of a workload
+struct Workload
+{
+    std::string name;
+    int    nobs;
+    int    batch_size;
+    int    nepoch;
+    double target_loss;
+    double init_sd;         // Standard deviation of the initial parameters
+    // Results
+    double time;            // Total training time, in seconds
+    double samples_per_sec;
+    double time_to_target;  // Negative if the target loss is not reached
+    double final_loss;
+    double peak_rss;        // In bytes
+};
+
+// Records the time when the training loss first reaches the target
+class LossCallback: public Callback
+{
+    private:
+        const double m_target;
+        double       m_start;
+
+    public:
+        double time_to_target;
+        double last_loss;
+
+        LossCallback(double target) :
+            m_target(target), m_start(internal::wall_time()),
+            time_to_target(-1.0), last_loss(0.0)
+        {}
+
+        void post_training_batch(const Network* net, const Matrix& x, const Matrix& y)
+        {
+            last_loss = net->get_output()->loss();
+
+            if (time_to_target < 0 && last_loss <= m_target)
+            {
+                time_to_target = internal::wall_time() - m_start;
+            }
+        }
+};
+
+// One-hot class labels from a random linear teacher model
+Matrix teacher_labels(const Matrix& x, int nclass)
+{
+    Matrix w = Matrix::Random(nclass, x.rows());
+    Matrix score = w * x;
+    Matrix y = Matrix::Zero(nclass, x.cols());
+
+    for (int i = 0; i < x.cols(); i++)
+    {
+        int label;
+        score.col(i).maxCoeff(&label);
+        y(label, i) = 1;
+    }
+
+    return y;
+}
+
+// Train the network and fill in the results of the workload
+void train(Network& net, Workload& work, const Matrix& x, const Matrix& y)
+{
+    Adam opt;
+    opt.m_lrate = 0.001;
+    net.init(0, work.init_sd, 123);
+    LossCallback callback(work.target_loss);
+    net.set_callback(callback);
+    const double start = internal::wall_time();
+    net.fit(opt, x, y, work.batch_size, work.nepoch, 123);
+    work.time = internal::wall_time() - start;
+    work.samples_per_sec = double(work.nobs) * work.nepoch / work.time;
+    work.time_to_target = callback.time_to_target;
+    work.final_loss = callback.last_loss;
+    work.peak_rss = bench::peak_rss();
+    net.set_default_callback();
+}
+
+// Deep multilayer perceptron with ReLU activations
+void run_mlp(Workload& work)
+{
+    const int nfeat = 128, nhidden = 256, nlayer = 6, nclass = 10;
+    work.nobs = 4096;
+    work.batch_size = 128;
+    work.nepoch = 3;
+    work.target_loss = 1.0;
+    work.init_sd = 0.1;
+    Matrix x = Matrix::Random(nfeat, work.nobs);
+    Matrix y = teacher_labels(x, nclass);
+    Network net;
+    net.add_layer(new FullyConnected<ReLU>(nfeat, nhidden));
+
+    for (int i = 1; i < nlayer - 1; i++)
+    {
+        net.add_layer(new FullyConnected<ReLU>(nhidden, nhidden));
+    }
+
+    net.add_layer(new FullyConnected<Softmax>(nhidden, nclass));
+    net.set_output(new MultiClassEntropy());
+    train(net, work, x, y);
+}
+
+// LeNet-style stack of convolutional and max-pooling layers on 28x28 images
+void run_lenet(Workload& work)
+{
+    const int nclass = 10;
+    work.nobs = 2048;
+    work.batch_size = 64;
+    work.nepoch = 3;
+    work.target_loss = 0.5;
+    work.init_sd = 0.1;
+    // Each image is a noisy version of the template image of its class
+    Matrix templates = Matrix::Random(28 * 28, nclass);
+    Matrix x = Matrix::Random(28 * 28, work.nobs);
+    Matrix y = Matrix::Zero(nclass, work.nobs);
+
+    for (int i = 0; i < work.nobs; i++)
+    {
+        const int label = std::rand() % nclass;
+        x.col(i) += templates.col(label);
+        y(label, i) = 1;
+    }
+
+    Network net;
+    net.add_layer(new Convolutional<ReLU>(28, 28, 1, 6, 5, 5));
+    net.add_layer(new MaxPooling<Identity>(24, 24, 6, 2, 2));
+    net.add_layer(new Convolutional<ReLU>(12, 12, 6, 16, 5, 5));
+    net.add_layer(new MaxPooling<Identity>(8, 8, 16, 2, 2));
+    net.add_layer(new FullyConnected<ReLU>(4 * 4 * 16, 120));
+    net.add_layer(new FullyConnected<ReLU>(120, 84));
+    net.add_layer(new FullyConnected<Softmax>(84, nclass));
+    net.set_output(new MultiClassEntropy());
+    train(net, work, x, y);
+}
+
+// Wide input layer with mostly zero features, as in bag-of-words models
+void run_sparse(Workload& work)
+{
+    const int nfeat = 5000, nhidden = 64;
+    const double density = 0.01;
+    work.nobs = 2048;
+    work.batch_size = 128;
+    work.nepoch = 3;
+    work.target_loss = 0.1;
+    work.init_sd = 0.01;
+    Matrix x = Matrix::Zero(nfeat, work.nobs);
+    RNG rng(123);
+
+    for (int j = 0; j < work.nobs; j++)
+    {
+        for (int i = 0; i < nfeat; i++)
+        {
+            if (rng.rand() < density)
+            {
+                x(i, j) = Scalar(1);
+            }
+        }
+    }
+
+    // Sparse linear teacher model
+    Vector w = Vector::Random(nfeat) * Scalar(0.2);
+    Matrix y = w.transpose() * x;
+    Network net;
+    net.add_layer(new FullyConnected<ReLU>(nfeat, nhidden));
+    net.add_layer(new FullyConnected<Identity>(nhidden, 1));
+    net.set_output(new RegressionMSE());
+    train(net, work, x, y);
+}
+
+void read_baseline(const char* filename, std::map<std::string, double>& baseline)
+{
+    std::ifstream ifs(filename);
+    if (ifs.fail())
+    {
+        std::cerr << "Cannot open baseline file " << filename << std::endl;
+        std::exit(2);
+    }
+
+    std::string line;
+
+    while (std::getline(ifs, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream iss(line);
+        std::string name;
+        double value;
+
+        if (iss >> name >> value)
+        {
+            baseline[name] = value;
+        }
+    }
+}
+
+void write_json(std::ostream& os, const std::vector<Workload>& works)
+{
+    os.precision(6);
+    os << "{\n  \"scalar_bytes\": " << sizeof(Scalar) << ",\n  \"results\": [";
+
+    for (std::size_t i = 0; i < works.size(); i++)
+    {
+        const Workload& w = works[i];
+        os << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << w.name << "\""
+           << ", \"nobs\": " << w.nobs << ", \"batch_size\": " << w.batch_size
+           << ", \"nepoch\": " << w.nepoch << ", \"time_sec\": " << w.time
+           << ", \"samples_per_sec\": " << w.samples_per_sec
+           << ", \"target_loss\": " << w.target_loss << ", \"time_to_target_sec\": ";
+
+        if (w.time_to_target >= 0)
+            os << w.time_to_target;
+        else
+            os << "null";
+
+        os << ", \"final_loss\": " << w.final_loss
+           << ", \"peak_rss_mb\": " << w.peak_rss / 1048576.0 << "}";
+    }
+
+    os << "\n  ]\n}" << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::string workload;
+    const char* output = NULL;
+    const char* baseline_file = NULL;
+    const char* save_file = NULL;
+    double threshold = 0.1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool has_value = (i + 1 < argc);
+
+        if (std::strcmp(argv[i], "--workload") == 0 && has_value)
+            workload = argv[++i];
+        else if (std::strcmp(argv[i], "--output") == 0 && has_value)
+            output = argv[++i];
+        else if (std::strcmp(argv[i], "--baseline") == 0 && has_value)
+            baseline_file = argv[++i];
+        else if (std::strcmp(argv[i], "--save-baseline") == 0 && has_value)
+            save_file = argv[++i];
+        else if (std::strcmp(argv[i], "--threshold") == 0 && has_value)
+            threshold = std::atof(argv[++i]);
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    const char* names[] = { "mlp", "lenet", "sparse" };
+    void (*funs[])(Workload&) = { run_mlp, run_lenet, run_sparse };
+    std::vector<Workload> works;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (!workload.empty() && workload != names[i])
+            continue;
+
+        std::srand(123);
+        Workload work;
+        work.name = names[i];
+        funs[i](work);
+        works.push_back(work);
+    }
+
+    if (works.empty())
+    {
+        std::cerr << "Unknown workload " << workload << std::endl;
+        return 2;
+    }
+
+    if (output)
+    {
+        std::ofstream ofs(output);
+        write_json(ofs, works);
+    }
+    else
+    {
+        write_json(std::cout, works);
+    }
+
+    if (save_file)
+    {
+        // Update the entries of the workloads that were run, keeping the others
+        std::map<std::string, double> baseline;
+        std::ifstream exists(save_file);
+        if (exists.good())
+            read_baseline(save_file, baseline);
+
+        for (std::size_t i = 0; i < works.size(); i++)
+            baseline[works[i].name] = works[i].samples_per_sec;
+
+        std::ofstream ofs(save_file);
+        ofs << "# workload samples_per_sec" << std::endl;
+
+        for (std::map<std::string, double>::const_iterator it = baseline.begin();
+             it != baseline.end(); it++)
+        {
+            ofs << it->first << " " << it->second << std::endl;
+        }
+    }
+
+    int status = 0;
+
+    if (baseline_file)
+    {
+        std::map<std::string, double> baseline;
+        read_baseline(baseline_file, baseline);
+
+        for (std::size_t i = 0; i < works.size(); i++)
+        {
+            const Workload& w = works[i];
+            std::map<std::string, double>::const_iterator it = baseline.find(w.name);
+
+            if (it == baseline.end())
+            {
+                std::cerr << w.name << ": no baseline" << std::endl;
+                continue;
+            }
+
+            const double ratio = w.samples_per_sec / it->second;
+            const bool regressed = (ratio < 1.0 - threshold);
+            std::cerr << w.name << ": " << w.samples_per_sec << " samples/sec, "
+                      << ratio * 100.0 << "% of baseline"
+                      << (regressed ? " -- REGRESSION" : "") << std::endl;
+
+            if (regressed)
+                status = 1;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,175 @@
+#ifndef BENCH_UTILS_H_
+#define BENCH_UTILS_H_
+
+#include <MiniDNN.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+namespace bench
+{
+
+
+// Settings shared by all benchmarks
+struct Settings
+{
+    int    warmup;     // Number of untimed warm-up runs
+    int    reps;       // Number of timed repetitions
+    double min_time;   // Each repetition runs the kernel enough times to last at least min_time seconds
+
+    Settings() :
+        warmup(3), reps(15), min_time(0.01)
+    {}
+};
+
+// Summary statistics of the repetitions, with times in seconds per call
+struct Result
+{
+    std::string                   name;
+    std::map<std::string, double> params;   // Kernel parameters, e.g. sizes
+    int    reps;
+    long   calls_per_rep;
+    double min;
+    double median;
+    double mean;
+    double stddev;
+    double max;
+    double items;   // Items (typically observations) processed per call
+    double flops;   // Analytical floating-point operations per call, 0 if not applicable
+};
+
+// Time a kernel object that provides "void operator()()"
+template <typename Kernel>
+Result run(const std::string& name, Kernel& kernel, const Settings& settings,
+           double items = 0, double flops = 0)
+{
+    using MiniDNN::internal::wall_time;
+
+    for (int i = 0; i < settings.warmup; i++)
+    {
+        kernel();
+    }
+
+    // Calibrate the number of calls per repetition
+    long ncall = 1;
+    double start = wall_time();
+    kernel();
+    double elapsed = wall_time() - start;
+
+    if (elapsed < settings.min_time)
+    {
+        ncall = long(settings.min_time / std::max(elapsed, 1e-9)) + 1;
+    }
+
+    std::vector<double> times(settings.reps);
+
+    for (int i = 0; i < settings.reps; i++)
+    {
+        start = wall_time();
+
+        for (long j = 0; j < ncall; j++)
+        {
+            kernel();
+        }
+
+        times[i] = (wall_time() - start) / ncall;
+    }
+
+    Result res;
+    res.name = name;
+    res.reps = settings.reps;
+    res.calls_per_rep = ncall;
+    res.items = items;
+    res.flops = flops;
+    std::sort(times.begin(), times.end());
+    res.min = times.front();
+    res.max = times.back();
+    const int n = times.size();
+    res.median = (n % 2 == 1) ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+    double sum = 0, sum2 = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        sum += times[i];
+        sum2 += times[i] * times[i];
+    }
+
+    res.mean = sum / n;
+    res.stddev = (n > 1) ? std::sqrt(std::max(0.0, (sum2 - sum * sum / n) / (n - 1))) : 0.0;
+    return res;
+}
+
+// Peak resident set size of the process so far, in bytes
+inline double peak_rss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return double(pmc.PeakWorkingSetSize);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return double(usage.ru_maxrss);          // In bytes on macOS
+#else
+    return double(usage.ru_maxrss) * 1024.0; // In kilobytes on Linux
+#endif
+#endif
+}
+
+// Write the results as a JSON document
+inline void write_json(std::ostream& os, const Settings& settings,
+                       const std::vector<Result>& results)
+{
+    os.precision(6);
+    os << "{\n  \"settings\": {\"warmup\": " << settings.warmup
+       << ", \"reps\": " << settings.reps
+       << ", \"min_time\": " << settings.min_time
+       << ", \"scalar_bytes\": " << sizeof(MiniDNN::Scalar) << "},\n";
+    os << "  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        os << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << r.name << "\", \"params\": {";
+
+        for (std::map<std::string, double>::const_iterator it = r.params.begin();
+             it != r.params.end(); it++)
+        {
+            os << (it == r.params.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+        }
+
+        os << "}, \"reps\": " << r.reps << ", \"calls_per_rep\": " << r.calls_per_rep
+           << ", \"latency_sec\": {\"min\": " << r.min << ", \"median\": " << r.median
+           << ", \"mean\": " << r.mean << ", \"stddev\": " << r.stddev << ", \"max\": " << r.max << "}";
+
+        if (r.items > 0)
+        {
+            os << ", \"items_per_sec\": " << r.items / r.median;
+        }
+
+        if (r.flops > 0)
+        {
+            os << ", \"gflops\": " << r.flops / r.median * 1e-9;
+        }
+
+        os << "}";
+    }
+
+    os << "\n  ]\n}" << std::endl;
+}
+
+
+} // namespace bench
+
+
+#endif /* BENCH_UTILS_H_ */
@@ -0,0 +1,83 @@
+// Check of the deterministic mode of MiniDNN
+//
+// Usage: check_deterministic
+//
+// Trains the same models with Network::set_deterministic(true) and 1, 4 and
+// 16 worker threads, and exits with status 1 if the resulting parameters are
+// not bit-for-bit identical. "make check" runs this program. Building it with
+// OpenMP, e.g. "make CXXFLAGS='-O2 -DNDEBUG -fopenmp'", also covers the limit
+// on Eigen's own parallelization.
+
+#include <MiniDNN.h>
+#include <iostream>
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef std::vector< std::vector<Scalar> > Parameters;
+
+
+void build_mlp(Network& net)
+{
+    net.add_layer(new FullyConnected<ReLU>(64, 128));
+    net.add_layer(new FullyConnected<ReLU>(128, 64));
+    net.add_layer(new FullyConnected<Softmax>(64, 10));
+    net.set_output(new MultiClassEntropy());
+}
+
+void build_cnn(Network& net)
+{
+    net.add_layer(new Convolutional<ReLU>(8, 8, 1, 4, 3, 3));
+    net.add_layer(new MaxPooling<ReLU>(6, 6, 4, 2, 2));
+    net.add_layer(new FullyConnected<Softmax>(36, 10));
+    net.set_output(new MultiClassEntropy());
+}
+
+// Train a model with the given number of threads and return its parameters
+Parameters train(void (*build)(Network&), const Matrix& x, const Matrix& y, int nthread)
+{
+    Network net;
+    build(net);
+    net.set_deterministic(true);
+    net.set_num_threads(nthread);
+    net.init(0, 0.1, 123);
+    Adam opt;
+    net.fit(opt, x, y, 32, 3, 123);
+    return net.get_parameters();
+}
+
+// Compare the parameters trained with several numbers of threads
+bool check(const std::string& name, void (*build)(Network&), int nrow)
+{
+    std::srand(123);
+    const int nobs = 512;
+    const Matrix x = Matrix::Random(nrow, nobs);
+    Matrix y = Matrix::Zero(10, nobs);
+
+    for (int j = 0; j < nobs; j++)
+    {
+        y(std::rand() % 10, j) = 1;
+    }
+
+    const int nthreads[] = { 1, 4, 16 };
+    const Parameters ref = train(build, x, y, nthreads[0]);
+    bool ok = true;
+
+    for (int k = 1; k < 3; k++)
+    {
+        const bool same = (train(build, x, y, nthreads[k]) == ref);
+        std::cout << name << ": " << nthreads[k] << " threads vs " << nthreads[0] << " thread "
+                  << (same ? "identical" : "DIFFERENT") << std::endl;
+        ok = ok && same;
+    }
+
+    return ok;
+}
+
+
+int main()
+{
+    const bool mlp = check("mlp", build_mlp, 64);
+    const bool cnn = check("cnn", build_cnn, 64);
+    return (mlp && cnn) ? 0 : 1;
+}
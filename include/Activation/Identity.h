@@ -19,13 +19,16 @@ namespace MiniDNN
 ///
 class Identity
 {
-    private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
-
     public:
+        // The Jacobian does not depend on Z, so layers need not keep Z, and
+        // apply_jacobian() may be called with G and A pointing to the same matrix
+        static const bool jacobian_needs_input = false;
+
         // a = activation(z) = z
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        // Note: Z and A may point to the same matrix
+        template <typename MatrixZ, typename MatrixA>
+        static inline void activate(const MatrixZ& Z, MatrixA& A)
         {
             A.noalias() = Z;
         }
@@ -35,8 +38,9 @@ class Identity
         // g = J * f = f
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename MatrixZ, typename MatrixA, typename MatrixF, typename MatrixG>
+        static inline void apply_jacobian(const MatrixZ& Z, const MatrixA& A,
+                                          const MatrixF& F, MatrixG& G)
         {
             G.noalias() = F;
         }
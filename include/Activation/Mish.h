@@ -17,15 +17,16 @@ namespace MiniDNN
 ///
 class Mish
 {
-    private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
-
     public:
+        // The Jacobian needs both Z and A
+        static const bool jacobian_needs_input = true;
+
         // Mish(x) = x * tanh(softplus(x))
         // softplus(x) = log(1 + exp(x))
         // a = activation(z) = Mish(z)
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        template <typename MatrixZ, typename MatrixA>
+        static inline void activate(const MatrixZ& Z, MatrixA& A)
         {
             // h(x) = tanh(softplus(x)) = (1 + exp(x))^2 - 1
             //                            ------------------
@@ -33,7 +34,7 @@ class Mish
             // Let s = exp(-abs(x)), t = 1 + s
             // If x >= 0, then h(x) = (t^2 - s^2) / (t^2 + s^2)
             // If x <= 0, then h(x) = (t^2 - 1) / (t^2 + 1)
-            Matrix S = (-Z.array().abs()).exp();
+            MatrixA S = (-Z.array().abs()).exp();
             A.array() = (S.array() + Scalar(1)).square();  // t^2
             S.noalias() = (Z.array() >= Scalar(0)).select(S.cwiseAbs2(), Scalar(1));  // s^2 or 1
             A.array() = (A.array() - S.array()) / (A.array() + S.array());
@@ -45,8 +46,9 @@ class Mish
         // g = J * f = Mish'(z) .* f
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename MatrixZ, typename MatrixA, typename MatrixF, typename MatrixG>
+        static inline void apply_jacobian(const MatrixZ& Z, const MatrixA& A,
+                                          const MatrixF& F, MatrixG& G)
         {
             // Let h(x) = tanh(softplus(x))
             // Mish'(x) = h(x) + x * h'(x)
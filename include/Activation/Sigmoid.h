@@ -15,13 +15,16 @@ namespace MiniDNN
 ///
 class Sigmoid
 {
-    private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
-
     public:
+        // The Jacobian is expressed in terms of A only, so layers need not keep Z,
+        // and apply_jacobian() may be called with G and A pointing to the same matrix
+        static const bool jacobian_needs_input = false;
+
         // a = activation(z) = 1 / (1 + exp(-z))
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        // Note: Z and A may point to the same matrix
+        template <typename MatrixZ, typename MatrixA>
+        static inline void activate(const MatrixZ& Z, MatrixA& A)
         {
             A.array() = Scalar(1) / (Scalar(1) + (-Z.array()).exp());
         }
@@ -31,8 +34,9 @@ class Sigmoid
         // g = J * f = a .* (1 - a) .* f
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename MatrixZ, typename MatrixA, typename MatrixF, typename MatrixG>
+        static inline void apply_jacobian(const MatrixZ& Z, const MatrixA& A,
+                                          const MatrixF& F, MatrixG& G)
         {
             G.array() = A.array() * (Scalar(1) - A.array()) * F.array();
         }
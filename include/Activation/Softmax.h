@@ -12,16 +12,29 @@ namespace MiniDNN
 ///
 class Softmax
 {
-    private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
-        typedef Eigen::Array<Scalar, 1, Eigen::Dynamic> RowArray;
-
     public:
+        // The Jacobian is expressed in terms of A only, so layers need not keep Z,
+        // and apply_jacobian() may be called with G and A pointing to the same matrix
+        static const bool jacobian_needs_input = false;
+
         // a = activation(z) = softmax(z)
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        // Note: Z and A may point to the same matrix
+        template <typename MatrixZ, typename MatrixA>
+        static inline void activate(const MatrixZ& Z, MatrixA& A)
         {
-            A.array() = (Z.rowwise() - Z.colwise().maxCoeff()).array().exp();
+            // A single observation needs no temporary row vectors
+            if (Z.cols() == 1)
+            {
+                const Scalar zmax = Z.maxCoeff();
+                A.array() = (Z.array() - zmax).exp();
+                A.array() /= A.sum();
+                return;
+            }
+
+            typedef Eigen::Array<Scalar, 1, MatrixZ::ColsAtCompileTime> RowArray;
+            RowArray colmax = Z.colwise().maxCoeff();
+            A.array() = (Z.array().rowwise() - colmax).exp();
             RowArray colsums = A.colwise().sum();
             A.array().rowwise() /= colsums;
         }
@@ -31,9 +44,11 @@ class Softmax
         // g = J * f = a .* f - a * (a' * f) = a .* (f - a'f)
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename MatrixZ, typename MatrixA, typename MatrixF, typename MatrixG>
+        static inline void apply_jacobian(const MatrixZ& Z, const MatrixA& A,
+                                          const MatrixF& F, MatrixG& G)
         {
+            typedef Eigen::Array<Scalar, 1, MatrixA::ColsAtCompileTime> RowArray;
             RowArray a_dot_f = A.cwiseProduct(F).colwise().sum();
             G.array() = A.array() * (F.array().rowwise() - a_dot_f);
         }
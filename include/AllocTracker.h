@@ -0,0 +1,360 @@
+#ifndef ALLOCTRACKER_H_
+#define ALLOCTRACKER_H_
+
+#include <cstddef>
+#include "Config.h"
+#ifdef MDNN_USE_THREADS
+    #include <atomic>
+#endif
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Profiling
+///
+/// Snapshot of the heap allocation counters of the process
+///
+struct AllocStats
+{
+    long   count; // Number of allocations since the program started
+    double bytes; // Total number of bytes allocated since the program started
+    double live;  // Number of bytes currently allocated
+    double peak;  // Peak number of bytes allocated, see AllocTracker::reset_peak()
+
+    AllocStats() :
+        count(0), bytes(0.0), live(0.0), peak(0.0)
+    {}
+};
+
+
+namespace internal
+{
+
+
+#ifdef MDNN_USE_THREADS
+typedef std::atomic<std::ptrdiff_t> AllocCounter;
+#else
+typedef std::ptrdiff_t AllocCounter;
+#endif
+
+struct AllocCounters
+{
+    AllocCounter installed;
+    AllocCounter count;
+    AllocCounter bytes;
+    AllocCounter live;
+    AllocCounter peak;
+};
+
+// The counters are zero-initialized before any dynamic initialization, so they
+// can be safely used by the allocation hooks at any time
+inline AllocCounters& alloc_counters()
+{
+    static AllocCounters counters;
+    return counters;
+}
+
+// Called by the allocation hooks
+inline void alloc_record(std::size_t size)
+{
+    AllocCounters& c = alloc_counters();
+    c.count += 1;
+    c.bytes += std::ptrdiff_t(size);
+    const std::ptrdiff_t live = (c.live += std::ptrdiff_t(size));
+#ifdef MDNN_USE_THREADS
+    std::ptrdiff_t peak = c.peak.load();
+
+    while (live > peak && !c.peak.compare_exchange_weak(peak, live)) {}
+#else
+    if (live > c.peak)
+        c.peak = live;
+#endif
+}
+
+inline void alloc_release(std::size_t size)
+{
+    alloc_counters().live -= std::ptrdiff_t(size);
+}
+
+
+} // namespace internal
+
+
+///
+/// \ingroup Profiling
+///
+/// Opt-in tracker of heap allocations.
+///
+/// The tracker counts the number and the size of heap allocations of the whole
+/// process, including the storage of Eigen matrices, temporaries of the
+/// convolution routines, and copies of `std::vector`. The counting hooks are
+/// compiled into the program by defining the macro `MDNN_ALLOC_TRACKER_HOOKS`
+/// in **exactly one** source file before including this header or MiniDNN.h,
+/// typically in a test or benchmark build:
+///
+/// \code
+/// #define MDNN_ALLOC_TRACKER_HOOKS
+/// #include <MiniDNN.h>
+/// \endcode
+///
+/// On glibc, the hooks replace `malloc()` and friends, so that every allocation
+/// is seen. On other platforms they replace the global `operator new` and
+/// `operator delete`, which do not see the storage of Eigen objects.
+///
+/// When the hooks are installed and the profiler is switched on by
+/// Network::set_profiling(), the network additionally records the number of
+/// allocations, the bytes allocated and the peak working set of each phase in
+/// the Profiler, for each layer and for each mini-batch (Profiler::TRAIN_STEP).
+/// Allocations made by other threads, such as the one that prefetches
+/// mini-batches, are attributed to the phase running on the main thread, so
+/// prefetching may need to be switched off for an exact breakdown.
+///
+/// The counters can also be read directly to check how much a piece of code
+/// allocates in steady state:
+///
+/// \code
+/// net.train_step(opt, x, y);  // Warm-up, buffers are allocated
+/// const long before = AllocTracker::stats().count;
+/// net.train_step(opt, x, y);
+/// std::cout << AllocTracker::stats().count - before << " allocations" << std::endl;
+/// \endcode
+///
+/// For example, a network of FullyConnected layers trained on the calling
+/// thread makes no allocation once warmed up, whereas the convolution kernels
+/// allocate their work matrices in each call, and each task sent to the thread
+/// pool (see Network::set_num_threads()) allocates a few small blocks for its
+/// bookkeeping.
+///
+class AllocTracker
+{
+    public:
+        ///
+        /// Whether the allocation hooks are compiled into the program
+        ///
+        static bool installed()
+        {
+            return internal::alloc_counters().installed != 0;
+        }
+
+        ///
+        /// Current values of the counters
+        ///
+        static AllocStats stats()
+        {
+            const internal::AllocCounters& c = internal::alloc_counters();
+            AllocStats res;
+            res.count = long(c.count);
+            res.bytes = double(std::ptrdiff_t(c.bytes));
+            res.live = double(std::ptrdiff_t(c.live));
+            res.peak = double(std::ptrdiff_t(c.peak));
+            return res;
+        }
+
+        ///
+        /// Set the peak to the number of bytes currently allocated, so that
+        /// the subsequent peak can be measured
+        ///
+        static void reset_peak()
+        {
+            internal::AllocCounters& c = internal::alloc_counters();
+            c.peak = std::ptrdiff_t(c.live);
+        }
+
+        ///
+        /// Raise the peak to at least the given value. Used to restore an
+        /// earlier peak after a nested measurement has called reset_peak().
+        ///
+        static void restore_peak(double peak)
+        {
+            internal::AllocCounters& c = internal::alloc_counters();
+
+            if (std::ptrdiff_t(peak) > std::ptrdiff_t(c.peak))
+                c.peak = std::ptrdiff_t(peak);
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#ifdef MDNN_ALLOC_TRACKER_HOOKS
+
+#include <cstdlib>
+#include <cerrno>
+#include <new>
+
+namespace MiniDNN
+{
+namespace internal
+{
+
+
+// Marks the hooks as installed during static initialization
+struct AllocHooksInstaller
+{
+    AllocHooksInstaller()
+    {
+        alloc_counters().installed = 1;
+    }
+};
+
+static AllocHooksInstaller alloc_hooks_installer;
+
+
+} // namespace internal
+} // namespace MiniDNN
+
+
+#if defined(__GLIBC__)
+
+#include <malloc.h>
+
+// Replace the allocation functions of the C library, and forward the calls to
+// the glibc implementations. The allocated sizes are measured by
+// malloc_usable_size(), so that allocations and deallocations match.
+extern "C" {
+
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t n, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+void  __libc_free(void* ptr);
+
+void* malloc(std::size_t size) __THROW
+{
+    void* ptr = __libc_malloc(size);
+    if (ptr)
+        MiniDNN::internal::alloc_record(malloc_usable_size(ptr));
+    return ptr;
+}
+
+void* calloc(std::size_t n, std::size_t size) __THROW
+{
+    void* ptr = __libc_calloc(n, size);
+    if (ptr)
+        MiniDNN::internal::alloc_record(malloc_usable_size(ptr));
+    return ptr;
+}
+
+void* realloc(void* ptr, std::size_t size) __THROW
+{
+    const std::size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    void* res = __libc_realloc(ptr, size);
+
+    // On failure the original block is left untouched
+    if (res || size == 0)
+    {
+        MiniDNN::internal::alloc_release(old_size);
+        if (res)
+            MiniDNN::internal::alloc_record(malloc_usable_size(res));
+    }
+
+    return res;
+}
+
+void* memalign(std::size_t alignment, std::size_t size) __THROW
+{
+    void* ptr = __libc_memalign(alignment, size);
+    if (ptr)
+        MiniDNN::internal::alloc_record(malloc_usable_size(ptr));
+    return ptr;
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size) __THROW
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** memptr, std::size_t alignment, std::size_t size) __THROW
+{
+    void* ptr = memalign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void free(void* ptr) __THROW
+{
+    if (ptr)
+        MiniDNN::internal::alloc_release(malloc_usable_size(ptr));
+    __libc_free(ptr);
+}
+
+} // extern "C"
+
+#else
+
+// Replace the global operator new and operator delete. The size of each block
+// is stored in a header in front of it.
+namespace MiniDNN
+{
+namespace internal
+{
+
+
+// Keep the maximum alignment of fundamental types
+const std::size_t alloc_header_size = 16;
+
+inline void* tracked_new(std::size_t size)
+{
+    void* block = std::malloc(size + alloc_header_size);
+    if (!block)
+        throw std::bad_alloc();
+    *static_cast<std::size_t*>(block) = size;
+    alloc_record(size);
+    return static_cast<char*>(block) + alloc_header_size;
+}
+
+inline void tracked_delete(void* ptr)
+{
+    if (!ptr)
+        return;
+    void* block = static_cast<char*>(ptr) - alloc_header_size;
+    alloc_release(*static_cast<std::size_t*>(block));
+    std::free(block);
+}
+
+
+} // namespace internal
+} // namespace MiniDNN
+
+#if __cplusplus >= 201103L
+    #define MDNN_THROW_BAD_ALLOC
+    #define MDNN_NO_THROW noexcept
+#else
+    #define MDNN_THROW_BAD_ALLOC throw(std::bad_alloc)
+    #define MDNN_NO_THROW throw()
+#endif
+
+void* operator new(std::size_t size) MDNN_THROW_BAD_ALLOC
+{
+    return MiniDNN::internal::tracked_new(size);
+}
+
+void* operator new[](std::size_t size) MDNN_THROW_BAD_ALLOC
+{
+    return MiniDNN::internal::tracked_new(size);
+}
+
+void operator delete(void* ptr) MDNN_NO_THROW
+{
+    MiniDNN::internal::tracked_delete(ptr);
+}
+
+void operator delete[](void* ptr) MDNN_NO_THROW
+{
+    MiniDNN::internal::tracked_delete(ptr);
+}
+
+#undef MDNN_THROW_BAD_ALLOC
+#undef MDNN_NO_THROW
+
+#endif /* __GLIBC__ */
+
+#endif /* MDNN_ALLOC_TRACKER_HOOKS */
+
+
+#endif /* ALLOCTRACKER_H_ */
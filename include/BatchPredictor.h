@@ -0,0 +1,339 @@
+#ifndef BATCHPREDICTOR_H_
+#define BATCHPREDICTOR_H_
+
+#include "Config.h"
+
+#ifdef MDNN_USE_THREADS
+
+#include <Eigen/Core>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <exception>
+#include "Network.h"
+#include "Utils/Timer.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Network
+///
+/// Counters of a BatchPredictor
+///
+struct BatchStats
+{
+    long   nrequest;      // Number of requests answered
+    long   nbatch;        // Number of batches evaluated
+    int    max_batch;     // Size of the largest batch
+    double queue_time;    // Total time that the requests waited before their batch
+                          // was evaluated, in seconds
+    double predict_time;  // Total wall time of the batched predictions
+
+    BatchStats() :
+        nrequest(0), nbatch(0), max_batch(0), queue_time(0.0), predict_time(0.0)
+    {}
+
+    ///
+    /// Average number of requests per batch
+    ///
+    double mean_batch() const
+    {
+        return (nbatch > 0) ? double(nrequest) / double(nbatch) : 0.0;
+    }
+};
+
+///
+/// \ingroup Network
+///
+/// Combines single observations submitted by concurrent callers into batches
+/// for the prediction of a model
+///
+/// A prediction of one observation mostly consists of matrix-vector products,
+/// whereas a batch of observations is evaluated by matrix-matrix products,
+/// which are several times faster per observation. The requests passed to
+/// submit() are queued, and a worker thread evaluates them together once
+/// `max_batch` requests are waiting, or once the oldest of them has waited for
+/// `max_delay` seconds. Each caller receives its own column of the result
+/// through a `std::future`.
+///
+/// \code
+/// BatchPredictor<Network> batcher(net, 32, 0.001);
+/// // In each request handler
+/// Vector y = batcher.submit(x).get();
+/// \endcode
+///
+/// The model is only used by the worker thread, which is all that a Network
+/// supports, so it must not be used elsewhere while the batcher exists.
+/// `Model` can be any class with a member function
+/// `Matrix predict(const Matrix&)`, such as Network and ModelHolder, whose
+/// models can thus be replaced while requests are being batched.
+///
+/// This class is only available when `MDNN_USE_THREADS` is defined.
+///
+/// \tparam Model The type of the model.
+///
+template <typename Model = Network>
+class BatchPredictor
+{
+    public:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef std::chrono::steady_clock Clock;
+
+        struct Request
+        {
+            Vector               x;
+            std::promise<Vector> result;
+            Clock::time_point    time;   // Time of submission
+            bool                 valid;  // Whether the request is part of the evaluated group
+            bool                 done;   // Whether the request has been evaluated
+        };
+
+        Model&                  m_model;
+        const int               m_max_batch;  // Maximum number of requests in a batch
+        const Clock::duration   m_max_delay;  // Maximum time that a request waits for others
+        std::deque<Request>     m_queue;      // Requests that have not been evaluated
+        bool                    m_stop;
+        BatchStats              m_stats;
+        mutable std::mutex      m_mutex;
+        std::condition_variable m_cond;
+        std::thread             m_thread;
+
+        BatchPredictor(const BatchPredictor&);
+        BatchPredictor& operator=(const BatchPredictor&);
+
+        // Evaluate the requests of a batch that have nrow predictors, and deliver
+        // their results
+        void run_group(std::vector<Request>& batch, int nrow, Matrix& x)
+        {
+            int ncol = 0;
+
+            for (std::size_t i = 0; i < batch.size(); i++)
+            {
+                batch[i].valid = (!batch[i].done && batch[i].x.size() == nrow);
+                ncol += batch[i].valid;
+            }
+
+            x.resize(nrow, ncol);
+
+            for (std::size_t i = 0, j = 0; i < batch.size(); i++)
+            {
+                if (batch[i].valid)
+                {
+                    x.col(j) = batch[i].x;
+                    batch[i].done = true;
+                    j++;
+                }
+            }
+
+            Matrix y;
+
+            try
+            {
+                y = m_model.predict(x);
+            }
+            catch (...)
+            {
+                for (std::size_t i = 0; i < batch.size(); i++)
+                {
+                    if (batch[i].valid)
+                    {
+                        batch[i].result.set_exception(std::current_exception());
+                    }
+                }
+                return;
+            }
+
+            for (std::size_t i = 0, j = 0; i < batch.size(); i++)
+            {
+                if (batch[i].valid)
+                {
+                    batch[i].result.set_value(y.col(j));
+                    j++;
+                }
+            }
+        }
+
+        // Evaluate a batch of requests and deliver the results
+        void run_batch(std::vector<Request>& batch, Matrix& x)
+        {
+            for (std::size_t i = 0; i < batch.size(); i++)
+            {
+                batch[i].done = false;
+            }
+
+            // Requests are evaluated together with the others of the same
+            // dimension, so a malformed request only fails on its own, with the
+            // error reported by the model. Normally there is a single group.
+            for (std::size_t i = 0; i < batch.size(); i++)
+            {
+                if (!batch[i].done)
+                {
+                    run_group(batch, batch[i].x.size(), x);
+                }
+            }
+        }
+
+        void worker()
+        {
+            std::vector<Request> batch;
+            Matrix x;
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (true)
+            {
+                m_cond.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+
+                // Requests submitted before the batcher is stopped are still answered
+                if (m_queue.empty())
+                {
+                    return;
+                }
+
+                // Wait for more requests until the batch is full or the oldest
+                // request is due
+                const Clock::time_point deadline = m_queue.front().time + m_max_delay;
+                m_cond.wait_until(lock, deadline, [this]() {
+                    return m_stop || int(m_queue.size()) >= m_max_batch;
+                });
+
+                const int n = std::min(int(m_queue.size()), m_max_batch);
+                const Clock::time_point start = Clock::now();
+                double queue_time = 0.0;
+                batch.clear();
+
+                for (int i = 0; i < n; i++)
+                {
+                    queue_time += std::chrono::duration<double>(start - m_queue.front().time).count();
+                    batch.push_back(std::move(m_queue.front()));
+                    m_queue.pop_front();
+                }
+
+                lock.unlock();
+                const double predict_start = internal::wall_time();
+                run_batch(batch, x);
+                const double predict_time = internal::wall_time() - predict_start;
+                lock.lock();
+
+                m_stats.nrequest += n;
+                m_stats.nbatch++;
+                m_stats.max_batch = std::max(m_stats.max_batch, n);
+                m_stats.queue_time += queue_time;
+                m_stats.predict_time += predict_time;
+            }
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param model     The model, which must outlive the batcher.
+        /// \param max_batch Maximum number of observations evaluated together.
+        /// \param max_delay Maximum time in seconds that a request waits for
+        ///                  other requests before its batch is evaluated. It
+        ///                  bounds the latency added to a request when the load
+        ///                  is low.
+        ///
+        BatchPredictor(Model& model, int max_batch, double max_delay) :
+            m_model(model), m_max_batch(max_batch),
+            m_max_delay(std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(max_delay))),
+            m_stop(false)
+        {
+            if (max_batch <= 0)
+            {
+                throw std::invalid_argument("[class BatchPredictor]: Maximum batch size must be positive");
+            }
+
+            if (max_delay < 0)
+            {
+                throw std::invalid_argument("[class BatchPredictor]: Maximum delay must be nonnegative");
+            }
+
+            m_thread = std::thread(&BatchPredictor::worker, this);
+        }
+
+        ///
+        /// Destructor, which answers the pending requests
+        ///
+        ~BatchPredictor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cond.notify_all();
+            m_thread.join();
+        }
+
+        ///
+        /// Queue one observation for prediction. This function can be called
+        /// from several threads at the same time.
+        ///
+        /// \param x The predictors of one observation.
+        ///
+        /// \return A future that receives the output of the observation, or the
+        ///         exception thrown by the prediction.
+        ///
+        std::future<Vector> submit(const Vector& x)
+        {
+            Request req;
+            req.x = x;
+            std::future<Vector> res = req.result.get_future();
+            bool notify;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                req.time = Clock::now();
+                m_queue.push_back(std::move(req));
+                // The worker only needs to wake up for the first request of a
+                // batch, and when the batch is full
+                const int n = m_queue.size();
+                notify = (n == 1 || n == m_max_batch);
+            }
+
+            if (notify)
+            {
+                m_cond.notify_all();
+            }
+
+            return res;
+        }
+
+        ///
+        /// Predict one observation, and wait for the result
+        ///
+        /// \param x The predictors of one observation.
+        ///
+        Vector predict(const Vector& x)
+        {
+            return submit(x).get();
+        }
+
+        ///
+        /// Counters of the requests and batches so far
+        ///
+        BatchStats stats() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_stats;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* MDNN_USE_THREADS */
+
+#endif /* BATCHPREDICTOR_H_ */
@@ -52,6 +52,8 @@ class Callback
                                         const IntegerVector& y) {}
 
         // After a mini-batch is trained
+        // Layer::output() of the hidden layers may then contain gradients, see
+        // the documentation of Layer::output()
         virtual void post_training_batch(const Network* net, const Matrix& x,
                                          const Matrix& y) {}
         virtual void post_training_batch(const Network* net, const Matrix& x,
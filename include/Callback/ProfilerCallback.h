@@ -0,0 +1,175 @@
+#ifndef CALLBACK_PROFILERCALLBACK_H_
+#define CALLBACK_PROFILERCALLBACK_H_
+
+#include <Eigen/Core>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "../Config.h"
+#include "../Callback.h"
+#include "../Profiler.h"
+#include "../AllocTracker.h"
+#include "../Network.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Callbacks
+///
+/// Callback function that prints a table of the profiling results at the end
+/// of each epoch. The table contains the time spent in each phase of each layer
+/// during that epoch, and for the forward pass and back-propagation, the achieved
+/// GFLOP/s and GB/s computed from the analytical costs of the layers. If the
+/// allocation hooks of AllocTracker are installed, the table also contains the
+/// number of heap allocations per call, the kilobytes allocated per call, and
+/// the peak working set allocated during a call.
+///
+/// The profiler of the network needs to be switched on by Network::set_profiling().
+/// The first table also includes the calls recorded before model fitting, so
+/// the profiler may need to be reset by `net.get_profiler().reset()` beforehand.
+///
+class ProfilerCallback: public Callback
+{
+    private:
+        std::ostream&              m_os;
+        std::vector<ProfileRecord> m_last; // Snapshot of the records at the end of the previous epoch
+
+        // All records of the network, starting with those not associated with any hidden layer
+        static std::vector<ProfileRecord> get_records(const Network* net)
+        {
+            const Profiler& prof = net->get_profiler();
+            const int nlayer = net->num_layers();
+            std::vector<ProfileRecord> res;
+            res.reserve((nlayer + 1) * Profiler::NPHASE);
+
+            for (int i = -1; i < nlayer; i++)
+            {
+                for (int j = 0; j < Profiler::NPHASE; j++)
+                {
+                    res.push_back(prof.get_record(i, Profiler::PHASE(j)));
+                }
+            }
+
+            return res;
+        }
+
+        void print_row(const std::string& layer, const std::string& type,
+                       Profiler::PHASE phase, const ProfileRecord& cur,
+                       const ProfileRecord& last)
+        {
+            const long ncall = cur.ncall - last.ncall;
+
+            if (ncall <= 0)
+            {
+                return;
+            }
+
+            const double time = cur.time - last.time;
+            const std::ios_base::fmtflags flags = m_os.flags();
+            const std::streamsize precision = m_os.precision();
+            m_os << std::left << std::setw(7) << layer << std::setw(18) << type
+                 << std::setw(10) << Profiler::phase_name(phase)
+                 << std::right << std::setw(8) << ncall
+                 << std::setw(12) << std::fixed << std::setprecision(3) << time * 1e3
+                 << std::setw(12) << time * 1e6 / ncall;
+
+            if (cur.flops > last.flops)
+            {
+                m_os << std::setw(10) << (cur.flops - last.flops) / time * 1e-9
+                     << std::setw(10) << (cur.bytes - last.bytes) / time * 1e-9;
+            }
+            else
+            {
+                m_os << std::setw(10) << "-" << std::setw(10) << "-";
+            }
+
+            if (AllocTracker::installed())
+            {
+                m_os << std::setw(10) << double(cur.allocs - last.allocs) / ncall
+                     << std::setw(12) << (cur.alloc_bytes - last.alloc_bytes) / ncall / 1024.0
+                     << std::setw(12) << cur.peak_bytes / 1024.0;
+            }
+
+            if (cur.in_rows > 0)
+            {
+                m_os << "   " << cur.in_rows << "x" << cur.in_cols;
+            }
+
+            m_os << std::endl;
+            m_os.flags(flags);
+            m_os.precision(precision);
+        }
+
+        void post_batch(const Network* net)
+        {
+            if (m_batch_id != m_nbatch - 1)
+            {
+                return;
+            }
+
+            std::vector<ProfileRecord> cur = get_records(net);
+            m_last.resize(cur.size());
+            const std::vector<const Layer*> layers = net->get_layers();
+            m_os << "[Epoch " << m_epoch_id << "] Profile" << std::endl;
+            m_os << std::left << std::setw(7) << "Layer" << std::setw(18) << "Type"
+                 << std::setw(10) << "Phase"
+                 << std::right << std::setw(8) << "Calls" << std::setw(12) << "Total(ms)"
+                 << std::setw(12) << "Mean(us)" << std::setw(10) << "GFLOP/s"
+                 << std::setw(10) << "GB/s";
+
+            if (AllocTracker::installed())
+            {
+                m_os << std::setw(10) << "Allocs" << std::setw(12) << "Alloc(KB)"
+                     << std::setw(12) << "Peak(KB)";
+            }
+
+            m_os << "   Input" << std::endl;
+            print_row("-", "Data", Profiler::GATHER,
+                      cur[Profiler::GATHER], m_last[Profiler::GATHER]);
+
+            for (int i = 0; i < int(layers.size()); i++)
+            {
+                for (int j = Profiler::FORWARD; j <= Profiler::UPDATE; j++)
+                {
+                    const int id = (i + 1) * Profiler::NPHASE + j;
+                    print_row(internal::to_string(i), layers[i]->layer_type(), Profiler::PHASE(j),
+                              cur[id], m_last[id]);
+                }
+            }
+
+            print_row("-", net->get_output()->output_type(), Profiler::EVALUATE,
+                      cur[Profiler::EVALUATE], m_last[Profiler::EVALUATE]);
+            print_row("-", "Network", Profiler::TRAIN_STEP,
+                      cur[Profiler::TRAIN_STEP], m_last[Profiler::TRAIN_STEP]);
+            m_last.swap(cur);
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param os The output stream to print the tables. Default is `std::cout`.
+        ///
+        ProfilerCallback(std::ostream& os = std::cout) :
+            m_os(os)
+        {}
+
+        void post_training_batch(const Network* net, const Matrix& x, const Matrix& y)
+        {
+            post_batch(net);
+        }
+
+        void post_training_batch(const Network* net, const Matrix& x,
+                                 const IntegerVector& y)
+        {
+            post_batch(net);
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* CALLBACK_PROFILERCALLBACK_H_ */
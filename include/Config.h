@@ -12,6 +12,13 @@ typedef double Scalar;
 typedef MDNN_SCALAR Scalar;
 #endif
 
+// Multithreading facilities that require C++11, such as batch prefetching
+// during model fitting. They can be disabled by defining MDNN_NO_THREADS
+#if !defined(MDNN_NO_THREADS) && \
+    (__cplusplus >= 201103L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201103L))
+#define MDNN_USE_THREADS
+#endif
+
 
 } // namespace MiniDNN
 
@@ -7,6 +7,8 @@
 #include "Config.h"
 #include "RNG.h"
 #include "Optimizer.h"
+#include "Utils/ThreadPool.h"
+#include "Utils/HalfFloat.h"
 
 namespace MiniDNN
 {
@@ -16,6 +18,29 @@ namespace MiniDNN
 /// \defgroup Layers Hidden Layers
 ///
 
+///
+/// \ingroup Layers
+///
+/// Analytical cost of the forward pass or back-propagation of a hidden layer,
+/// used for roofline analysis. The memory traffic counts the compulsory reads
+/// and writes of the input, output, parameters and intermediate results, assuming
+/// each of them is transferred once.
+///
+struct LayerCost
+{
+    double flops;         // Number of floating-point operations
+    double bytes_read;    // Number of bytes read from memory
+    double bytes_written; // Number of bytes written to memory
+
+    LayerCost() :
+        flops(0.0), bytes_read(0.0), bytes_written(0.0)
+    {}
+
+    LayerCost(double flops_, double bytes_read_, double bytes_written_) :
+        flops(flops_), bytes_read(bytes_read_), bytes_written(bytes_written_)
+    {}
+};
+
 ///
 /// \ingroup Layers
 ///
@@ -28,10 +53,14 @@ class Layer
     protected:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
         typedef std::map<std::string, int> MetaInfo;
 
         const int m_in_size;  // Size of input units
         const int m_out_size; // Size of output units
+        bool m_trainable;          // Whether the parameters are updated in model fitting
+        bool m_need_backprop_data; // Whether Layer::backprop() needs to compute the gradient of input units
+        internal::ThreadPool* m_pool; // Thread pool for concurrent computations, or NULL
 
     public:
         ///
@@ -43,7 +72,8 @@ class Layer
         ///                 equal to the number of input units of the next layer.
         ///
         Layer(const int in_size, const int out_size) :
-            m_in_size(in_size), m_out_size(out_size)
+            m_in_size(in_size), m_out_size(out_size),
+            m_trainable(true), m_need_backprop_data(true), m_pool(NULL)
         {}
 
         ///
@@ -66,6 +96,64 @@ class Layer
             return m_out_size;
         }
 
+        ///
+        /// Freeze or unfreeze the parameters of this layer.
+        ///
+        /// The parameters of a frozen layer are not updated in model fitting,
+        /// and Layer::backprop() skips the computation of their gradients. If
+        /// all the layers below a frozen layer are also frozen, the network
+        /// does not call Layer::backprop() on them at all.
+        ///
+        /// \param trainable Whether the parameters should be updated. Default is `true`.
+        ///
+        void set_trainable(bool trainable)
+        {
+            m_trainable = trainable;
+        }
+
+        ///
+        /// Whether the parameters of this layer are updated in model fitting.
+        ///
+        bool trainable() const
+        {
+            return m_trainable;
+        }
+
+        ///
+        /// Set whether Layer::backprop() needs to compute the gradient of input
+        /// units, i.e., the data returned by Layer::backprop_data().
+        ///
+        /// This is set by the Network class before back-propagation. The gradient
+        /// is not needed by the first layer, or by a layer where all the layers
+        /// below it are frozen, and then Layer::backprop() can skip its computation.
+        ///
+        void set_need_backprop_data(bool need)
+        {
+            m_need_backprop_data = need;
+        }
+
+        ///
+        /// Whether Layer::backprop() needs to compute the gradient of input units.
+        ///
+        bool need_backprop_data() const
+        {
+            return m_need_backprop_data;
+        }
+
+        ///
+        /// Set the thread pool that Layer::backprop() may use to run independent
+        /// computations concurrently, such as the gradients of the parameters and
+        /// of the input units. This is set by the Network class, see
+        /// Network::set_num_threads(). The pool is not used if `MDNN_USE_THREADS`
+        /// is not defined.
+        ///
+        /// \param pool The thread pool, or `NULL` to run sequentially.
+        ///
+        void set_thread_pool(internal::ThreadPool* pool)
+        {
+            m_pool = pool;
+        }
+
         ///
         /// Initialize layer parameters using \f$N(\mu, \sigma^2)\f$ distribution.
         ///
@@ -98,13 +186,42 @@ class Layer
         virtual void forward(const Matrix& prev_layer_data) = 0;
 
         ///
-        /// Obtain the output values of this layer
+        /// Compute the output of this layer from an input that is not stored in
+        /// a Matrix object, such as a Map over a buffer of the caller, or a block
+        /// of columns of a larger matrix.
+        ///
+        /// This is used for the first layer in Network::predict() and
+        /// Network::train_step() with a caller-provided input. The default
+        /// implementation copies the input to a temporary matrix and calls
+        /// Layer::forward(), and layers override it to read the input in place.
+        ///
+        /// \param prev_layer_data The input of this layer, with the same meaning
+        ///                        as in Layer::forward(). Its columns may be
+        ///                        separated by an outer stride.
+        ///
+        virtual void forward_ref(const ConstRefMat& prev_layer_data)
+        {
+            const Matrix input = prev_layer_data;
+            forward(input);
+        }
+
+        ///
+        /// Obtain the output values of this layer after Layer::forward()
         ///
         /// This function is assumed to be called after Layer::forward() in each iteration.
         /// The output are the values of output hidden units after applying activation function.
         /// The main usage of this function is to provide the `prev_layer_data` parameter
         /// in Layer::forward() of the next layer.
         ///
+        /// **Note**: the output is only valid between Layer::forward() and
+        /// Layer::backprop(). FullyConnected, Convolutional and MaxPooling reuse
+        /// its storage for the gradient of the linear terms in Layer::backprop(),
+        /// if the activation does not need its input to compute the gradient
+        /// (see `jacobian_needs_input` of the activation classes). The matrix then
+        /// contains gradients instead of outputs, for example when it is read in
+        /// Callback::post_training_batch() after Network::fit() has trained a
+        /// mini-batch. Call Network::predict() to obtain the outputs instead.
+        ///
         /// \return A reference to the matrix that contains the output values. The
         ///         matrix should have `out_size` rows as in the constructor,
         ///         and have number of columns equal to that of `prev_layer_data` in the
@@ -118,6 +235,8 @@ class Layer
         /// The purpose of this function is to compute the gradient of input units,
         /// which can be retrieved by Layer::backprop_data(), and the gradient of
         /// layer parameters, which could later be used by the Layer::update() function.
+        /// Implementations may skip the former if Layer::need_backprop_data() is
+        /// `false`, and the latter if Layer::trainable() is `false`.
         ///
         /// \param prev_layer_data The output of previous layer, which is also the
         ///                        input of this layer. `prev_layer_data` should have
@@ -132,6 +251,23 @@ class Layer
         virtual void backprop(const Matrix& prev_layer_data,
                               const Matrix& next_layer_data) = 0;
 
+        ///
+        /// Compute the gradients from an input that is not stored in a Matrix
+        /// object, the counterpart of Layer::forward_ref() in back-propagation
+        ///
+        /// The default implementation copies the input to a temporary matrix and
+        /// calls Layer::backprop(), and layers override it to read the input in place.
+        ///
+        /// \param prev_layer_data The input of this layer, as passed to Layer::forward_ref().
+        /// \param next_layer_data The gradients of the output units, as in Layer::backprop().
+        ///
+        virtual void backprop_ref(const ConstRefMat& prev_layer_data,
+                                  const Matrix& next_layer_data)
+        {
+            const Matrix input = prev_layer_data;
+            backprop(input, next_layer_data);
+        }
+
         ///
         /// Obtain the gradient of input units of this layer
         ///
@@ -153,10 +289,87 @@ class Layer
         ///
         virtual std::vector<Scalar> get_parameters() const = 0;
         ///
+        /// Number of serialized parameters, i.e., the length of the vector
+        /// returned by Layer::get_parameters()
+        ///
+        virtual int num_parameters() const
+        {
+            return get_parameters().size();
+        }
+        ///
+        /// Copy the serialized parameters to an existing vector, in the layout of
+        /// Layer::get_parameters(). The vector is resized, so its memory is reused
+        /// if it already has the capacity.
+        ///
+        virtual void copy_parameters(std::vector<Scalar>& param) const
+        {
+            param = get_parameters();
+        }
+        ///
         /// Set the values of layer parameters from serialized data
         ///
         virtual void set_parameters(const std::vector<Scalar>& param) {};
 
+        ///
+        /// Use serialized parameters stored in external memory, for example a
+        /// memory-mapped model file, without copying them
+        ///
+        /// The memory must stay valid while the layer uses it, and it is never
+        /// written. A layer that supports mapping copies the parameters to its
+        /// own storage before modifying them, for example in Layer::update().
+        /// The default implementation copies the data with Layer::set_parameters().
+        ///
+        /// \param data Pointer to the serialized parameters, in the same layout as
+        ///             Layer::get_parameters().
+        /// \param size Number of values in `data`.
+        ///
+        virtual void map_parameters(const Scalar* data, int size)
+        {
+            set_parameters(std::vector<Scalar>(data, data + size));
+        }
+
+        ///
+        /// Use serialized parameters stored in a 16-bit format in external memory,
+        /// for example a model file written by Network::export_net() with a
+        /// 16-bit precision
+        ///
+        /// Layers that support compact storage (see set_storage_precision()) use
+        /// the data in place where possible. The default implementation converts
+        /// the data to Scalar and calls Layer::set_parameters().
+        ///
+        /// \param data      Pointer to the serialized parameters, in the same layout
+        ///                  as Layer::get_parameters().
+        /// \param size      Number of values in `data`.
+        /// \param precision The format of `data`, FP16_PRECISION or BF16_PRECISION.
+        ///
+        virtual void map_compact_parameters(const uint16_t* data, int size, PRECISION precision)
+        {
+            std::vector<Scalar> param(size);
+            internal::unpack_scalars(data, size, param.empty() ? NULL : &param[0], precision);
+            set_parameters(param);
+        }
+
+        ///
+        /// Store the parameters of this layer in a compact format to save memory
+        ///
+        /// With FP16_PRECISION or BF16_PRECISION, a layer that supports compact
+        /// storage keeps its main parameters in 16 bits, and converts them to
+        /// Scalar block by block inside its forward computations. This is meant
+        /// for inference; the parameters are converted back to Scalar when they
+        /// are updated or set. The default implementation ignores the request.
+        ///
+        /// \param precision The storage format. SCALAR_PRECISION restores full precision.
+        ///
+        virtual void set_storage_precision(PRECISION precision) {}
+
+        ///
+        /// The format in which the parameters are currently stored
+        ///
+        virtual PRECISION storage_precision() const
+        {
+            return SCALAR_PRECISION;
+        }
+
         ///
         /// Get serialized values of the gradient of parameters
         ///
@@ -182,6 +395,28 @@ class Layer
         ///              where 1 is the index, "Layer1" is the key, and 2 is the value.
         ///
         virtual void fill_meta_info(MetaInfo& map, int index) const = 0;
+
+        ///
+        /// Analytical cost of Layer::forward() for a given number of observations.
+        /// The default implementation returns zero cost.
+        ///
+        /// \param nobs Number of observations, i.e., the number of columns of `prev_layer_data`.
+        ///
+        virtual LayerCost forward_cost(int nobs) const
+        {
+            return LayerCost();
+        }
+
+        ///
+        /// Analytical cost of Layer::backprop() for a given number of observations.
+        /// The default implementation returns zero cost.
+        ///
+        /// \param nobs Number of observations, i.e., the number of columns of `prev_layer_data`.
+        ///
+        virtual LayerCost backprop_cost(int nobs) const
+        {
+            return LayerCost();
+        }
 };
 
 
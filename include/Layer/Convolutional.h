@@ -3,6 +3,7 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include <new>
 #include <stdexcept>
 #include "../Config.h"
 #include "../Layer.h"
@@ -10,6 +11,7 @@
 #include "../Utils/Random.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
+#include "../Utils/ActivationTraits.h"
 
 
 namespace MiniDNN
@@ -32,24 +34,239 @@ class Convolutional: public Layer
         typedef Matrix::ConstAlignedMapType ConstAlignedMapMat;
         typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
         typedef Vector::AlignedMapType AlignedMapVec;
+        typedef Eigen::Map<Vector> MapVec;
         typedef std::map<std::string, int> MetaInfo;
 
         const internal::ConvDims m_dim; // Various dimensions of convolution
 
+        Vector m_filter_storage; // Storage of the filter parameters, unless they are mapped
+        Vector m_bias_storage;   // Storage of the bias, unless it is mapped
+        bool   m_mapped;         // Whether m_filter_data and m_bias point to external memory
 
-        Vector m_filter_data;  // Filter parameters. Total length is
+        MapVec m_filter_data;  // Filter parameters, pointing to m_filter_storage or to the
+                               // memory given in map_parameters(), or to NULL if the
+                               // filters are stored in m_filter_compact. Total length is
                                // (in_channels x out_channels x filter_rows x filter_cols)
                                // See Utils/Convolution.h for its layout
+        internal::CompactStorage m_filter_compact; // Filters in a 16-bit format, see set_storage_precision()
 
         Vector m_df_data;      // Derivative of filters, same dimension as m_filter_data
 
-        Vector m_bias;         // Bias term for the output channels, out_channels x 1. (One bias term per channel)
+        MapVec m_bias;         // Bias term for the output channels, out_channels x 1. (One bias term per channel)
         Vector m_db;           // Derivative of bias, same dimension as m_bias
 
         Matrix m_z;            // Linear term, z = conv(in, w) + b. Each column is an observation
+                               // Only kept if the activation function needs it in backprop
         Matrix m_a;            // Output of this layer, a = act(z)
         Matrix m_din;          // Derivative of the input of this layer
                                // Note that input of this layer is also the output of previous layer
+        Matrix m_patch;        // Image patches of a single observation, kept to avoid
+                               // reallocating them in each prediction
+
+        // Point m_filter_data and m_bias to the given memory
+        void set_storage(Scalar* filter, Scalar* bias)
+        {
+            const int filter_data_size = m_dim.in_channels * m_dim.out_channels *
+                                         m_dim.filter_rows * m_dim.filter_cols;
+            new (&m_filter_data) MapVec(filter, filter_data_size);
+            new (&m_bias) MapVec(bias, m_dim.out_channels);
+        }
+
+        // Copy mapped or compact parameters to the Scalar storage of the layer
+        // before they are modified
+        void own_parameters()
+        {
+            if (!m_filter_compact.empty())
+            {
+                m_filter_storage.resize(m_filter_compact.size());
+                m_filter_compact.unpack(m_filter_storage.data());
+                m_filter_compact.release();
+                set_storage(m_filter_storage.data(), m_bias.data());
+            }
+
+            if (!m_mapped)
+            {
+                return;
+            }
+
+            m_filter_storage = m_filter_data;
+            m_bias_storage = m_bias;
+            set_storage(m_filter_storage.data(), m_bias_storage.data());
+            m_mapped = false;
+        }
+
+        // Gradients of the parameters given dLz = d(L) / d(z)
+        // src: in_size x nobs, stored contiguously
+        void param_gradient(const Scalar* src, const Matrix& dLz)
+        {
+            const int nobs = dLz.cols();
+            // Derivative for weights
+            internal::ConvDims back_conv_dim(nobs, m_dim.out_channels, m_dim.channel_rows,
+                                             m_dim.channel_cols,
+                                             m_dim.conv_rows, m_dim.conv_cols);
+            internal::convolve_valid(back_conv_dim, src, false,
+                                     m_dim.in_channels,
+                                     dLz.data(), m_df_data.data()
+                                    );
+            m_df_data /= nobs;
+            // Derivative for bias
+            // Aggregate d(L) / d(z) in each output channel
+            ConstAlignedMapMat dLz_by_channel(dLz.data(), m_dim.conv_rows * m_dim.conv_cols,
+                                              m_dim.out_channels * nobs);
+            Vector dLb = dLz_by_channel.colwise().sum();
+            // Average over observations
+            ConstAlignedMapMat dLb_by_obs(dLb.data(), m_dim.out_channels, nobs);
+            m_db.noalias() = dLb_by_obs.rowwise().mean();
+        }
+
+        // Gradient of the input units given dLz = d(L) / d(z)
+        void input_gradient(const Matrix& dLz)
+        {
+            const int nobs = dLz.cols();
+            // Compute d(L) / d_in = conv_full(d(L) / d(z), w_rotate)
+            m_din.resize(this->m_in_size, nobs);
+            internal::ConvDims conv_full_dim(m_dim.out_channels, m_dim.in_channels,
+                                             m_dim.conv_rows, m_dim.conv_cols, m_dim.filter_rows, m_dim.filter_cols);
+            // With compact storage, the filters are converted for this computation
+            Vector filter;
+
+            if (!m_filter_compact.empty())
+            {
+                filter.resize(m_filter_compact.size());
+                m_filter_compact.unpack(filter.data());
+            }
+
+            internal::convolve_full(conv_full_dim, dLz.data(), nobs,
+                                    m_filter_compact.empty() ? m_filter_data.data() : filter.data(),
+                                    m_din.data()
+                                   );
+        }
+
+        // src: in_size x nobs, stored contiguously
+        void forward_data(const Scalar* src, int nobs)
+        {
+            // Linear term, z = conv(in, w) + b
+            // If the Jacobian of the activation function does not depend on z,
+            // z is computed in m_a and then overwritten by the activation
+            Matrix& z = internal::JacobianNeedsInput<Activation>::value ? m_z : m_a;
+            z.resize(this->m_out_size, nobs);
+            // Convolution
+            // With compact storage, the filters of each input channel are
+            // converted right before they are used
+            // A single observation, typically in latency-bound prediction, uses
+            // one matrix product per input channel
+            if (m_filter_compact.empty())
+            {
+                internal::ScalarFilters filters(m_filter_data.data());
+
+                if (nobs == 1)
+                {
+                    internal::convolve_valid_single(m_dim, src, filters,
+                                                    m_patch, z.data());
+                }
+                else
+                {
+                    internal::convolve_valid(m_dim, src, true, nobs,
+                                             filters, z.data()
+                                            );
+                }
+            }
+            else
+            {
+                internal::CompactFilters filters(m_filter_compact);
+
+                if (nobs == 1)
+                {
+                    internal::convolve_valid_single(m_dim, src, filters,
+                                                    m_patch, z.data());
+                }
+                else
+                {
+                    internal::convolve_valid(m_dim, src, true, nobs,
+                                             filters, z.data()
+                                            );
+                }
+            }
+
+            // Add bias terms
+            // Each column of z contains m_dim.out_channels channels, and each channel has
+            // m_dim.conv_rows * m_dim.conv_cols elements
+            int channel_start_row = 0;
+            const int channel_nelem = m_dim.conv_rows * m_dim.conv_cols;
+
+            for (int i = 0; i < m_dim.out_channels; i++, channel_start_row += channel_nelem)
+            {
+                z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
+            }
+
+            // Apply activation function
+            m_a.resize(this->m_out_size, nobs);
+            Activation::activate(z, m_a);
+        }
+
+        // src: in_size x nobs, stored contiguously
+        // next_layer_data: out_size x nobs
+        // https://grzegorzgwardys.wordpress.com/2016/04/22/8/
+        void backprop_data(const Scalar* src, const Matrix& next_layer_data)
+        {
+            // After forward stage, m_z contains z = conv(in, w) + b if it is needed
+            // Now we need to calculate d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
+            // d(L) / d(a) is computed in the next layer, contained in next_layer_data
+            // The Jacobian matrix J = d(a) / d(z) is determined by the activation function
+            // dLz overwrites m_z if the Jacobian needs z, and m_a otherwise
+            Matrix& dLz = internal::JacobianNeedsInput<Activation>::value ? m_z : m_a;
+            Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+            // z_j = sum_i(conv(in_i, w_ij)) + b_j
+            //
+            // d(z_k) / d(w_ij) = 0, if k != j
+            // d(L) / d(w_ij) = [d(z_j) / d(w_ij)] * [d(L) / d(z_j)] = sum_i{ [d(z_j) / d(w_ij)] * [d(L) / d(z_j)] }
+            // = sum_i(conv(in_i, d(L) / d(z_j)))
+            //
+            // z_j is an image (matrix), b_j is a scalar
+            // d(z_j) / d(b_j) = a matrix of the same size of d(z_j) filled with 1
+            // d(L) / d(b_j) = (d(L) / d(z_j)).sum()
+            //
+            // d(z_j) / d(in_i) = conv_full_op(w_ij_rotate)
+            // d(L) / d(in_i) = sum_j((d(z_j) / d(in_i)) * (d(L) / d(z_j))) = sum_j(conv_full(d(L) / d(z_j), w_ij_rotate))
+#ifdef MDNN_USE_THREADS
+
+            // The two convolutions are independent, so the parameter gradients are
+            // computed in the thread pool while this thread computes d(L) / d_in
+            if (this->m_pool && this->m_trainable && this->m_need_backprop_data)
+            {
+                std::future<void> task = this->m_pool->submit([&]()
+                {
+                    param_gradient(src, dLz);
+                });
+
+                try
+                {
+                    input_gradient(dLz);
+                }
+                catch (...)
+                {
+                    task.wait();
+                    throw;
+                }
+
+                task.get();
+                return;
+            }
+
+#endif
+
+            // The gradients of frozen parameters are not needed
+            if (this->m_trainable)
+            {
+                param_gradient(src, dLz);
+            }
+
+            // d(L) / d_in is not needed if no layer below is trainable
+            if (this->m_need_backprop_data)
+            {
+                input_gradient(dLz);
+            }
+        }
 
     public:
         ///
@@ -68,7 +285,8 @@ class Convolutional: public Layer
             Layer(in_width * in_height * in_channels,
                   (in_width - window_width + 1) * (in_height - window_height + 1) * out_channels),
             m_dim(in_channels, out_channels, in_height, in_width, window_height,
-                  window_width)
+                  window_width),
+            m_mapped(false), m_filter_data(NULL, 0), m_bias(NULL, 0)
         {}
 
         void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
@@ -90,38 +308,34 @@ class Convolutional: public Layer
             const int filter_data_size = m_dim.in_channels * m_dim.out_channels *
                                          m_dim.filter_rows * m_dim.filter_cols;
             // Filter parameters
-            m_filter_data.resize(filter_data_size);
+            m_filter_storage.resize(filter_data_size);
             m_df_data.resize(filter_data_size);
             // Bias term
-            m_bias.resize(m_dim.out_channels);
+            m_bias_storage.resize(m_dim.out_channels);
             m_db.resize(m_dim.out_channels);
+            set_storage(m_filter_storage.data(), m_bias_storage.data());
+            m_mapped = false;
+            m_filter_compact.release();
         }
 
         // http://cs231n.github.io/convolutional-networks/
         void forward(const Matrix& prev_layer_data)
         {
-            // Each column is an observation
-            const int nobs = prev_layer_data.cols();
-            // Linear term, z = conv(in, w) + b
-            m_z.resize(this->m_out_size, nobs);
-            // Convolution
-            internal::convolve_valid(m_dim, prev_layer_data.data(), true, nobs,
-                                     m_filter_data.data(), m_z.data()
-                                    );
-            // Add bias terms
-            // Each column of m_z contains m_dim.out_channels channels, and each channel has
-            // m_dim.conv_rows * m_dim.conv_cols elements
-            int channel_start_row = 0;
-            const int channel_nelem = m_dim.conv_rows * m_dim.conv_cols;
+            forward_data(prev_layer_data.data(), prev_layer_data.cols());
+        }
 
-            for (int i = 0; i < m_dim.out_channels; i++, channel_start_row += channel_nelem)
+        // The convolution routines need the observations to be stored one after
+        // another, so only other inputs are copied
+        void forward_ref(const ConstRefMat& prev_layer_data)
+        {
+            if (prev_layer_data.cols() <= 1 || prev_layer_data.outerStride() == this->m_in_size)
             {
-                m_z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
+                forward_data(prev_layer_data.data(), prev_layer_data.cols());
+            }
+            else
+            {
+                Layer::forward_ref(prev_layer_data);
             }
-
-            // Apply activation function
-            m_a.resize(this->m_out_size, nobs);
-            Activation::activate(m_z, m_a);
         }
 
         const Matrix& output() const
@@ -131,52 +345,22 @@ class Convolutional: public Layer
 
         // prev_layer_data: in_size x nobs
         // next_layer_data: out_size x nobs
-        // https://grzegorzgwardys.wordpress.com/2016/04/22/8/
         void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
         {
-            const int nobs = prev_layer_data.cols();
-            // After forward stage, m_z contains z = conv(in, w) + b
-            // Now we need to calculate d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
-            // d(L) / d(a) is computed in the next layer, contained in next_layer_data
-            // The Jacobian matrix J = d(a) / d(z) is determined by the activation function
-            Matrix& dLz = m_z;
-            Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
-            // z_j = sum_i(conv(in_i, w_ij)) + b_j
-            //
-            // d(z_k) / d(w_ij) = 0, if k != j
-            // d(L) / d(w_ij) = [d(z_j) / d(w_ij)] * [d(L) / d(z_j)] = sum_i{ [d(z_j) / d(w_ij)] * [d(L) / d(z_j)] }
-            // = sum_i(conv(in_i, d(L) / d(z_j)))
-            //
-            // z_j is an image (matrix), b_j is a scalar
-            // d(z_j) / d(b_j) = a matrix of the same size of d(z_j) filled with 1
-            // d(L) / d(b_j) = (d(L) / d(z_j)).sum()
-            //
-            // d(z_j) / d(in_i) = conv_full_op(w_ij_rotate)
-            // d(L) / d(in_i) = sum_j((d(z_j) / d(in_i)) * (d(L) / d(z_j))) = sum_j(conv_full(d(L) / d(z_j), w_ij_rotate))
-            // Derivative for weights
-            internal::ConvDims back_conv_dim(nobs, m_dim.out_channels, m_dim.channel_rows,
-                                             m_dim.channel_cols,
-                                             m_dim.conv_rows, m_dim.conv_cols);
-            internal::convolve_valid(back_conv_dim, prev_layer_data.data(), false,
-                                     m_dim.in_channels,
-                                     dLz.data(), m_df_data.data()
-                                    );
-            m_df_data /= nobs;
-            // Derivative for bias
-            // Aggregate d(L) / d(z) in each output channel
-            ConstAlignedMapMat dLz_by_channel(dLz.data(), m_dim.conv_rows * m_dim.conv_cols,
-                                              m_dim.out_channels * nobs);
-            Vector dLb = dLz_by_channel.colwise().sum();
-            // Average over observations
-            ConstAlignedMapMat dLb_by_obs(dLb.data(), m_dim.out_channels, nobs);
-            m_db.noalias() = dLb_by_obs.rowwise().mean();
-            // Compute d(L) / d_in = conv_full(d(L) / d(z), w_rotate)
-            m_din.resize(this->m_in_size, nobs);
-            internal::ConvDims conv_full_dim(m_dim.out_channels, m_dim.in_channels,
-                                             m_dim.conv_rows, m_dim.conv_cols, m_dim.filter_rows, m_dim.filter_cols);
-            internal::convolve_full(conv_full_dim, dLz.data(), nobs,
-                                    m_filter_data.data(), m_din.data()
-                                   );
+            backprop_data(prev_layer_data.data(), next_layer_data);
+        }
+
+        // As in forward_ref(), only inputs that are not stored contiguously are copied
+        void backprop_ref(const ConstRefMat& prev_layer_data, const Matrix& next_layer_data)
+        {
+            if (prev_layer_data.cols() <= 1 || prev_layer_data.outerStride() == this->m_in_size)
+            {
+                backprop_data(prev_layer_data.data(), next_layer_data);
+            }
+            else
+            {
+                Layer::backprop_ref(prev_layer_data, next_layer_data);
+            }
         }
 
         const Matrix& backprop_data() const
@@ -186,6 +370,12 @@ class Convolutional: public Layer
 
         void update(Optimizer& opt)
         {
+            if (!this->m_trainable)
+            {
+                return;
+            }
+
+            own_parameters();
             ConstAlignedMapVec dw(m_df_data.data(), m_df_data.size());
             ConstAlignedMapVec db(m_db.data(), m_db.size());
             AlignedMapVec      w(m_filter_data.data(), m_filter_data.size());
@@ -194,14 +384,34 @@ class Convolutional: public Layer
             opt.update(db, b);
         }
 
-        std::vector<Scalar> get_parameters() const
+        int num_parameters() const
         {
-            std::vector<Scalar> res(m_filter_data.size() + m_bias.size());
+            return m_filter_data.size() + m_bias.size();
+        }
+
+        void copy_parameters(std::vector<Scalar>& res) const
+        {
+            res.resize(m_filter_data.size() + m_bias.size());
+
             // Copy the data of filters and bias to a long vector
-            std::copy(m_filter_data.data(), m_filter_data.data() + m_filter_data.size(),
-                      res.begin());
+            if (m_filter_compact.empty())
+            {
+                std::copy(m_filter_data.data(), m_filter_data.data() + m_filter_data.size(),
+                          res.begin());
+            }
+            else
+            {
+                m_filter_compact.unpack(&res[0]);
+            }
+
             std::copy(m_bias.data(), m_bias.data() + m_bias.size(),
                       res.begin() + m_filter_data.size());
+        }
+
+        std::vector<Scalar> get_parameters() const
+        {
+            std::vector<Scalar> res;
+            copy_parameters(res);
             return res;
         }
 
@@ -212,11 +422,83 @@ class Convolutional: public Layer
                 throw std::invalid_argument("[class Convolutional]: Parameter size does not match");
             }
 
+            own_parameters();
             std::copy(param.begin(), param.begin() + m_filter_data.size(),
                       m_filter_data.data());
             std::copy(param.begin() + m_filter_data.size(), param.end(), m_bias.data());
         }
 
+        void map_parameters(const Scalar* data, int size)
+        {
+            const int filter_data_size = m_dim.in_channels * m_dim.out_channels *
+                                         m_dim.filter_rows * m_dim.filter_cols;
+
+            if (size != filter_data_size + m_dim.out_channels)
+            {
+                throw std::invalid_argument("[class Convolutional]: Parameter size does not match");
+            }
+
+            // The mapped memory is never written, see own_parameters()
+            Scalar* filter = const_cast<Scalar*>(data);
+            set_storage(filter, filter + filter_data_size);
+            m_mapped = true;
+            m_filter_compact.release();
+            // Release the storage allocated by init()
+            m_filter_storage.resize(0);
+            m_bias_storage.resize(0);
+        }
+
+        void map_compact_parameters(const uint16_t* data, int size, PRECISION precision)
+        {
+            const int filter_data_size = m_dim.in_channels * m_dim.out_channels *
+                                         m_dim.filter_rows * m_dim.filter_cols;
+
+            if (size != filter_data_size + m_dim.out_channels)
+            {
+                throw std::invalid_argument("[class Convolutional]: Parameter size does not match");
+            }
+
+            // The filters are used in place, and the bias is converted to Scalar
+            m_filter_compact.map(data, filter_data_size, precision);
+            m_bias_storage.resize(m_dim.out_channels);
+            internal::unpack_scalars(data + filter_data_size, m_dim.out_channels,
+                                     m_bias_storage.data(), precision);
+            set_storage(NULL, m_bias_storage.data());
+            m_mapped = false;
+            m_filter_storage.resize(0);
+        }
+
+        ///
+        /// Store the filters in a 16-bit format, see Layer::set_storage_precision()
+        ///
+        /// forward() converts the filters of one input channel at a time. The
+        /// gradient of input units converts all filters for the duration of
+        /// the computation. The bias is kept in Scalar.
+        ///
+        void set_storage_precision(PRECISION precision)
+        {
+            if (precision == m_filter_compact.precision())
+            {
+                return;
+            }
+
+            own_parameters();
+
+            if (precision == SCALAR_PRECISION)
+            {
+                return;
+            }
+
+            m_filter_compact.pack(m_filter_data.data(), m_filter_data.size(), precision);
+            set_storage(NULL, m_bias_storage.data());
+            m_filter_storage.resize(0);
+        }
+
+        PRECISION storage_precision() const
+        {
+            return m_filter_compact.precision();
+        }
+
         std::vector<Scalar> get_derivatives() const
         {
             std::vector<Scalar> res(m_df_data.size() + m_db.size());
@@ -249,6 +531,54 @@ class Convolutional: public Layer
             map.insert(std::make_pair("window_width" + ind, m_dim.filter_cols));
             map.insert(std::make_pair("window_height" + ind, m_dim.filter_rows));
         }
+
+        LayerCost forward_cost(int nobs) const
+        {
+            // Each output pixel of each output channel sums over in_channels x filter_rows x filter_cols products
+            const double n = nobs;
+            const double nfilter = double(m_dim.in_channels) * m_dim.out_channels;
+            const double filter_size = double(m_dim.filter_rows) * m_dim.filter_cols;
+            const double conv_size = double(m_dim.conv_rows) * m_dim.conv_cols;
+            const double flops = 2 * nfilter * filter_size * conv_size * n + 2 * this->m_out_size * n;
+            // Read input, filters, bias and z, write z and a
+            const double filter_bytes = m_filter_compact.empty() ? sizeof(Scalar) : sizeof(uint16_t);
+            const double read = this->m_in_size * n + m_dim.out_channels + this->m_out_size * n;
+            const double written = 2 * this->m_out_size * n;
+            return LayerCost(flops, read * sizeof(Scalar) + nfilter * filter_size * filter_bytes,
+                             written * sizeof(Scalar));
+        }
+
+        LayerCost backprop_cost(int nobs) const
+        {
+            // The filter gradient ("valid" rule) and the input gradient ("full" rule)
+            // each cost about the same number of products as the forward pass
+            const double n = nobs;
+            const double nfilter = double(m_dim.in_channels) * m_dim.out_channels;
+            const double filter_size = double(m_dim.filter_rows) * m_dim.filter_cols;
+            const double conv_size = double(m_dim.conv_rows) * m_dim.conv_cols;
+            // Read z, a and next, write dLz
+            double flops = 2 * this->m_out_size * n;
+            double read = 3 * this->m_out_size * n;
+            double written = this->m_out_size * n;
+
+            if (this->m_trainable)
+            {
+                // Read input and dLz, write filter gradient and db
+                flops += 2 * nfilter * filter_size * conv_size * n + this->m_out_size * n;
+                read += this->m_in_size * n + this->m_out_size * n;
+                written += nfilter * filter_size + m_dim.out_channels;
+            }
+
+            if (this->m_need_backprop_data)
+            {
+                // Read dLz and filters, write din
+                flops += 2 * nfilter * filter_size * conv_size * n;
+                read += this->m_out_size * n + nfilter * filter_size;
+                written += this->m_in_size * n;
+            }
+
+            return LayerCost(flops, read * sizeof(Scalar), written * sizeof(Scalar));
+        }
 };
 
 
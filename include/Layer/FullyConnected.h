@@ -3,12 +3,15 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include <new>
+#include <algorithm>
 #include <stdexcept>
 #include "../Config.h"
 #include "../Layer.h"
 #include "../Utils/Random.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
+#include "../Utils/ActivationTraits.h"
 
 namespace MiniDNN
 {
@@ -27,17 +30,226 @@ class FullyConnected: public Layer
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
         typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
         typedef Vector::AlignedMapType AlignedMapVec;
+        typedef Eigen::Map<Matrix> MapMat;
+        typedef Eigen::Map<Vector> MapVec;
         typedef std::map<std::string, int> MetaInfo;
 
-        Matrix m_weight;  // Weight parameters, W(in_size x out_size)
-        Vector m_bias;    // Bias parameters, b(out_size x 1)
+        Matrix m_weight_data; // Storage of the weights, unless they are mapped
+        Vector m_bias_data;   // Storage of the bias, unless it is mapped
+        MapMat m_weight;  // Weight parameters, W(in_size x out_size), pointing to
+                          // m_weight_data or to the memory given in map_parameters(),
+                          // or to NULL if the weights are stored in m_weight_compact
+        MapVec m_bias;    // Bias parameters, b(out_size x 1)
+        bool   m_mapped;  // Whether m_weight and m_bias point to external memory
+        internal::CompactStorage m_weight_compact; // Weights in a 16-bit format, see set_storage_precision()
+        Matrix m_panel;   // Block of columns of W converted from m_weight_compact
         Matrix m_dw;      // Derivative of weights
         Vector m_db;      // Derivative of bias
-        Matrix m_z;       // Linear term, z = W' * in + b
+        Matrix m_z;       // Linear term, z = W' * in + b. Only kept if the
+                          // activation function needs it in backprop
         Matrix m_a;       // Output of this layer, a = act(z)
         Matrix m_din;     // Derivative of the input of this layer.
                           // Note that input of this layer is also the output of previous layer
 
+        Scalar m_sparse_threshold;      // Minimum proportion of zero inputs to use the sparse path
+        Scalar m_sparsity;              // Proportion of zero inputs in the last forward pass
+        bool   m_sparse_input;          // Whether the last forward pass used the sparse path
+        std::vector<int>    m_nz_start; // Nonzero inputs of observation j are stored in
+        std::vector<int>    m_nz_index; // [m_nz_start[j], m_nz_start[j + 1]) of m_nz_index
+        std::vector<Scalar> m_nz_value; // (row indices) and m_nz_value (values)
+
+        // Point m_weight and m_bias to the given memory
+        void set_storage(Scalar* weight, Scalar* bias)
+        {
+            new (&m_weight) MapMat(weight, this->m_in_size, this->m_out_size);
+            new (&m_bias) MapVec(bias, this->m_out_size);
+        }
+
+        // Number of columns of W converted from m_weight_compact at a time,
+        // chosen such that a block of weights stays in the cache
+        int panel_cols() const
+        {
+            return std::max(1, std::min(this->m_out_size, 65536 / std::max(1, this->m_in_size)));
+        }
+
+        // Convert the columns [start, start + n) of W from m_weight_compact to
+        // the first n columns of m_panel
+        void unpack_panel(int start, int n)
+        {
+            m_panel.resize(this->m_in_size, panel_cols());
+            m_weight_compact.unpack(start * this->m_in_size, n * this->m_in_size, m_panel.data());
+        }
+
+        // Copy mapped or compact parameters to the Scalar storage of the layer
+        // before they are modified
+        void own_parameters()
+        {
+            if (!m_weight_compact.empty())
+            {
+                m_weight_data.resize(this->m_in_size, this->m_out_size);
+                m_weight_compact.unpack(m_weight_data.data());
+                m_weight_compact.release();
+                m_panel.resize(0, 0);
+                set_storage(m_weight_data.data(), m_bias.data());
+            }
+
+            if (!m_mapped)
+            {
+                return;
+            }
+
+            m_weight_data = m_weight;
+            m_bias_data = m_bias;
+            set_storage(m_weight_data.data(), m_bias_data.data());
+            m_mapped = false;
+        }
+
+        // Store the nonzero inputs observation by observation
+        // Estimate the proportion of zero inputs, and return whether the sparse
+        // path is used. The columns are scanned until the number of nonzero
+        // values rules out the sparse path, so dense inputs are only partially
+        // visited, and nothing is scanned if the sparse path is disabled.
+        bool check_sparsity(const ConstRefMat& prev_layer_data)
+        {
+            m_sparsity = 0;
+
+            // The sparse path reads W in Scalar, so it is not used with compact storage
+            if (m_sparse_threshold > Scalar(1) || !m_weight_compact.empty() ||
+                    prev_layer_data.size() == 0)
+            {
+                return false;
+            }
+
+            const int nrow = prev_layer_data.rows(), ncol = prev_layer_data.cols();
+            const Scalar max_nonzero = (Scalar(1) - m_sparse_threshold) * prev_layer_data.size();
+            int nzero = 0, j = 0;
+
+            while (j < ncol)
+            {
+                nzero += (prev_layer_data.col(j).array() == Scalar(0)).count();
+                j++;
+
+                if (Scalar(j * nrow - nzero) > max_nonzero)
+                {
+                    break;
+                }
+            }
+
+            m_sparsity = Scalar(nzero) / Scalar(j * nrow);
+            return (j == ncol) && (nzero >= m_sparse_threshold * prev_layer_data.size());
+        }
+
+        void compress_input(const ConstRefMat& prev_layer_data)
+        {
+            const int nobs = prev_layer_data.cols();
+            m_nz_start.resize(nobs + 1);
+            m_nz_index.clear();
+            m_nz_value.clear();
+
+            for (int j = 0; j < nobs; j++)
+            {
+                m_nz_start[j] = m_nz_index.size();
+                const Scalar* x = prev_layer_data.col(j).data();
+
+                for (int k = 0; k < this->m_in_size; k++, x++)
+                {
+                    if (*x != Scalar(0))
+                    {
+                        m_nz_index.push_back(k);
+                        m_nz_value.push_back(*x);
+                    }
+                }
+            }
+
+            m_nz_start[nobs] = m_nz_index.size();
+        }
+
+        // Gradients of the parameters given dLz = d(L) / d(z)
+        void param_gradient(const ConstRefMat& prev_layer_data, const Matrix& dLz)
+        {
+            const int nobs = prev_layer_data.cols();
+
+            // Derivative for weights, d(L) / d(W) = in * [d(L) / d(z)]'
+            // If the input is sparse, each column of d(L) / d(W) is accumulated
+            // over the nonzero inputs recorded in forward(), so that the column
+            // stays in cache for all observations
+            if (m_sparse_input)
+            {
+                m_dw.setZero();
+                const int out_main = this->m_out_size - this->m_out_size % 4;
+
+                // Four columns at a time, which share the loads of the nonzero inputs
+                for (int o = 0; o < out_main; o += 4)
+                {
+                    Scalar* dw0 = m_dw.col(o).data();
+                    Scalar* dw1 = m_dw.col(o + 1).data();
+                    Scalar* dw2 = m_dw.col(o + 2).data();
+                    Scalar* dw3 = m_dw.col(o + 3).data();
+
+                    for (int j = 0; j < nobs; j++)
+                    {
+                        const Scalar g0 = dLz(o, j), g1 = dLz(o + 1, j), g2 = dLz(o + 2, j), g3 = dLz(o + 3, j);
+
+                        for (int p = m_nz_start[j]; p < m_nz_start[j + 1]; p++)
+                        {
+                            const int k = m_nz_index[p];
+                            const Scalar x = m_nz_value[p];
+                            dw0[k] += x * g0;
+                            dw1[k] += x * g1;
+                            dw2[k] += x * g2;
+                            dw3[k] += x * g3;
+                        }
+                    }
+                }
+
+                for (int o = out_main; o < this->m_out_size; o++)
+                {
+                    Scalar* dw = m_dw.col(o).data();
+
+                    for (int j = 0; j < nobs; j++)
+                    {
+                        const Scalar g = dLz(o, j);
+
+                        for (int p = m_nz_start[j]; p < m_nz_start[j + 1]; p++)
+                        {
+                            dw[m_nz_index[p]] += m_nz_value[p] * g;
+                        }
+                    }
+                }
+            }
+            else
+            {
+                m_dw.noalias() = prev_layer_data * dLz.transpose();
+            }
+
+            m_dw /= Scalar(nobs);
+
+            // Derivative for bias, d(L) / d(b) = d(L) / d(z)
+            m_db.noalias() = dLz.rowwise().mean();
+        }
+
+        // Gradient of the input units, d(L) / d_in = W * [d(L) / d(z)]
+        void input_gradient(const Matrix& dLz)
+        {
+            m_din.resize(this->m_in_size, dLz.cols());
+
+            if (m_weight_compact.empty())
+            {
+                m_din.noalias() = m_weight * dLz;
+                return;
+            }
+
+            m_din.setZero();
+            const int ncol = panel_cols();
+
+            for (int j = 0; j < this->m_out_size; j += ncol)
+            {
+                const int n = std::min(ncol, this->m_out_size - j);
+                unpack_panel(j, n);
+                m_din.noalias() += m_panel.leftCols(n) * dLz.middleRows(j, n);
+            }
+        }
+
     public:
         ///
         /// Constructor
@@ -46,7 +258,9 @@ class FullyConnected: public Layer
         /// \param out_size Number of output units.
         ///
         FullyConnected(const int in_size, const int out_size) :
-            Layer(in_size, out_size)
+            Layer(in_size, out_size),
+            m_weight(NULL, 0, 0), m_bias(NULL, 0), m_mapped(false),
+            m_sparse_threshold(0.8), m_sparsity(0), m_sparse_input(false)
         {}
 
         void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
@@ -61,23 +275,147 @@ class FullyConnected: public Layer
         void init()
         {
             // Set parameter dimension
-            m_weight.resize(this->m_in_size, this->m_out_size);
-            m_bias.resize(this->m_out_size);
+            m_weight_data.resize(this->m_in_size, this->m_out_size);
+            m_bias_data.resize(this->m_out_size);
+            set_storage(m_weight_data.data(), m_bias_data.data());
+            m_mapped = false;
+            m_weight_compact.release();
             m_dw.resize(this->m_in_size, this->m_out_size);
             m_db.resize(this->m_out_size);
         }
 
+        ///
+        /// Set the threshold for the sparse forward and backward path
+        ///
+        /// Inputs following a ReLU layer often contain many exact zeros. If the
+        /// proportion of zeros in a batch is at least `threshold`, the layer only
+        /// visits the nonzero inputs in forward() and in the weight gradient of
+        /// backprop(), instead of using dense matrix products. The weights are
+        /// read in place, so the only extra memory is the list of nonzero inputs.
+        ///
+        /// \param threshold Proportion of zero inputs in `[0, 1]`. A value larger
+        ///                  than 1 disables the sparse path. The default is 0.8.
+        ///
+        void set_sparse_threshold(const Scalar& threshold)
+        {
+            m_sparse_threshold = threshold;
+        }
+
+        ///
+        /// Proportion of zero inputs observed in the last call of forward()
+        ///
+        /// The input is only scanned until the sparse path is ruled out, so for
+        /// dense inputs this is an estimate from the first observations, and it
+        /// is 0 if the sparse path is disabled.
+        ///
+        Scalar input_sparsity() const
+        {
+            return m_sparsity;
+        }
+
         // prev_layer_data: in_size x nobs
         void forward(const Matrix& prev_layer_data)
+        {
+            forward_ref(prev_layer_data);
+        }
+
+        // The products read the input in place, whatever its outer stride
+        void forward_ref(const ConstRefMat& prev_layer_data)
         {
             const int nobs = prev_layer_data.cols();
             // Linear term z = W' * in + b
-            m_z.resize(this->m_out_size, nobs);
-            m_z.noalias() = m_weight.transpose() * prev_layer_data;
-            m_z.colwise() += m_bias;
+            // If the Jacobian of the activation function does not depend on z,
+            // z is computed in m_a and then overwritten by the activation
+            Matrix& z = internal::JacobianNeedsInput<Activation>::value ? m_z : m_a;
+            z.resize(this->m_out_size, nobs);
+            m_sparse_input = check_sparsity(prev_layer_data);
+
+            if (m_sparse_input)
+            {
+                // z_oj = b_o + sum_k W_ko * in_kj over the nonzero inputs in_kj
+                // W is read in place, one column at a time, so that the column
+                // stays in cache for all observations
+                compress_input(prev_layer_data);
+                const int out_main = this->m_out_size - this->m_out_size % 4;
+
+                // Four outputs at a time, which share the loads of the nonzero inputs
+                for (int o = 0; o < out_main; o += 4)
+                {
+                    const Scalar* w0 = m_weight.col(o).data();
+                    const Scalar* w1 = m_weight.col(o + 1).data();
+                    const Scalar* w2 = m_weight.col(o + 2).data();
+                    const Scalar* w3 = m_weight.col(o + 3).data();
+
+                    for (int j = 0; j < nobs; j++)
+                    {
+                        Scalar z0 = m_bias[o], z1 = m_bias[o + 1], z2 = m_bias[o + 2], z3 = m_bias[o + 3];
+
+                        for (int p = m_nz_start[j]; p < m_nz_start[j + 1]; p++)
+                        {
+                            const int k = m_nz_index[p];
+                            const Scalar x = m_nz_value[p];
+                            z0 += x * w0[k];
+                            z1 += x * w1[k];
+                            z2 += x * w2[k];
+                            z3 += x * w3[k];
+                        }
+
+                        z(o, j) = z0;
+                        z(o + 1, j) = z1;
+                        z(o + 2, j) = z2;
+                        z(o + 3, j) = z3;
+                    }
+                }
+
+                for (int o = out_main; o < this->m_out_size; o++)
+                {
+                    const Scalar* w = m_weight.col(o).data();
+
+                    for (int j = 0; j < nobs; j++)
+                    {
+                        Scalar zoj = m_bias[o];
+
+                        for (int p = m_nz_start[j]; p < m_nz_start[j + 1]; p++)
+                        {
+                            zoj += m_nz_value[p] * w[m_nz_index[p]];
+                        }
+
+                        z(o, j) = zoj;
+                    }
+                }
+            }
+            else if (!m_weight_compact.empty())
+            {
+                // Compact storage, z = W' * in computed block by block, where each
+                // block of W is converted right before it is used
+                const int ncol = panel_cols();
+
+                for (int j = 0; j < this->m_out_size; j += ncol)
+                {
+                    const int n = std::min(ncol, this->m_out_size - j);
+                    unpack_panel(j, n);
+                    z.middleRows(j, n).noalias() = m_panel.leftCols(n).transpose() * prev_layer_data;
+                }
+
+                z.colwise() += m_bias;
+            }
+            else if (nobs == 1)
+            {
+                // A single observation, typically in latency-bound prediction,
+                // is a matrix-vector product accumulated onto the bias, which
+                // saves the dispatch of the matrix product and a pass over z
+                z.col(0).noalias() = m_bias;
+                z.col(0).noalias() += m_weight.transpose() * prev_layer_data.col(0);
+            }
+            else
+            {
+                z.noalias() = m_weight.transpose() * prev_layer_data;
+                z.colwise() += m_bias;
+            }
+
             // Apply activation function
             m_a.resize(this->m_out_size, nobs);
-            Activation::activate(m_z, m_a);
+            Activation::activate(z, m_a);
         }
 
         const Matrix& output() const
@@ -89,21 +427,59 @@ class FullyConnected: public Layer
         // next_layer_data: out_size x nobs
         void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
         {
-            const int nobs = prev_layer_data.cols();
-            // After forward stage, m_z contains z = W' * in + b
+            backprop_ref(prev_layer_data, next_layer_data);
+        }
+
+        // The weight gradient reads the input in place, whatever its outer stride
+        void backprop_ref(const ConstRefMat& prev_layer_data, const Matrix& next_layer_data)
+        {
+            // After forward stage, m_z contains z = W' * in + b if it is needed
             // Now we need to calculate d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
             // d(L) / d(a) is computed in the next layer, contained in next_layer_data
             // The Jacobian matrix J = d(a) / d(z) is determined by the activation function
-            Matrix& dLz = m_z;
+            // dLz overwrites m_z if the Jacobian needs z, and m_a otherwise
+            Matrix& dLz = internal::JacobianNeedsInput<Activation>::value ? m_z : m_a;
             Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
             // Now dLz contains d(L) / d(z)
-            // Derivative for weights, d(L) / d(W) = [d(L) / d(z)] * in'
-            m_dw.noalias() = prev_layer_data * dLz.transpose() / nobs;
-            // Derivative for bias, d(L) / d(b) = d(L) / d(z)
-            m_db.noalias() = dLz.rowwise().mean();
+#ifdef MDNN_USE_THREADS
+
+            // The two products below are independent, so the parameter gradients
+            // are computed in the thread pool while this thread computes d(L) / d_in
+            if (this->m_pool && this->m_trainable && this->m_need_backprop_data)
+            {
+                std::future<void> task = this->m_pool->submit([&]()
+                {
+                    param_gradient(prev_layer_data, dLz);
+                });
+
+                try
+                {
+                    input_gradient(dLz);
+                }
+                catch (...)
+                {
+                    task.wait();
+                    throw;
+                }
+
+                task.get();
+                return;
+            }
+
+#endif
+
+            // The gradients of frozen parameters are not needed
+            if (this->m_trainable)
+            {
+                param_gradient(prev_layer_data, dLz);
+            }
+
             // Compute d(L) / d_in = W * [d(L) / d(z)]
-            m_din.resize(this->m_in_size, nobs);
-            m_din.noalias() = m_weight * dLz;
+            // It is not needed if no layer below is trainable
+            if (this->m_need_backprop_data)
+            {
+                input_gradient(dLz);
+            }
         }
 
         const Matrix& backprop_data() const
@@ -113,6 +489,12 @@ class FullyConnected: public Layer
 
         void update(Optimizer& opt)
         {
+            if (!this->m_trainable)
+            {
+                return;
+            }
+
+            own_parameters();
             ConstAlignedMapVec dw(m_dw.data(), m_dw.size());
             ConstAlignedMapVec db(m_db.data(), m_db.size());
             AlignedMapVec      w(m_weight.data(), m_weight.size());
@@ -121,13 +503,33 @@ class FullyConnected: public Layer
             opt.update(db, b);
         }
 
-        std::vector<Scalar> get_parameters() const
+        int num_parameters() const
         {
-            std::vector<Scalar> res(m_weight.size() + m_bias.size());
+            return m_weight.size() + m_bias.size();
+        }
+
+        void copy_parameters(std::vector<Scalar>& res) const
+        {
+            res.resize(m_weight.size() + m_bias.size());
+
             // Copy the data of weights and bias to a long vector
-            std::copy(m_weight.data(), m_weight.data() + m_weight.size(), res.begin());
+            if (m_weight_compact.empty())
+            {
+                std::copy(m_weight.data(), m_weight.data() + m_weight.size(), res.begin());
+            }
+            else
+            {
+                m_weight_compact.unpack(&res[0]);
+            }
+
             std::copy(m_bias.data(), m_bias.data() + m_bias.size(),
                       res.begin() + m_weight.size());
+        }
+
+        std::vector<Scalar> get_parameters() const
+        {
+            std::vector<Scalar> res;
+            copy_parameters(res);
             return res;
         }
 
@@ -138,10 +540,78 @@ class FullyConnected: public Layer
                 throw std::invalid_argument("[class FullyConnected]: Parameter size does not match");
             }
 
+            own_parameters();
             std::copy(param.begin(), param.begin() + m_weight.size(), m_weight.data());
             std::copy(param.begin() + m_weight.size(), param.end(), m_bias.data());
         }
 
+        void map_parameters(const Scalar* data, int size)
+        {
+            if (size != this->m_in_size * this->m_out_size + this->m_out_size)
+            {
+                throw std::invalid_argument("[class FullyConnected]: Parameter size does not match");
+            }
+
+            // The mapped memory is never written, see own_parameters()
+            Scalar* weight = const_cast<Scalar*>(data);
+            set_storage(weight, weight + this->m_in_size * this->m_out_size);
+            m_mapped = true;
+            m_weight_compact.release();
+            // Release the storage allocated by init()
+            m_weight_data.resize(0, 0);
+            m_bias_data.resize(0);
+        }
+
+        void map_compact_parameters(const uint16_t* data, int size, PRECISION precision)
+        {
+            const int nweight = this->m_in_size * this->m_out_size;
+
+            if (size != nweight + this->m_out_size)
+            {
+                throw std::invalid_argument("[class FullyConnected]: Parameter size does not match");
+            }
+
+            // The weights are used in place, and the bias is converted to Scalar
+            m_weight_compact.map(data, nweight, precision);
+            m_bias_data.resize(this->m_out_size);
+            internal::unpack_scalars(data + nweight, this->m_out_size, m_bias_data.data(), precision);
+            set_storage(NULL, m_bias_data.data());
+            m_mapped = false;
+            m_weight_data.resize(0, 0);
+        }
+
+        ///
+        /// Store the weights in a 16-bit format, see Layer::set_storage_precision()
+        ///
+        /// The weights take a quarter (with double as Scalar) or half (with float)
+        /// of the memory. forward() and the gradient of input units convert them
+        /// one block of columns at a time, and the sparse forward path is disabled.
+        /// The bias is kept in Scalar.
+        ///
+        void set_storage_precision(PRECISION precision)
+        {
+            if (precision == m_weight_compact.precision())
+            {
+                return;
+            }
+
+            own_parameters();
+
+            if (precision == SCALAR_PRECISION)
+            {
+                return;
+            }
+
+            m_weight_compact.pack(m_weight.data(), m_weight.size(), precision);
+            set_storage(NULL, m_bias_data.data());
+            m_weight_data.resize(0, 0);
+        }
+
+        PRECISION storage_precision() const
+        {
+            return m_weight_compact.precision();
+        }
+
         std::vector<Scalar> get_derivatives() const
         {
             std::vector<Scalar> res(m_dw.size() + m_db.size());
@@ -169,6 +639,47 @@ class FullyConnected: public Layer
             map.insert(std::make_pair("in_size" + ind, in_size()));
             map.insert(std::make_pair("out_size" + ind, out_size()));
         }
+
+        LayerCost forward_cost(int nobs) const
+        {
+            // z = W' * in + b, a = act(z)
+            const double in = this->m_in_size, out = this->m_out_size, n = nobs;
+            const double flops = 2 * in * out * n + 2 * out * n;
+            // Read W, b, in, and z, write z and a
+            const double weight_bytes = m_weight_compact.empty() ? sizeof(Scalar) : sizeof(uint16_t);
+            const double read = out + in * n + out * n;
+            const double written = 2 * out * n;
+            return LayerCost(flops, read * sizeof(Scalar) + in * out * weight_bytes,
+                             written * sizeof(Scalar));
+        }
+
+        LayerCost backprop_cost(int nobs) const
+        {
+            // dLz = J * next, dW = in * dLz', db = mean(dLz), din = W * dLz
+            const double in = this->m_in_size, out = this->m_out_size, n = nobs;
+            // Read z, a and next, write dLz
+            double flops = 2 * out * n;
+            double read = 3 * out * n;
+            double written = out * n;
+
+            if (this->m_trainable)
+            {
+                // Read in and dLz, write dW and db
+                flops += 2 * in * out * n + out * n;
+                read += in * n + out * n;
+                written += in * out + out;
+            }
+
+            if (this->m_need_backprop_data)
+            {
+                // Read dLz and W, write din
+                flops += 2 * in * out * n;
+                read += out * n + in * out;
+                written += in * n;
+            }
+
+            return LayerCost(flops, read * sizeof(Scalar), written * sizeof(Scalar));
+        }
 };
 
 
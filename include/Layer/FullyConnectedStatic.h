@@ -0,0 +1,188 @@
+#ifndef LAYER_FULLYCONNECTEDSTATIC_H_
+#define LAYER_FULLYCONNECTEDSTATIC_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "../Config.h"
+#include "../RNG.h"
+#include "../Optimizer.h"
+#include "../Utils/Random.h"
+#include "../Utils/ActivationTraits.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Layers
+///
+/// Fully connected hidden layer with dimensions known at compile time, used
+/// in StaticNetwork
+///
+/// The layer computes the same function as FullyConnected<Activation>, and its
+/// parameters are laid out in the same way by get_parameters() and
+/// set_parameters(). Unlike FullyConnected, it is not derived from Layer, so
+/// its member functions are not virtual and can be inlined, and it uses
+/// fixed-size Eigen types. A single observation is processed by predict()
+/// without any heap allocation, and a mini-batch, whose number of
+/// observations is only known at run time, by forward() and backprop().
+///
+/// The parameters are stored inside the object, so the layer is meant for
+/// small models, e.g. with a few thousand parameters.
+///
+/// \tparam InSize     Number of input units.
+/// \tparam OutSize    Number of output units.
+/// \tparam Activation The activation function, such as ReLU.
+///
+template <int InSize, int OutSize, typename Activation>
+class FullyConnectedStatic
+{
+    public:
+        static const int in_size = InSize;
+        static const int out_size = OutSize;
+        static const int num_parameters = InSize * OutSize + OutSize;
+
+        typedef Eigen::Matrix<Scalar, InSize, 1> InputVector;
+        typedef Eigen::Matrix<Scalar, OutSize, 1> OutputVector;
+        typedef Eigen::Matrix<Scalar, InSize, Eigen::Dynamic> InputMatrix;
+        typedef Eigen::Matrix<Scalar, OutSize, Eigen::Dynamic> OutputMatrix;
+
+    private:
+        typedef Eigen::Matrix<Scalar, InSize, OutSize> WeightMatrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef Vector::AlignedMapType AlignedMapVec;
+
+        // Optimizer::update() takes aligned maps, and fixed-size matrices whose
+        // sizes are not multiples of the packet size are not aligned by Eigen
+        EIGEN_ALIGN_MAX WeightMatrix m_weight; // Weight parameters, W(in_size x out_size)
+        EIGEN_ALIGN_MAX OutputVector m_bias;   // Bias parameters, b(out_size x 1)
+        EIGEN_ALIGN_MAX WeightMatrix m_dw;     // Derivative of weights
+        EIGEN_ALIGN_MAX OutputVector m_db;     // Derivative of bias
+        OutputMatrix m_z;   // Linear term, z = W' * in + b. Only kept if the
+                            // activation function needs it in backprop
+        OutputMatrix m_a;   // Output of this layer, a = act(z)
+        InputMatrix  m_din; // Derivative of the input of this layer
+
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        FullyConnectedStatic()
+        {
+            m_weight.setZero();
+            m_bias.setZero();
+            m_dw.setZero();
+            m_db.setZero();
+        }
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+        {
+            // Same order of random numbers as FullyConnected
+            internal::set_normal_random(m_weight.data(), m_weight.size(), rng, mu, sigma);
+            internal::set_normal_random(m_bias.data(), m_bias.size(), rng, mu, sigma);
+        }
+
+        // Output of a single observation
+        OutputVector predict(const InputVector& x) const
+        {
+            OutputVector z, a;
+            z.noalias() = m_weight.transpose() * x;
+            z += m_bias;
+            Activation::activate(z, a);
+            return a;
+        }
+
+        // prev_layer_data: in_size x nobs
+        void forward(const InputMatrix& prev_layer_data)
+        {
+            const int nobs = prev_layer_data.cols();
+            // If the Jacobian of the activation function does not depend on z,
+            // z is computed in m_a and then overwritten by the activation
+            OutputMatrix& z = internal::JacobianNeedsInput<Activation>::value ? m_z : m_a;
+            z.resize(OutSize, nobs);
+            z.noalias() = m_weight.transpose() * prev_layer_data;
+            z.colwise() += m_bias;
+            m_a.resize(OutSize, nobs);
+            Activation::activate(z, m_a);
+        }
+
+        const OutputMatrix& output() const
+        {
+            return m_a;
+        }
+
+        // prev_layer_data: in_size x nobs
+        // next_layer_data: out_size x nobs
+        // If need_backprop_data is false, d(L) / d_in is not computed
+        void backprop(const InputMatrix& prev_layer_data, const OutputMatrix& next_layer_data,
+                      bool need_backprop_data = true)
+        {
+            const int nobs = prev_layer_data.cols();
+            // d(L) / d(z) overwrites m_z if the Jacobian needs z, and m_a otherwise
+            OutputMatrix& dLz = internal::JacobianNeedsInput<Activation>::value ? m_z : m_a;
+            Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+            // d(L) / d(W) = in * [d(L) / d(z)]', d(L) / d(b) = d(L) / d(z)
+            // The product is written in place and then scaled, so that no temporary
+            // matrix is created
+            m_dw.noalias() = prev_layer_data * dLz.transpose();
+            m_dw /= Scalar(nobs);
+            m_db.noalias() = dLz.rowwise().mean();
+
+            // d(L) / d_in = W * [d(L) / d(z)]
+            if (need_backprop_data)
+            {
+                m_din.noalias() = m_weight * dLz;
+            }
+        }
+
+        const InputMatrix& backprop_data() const
+        {
+            return m_din;
+        }
+
+        void update(Optimizer& opt)
+        {
+            ConstAlignedMapVec dw(m_dw.data(), m_dw.size());
+            ConstAlignedMapVec db(m_db.data(), m_db.size());
+            AlignedMapVec      w(m_weight.data(), m_weight.size());
+            AlignedMapVec      b(m_bias.data(), m_bias.size());
+            opt.update(dw, w);
+            opt.update(db, b);
+        }
+
+        // The weights, column by column, followed by the bias
+        std::vector<Scalar> get_parameters() const
+        {
+            std::vector<Scalar> res(num_parameters);
+            std::copy(m_weight.data(), m_weight.data() + m_weight.size(), res.begin());
+            std::copy(m_bias.data(), m_bias.data() + m_bias.size(), res.begin() + m_weight.size());
+            return res;
+        }
+
+        void set_parameters(const std::vector<Scalar>& param)
+        {
+            if (static_cast<int>(param.size()) != num_parameters)
+            {
+                throw std::invalid_argument("[class FullyConnectedStatic]: Parameter size does not match");
+            }
+
+            std::copy(param.begin(), param.begin() + m_weight.size(), m_weight.data());
+            std::copy(param.begin() + m_weight.size(), param.end(), m_bias.data());
+        }
+
+        std::vector<Scalar> get_derivatives() const
+        {
+            std::vector<Scalar> res(num_parameters);
+            std::copy(m_dw.data(), m_dw.data() + m_dw.size(), res.begin());
+            std::copy(m_db.data(), m_db.data() + m_db.size(), res.begin() + m_dw.size());
+            return res;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* LAYER_FULLYCONNECTEDSTATIC_H_ */
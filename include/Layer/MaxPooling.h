@@ -9,6 +9,7 @@
 #include "../Utils/FindMax.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
+#include "../Utils/ActivationTraits.h"
 
 namespace MiniDNN
 {
@@ -39,47 +40,23 @@ class MaxPooling: public Layer
         const int m_out_cols;
 
         IntMatrix m_loc;             // Record the locations of maximums
-        Matrix m_z;                  // Max pooling results
+        Matrix m_z;                  // Max pooling results. Only kept if the activation
+                                     // function needs it in backprop
         Matrix m_a;                  // Output of this layer, a = act(z)
         Matrix m_din;                // Derivative of the input of this layer.
                                      // Note that input of this layer is also the output of previous layer
 
-    public:
-        // Currently we only implement the "valid" rule
-        // https://stackoverflow.com/q/37674306
-        ///
-        /// Constructor
-        ///
-        /// \param in_width       Width of the input image in each channel.
-        /// \param in_height      Height of the input image in each channel.
-        /// \param in_channels    Number of input channels.
-        /// \param pooling_width  Width of the pooling window.
-        /// \param pooling_height Height of the pooling window.
-        ///
-        MaxPooling(const int in_width_, const int in_height_, const int in_channels_,
-                   const int pooling_width_, const int pooling_height_) :
-            Layer(in_width_ * in_height_ * in_channels_,
-                  (in_width_ / pooling_width_) * (in_height_ / pooling_height_) * in_channels_),
-            m_channel_rows(in_height_), m_channel_cols(in_width_),
-            m_in_channels(in_channels_),
-            m_pool_rows(pooling_height_), m_pool_cols(pooling_width_),
-            m_out_rows(m_channel_rows / m_pool_rows),
-            m_out_cols(m_channel_cols / m_pool_cols)
-        {}
-
-        void init(const Scalar& mu, const Scalar& sigma, RNG& rng) {}
-
-        void init() {}
-
-        void forward(const Matrix& prev_layer_data)
+        // src: in_size x nobs, stored contiguously
+        void forward_data(const Scalar* src, int nobs)
         {
-            // Each column is an observation
-            const int nobs = prev_layer_data.cols();
             m_loc.resize(this->m_out_size, nobs);
-            m_z.resize(this->m_out_size, nobs);
+            // If the Jacobian of the activation function does not depend on z,
+            // z is computed in m_a and then overwritten by the activation
+            Matrix& z = internal::JacobianNeedsInput<Activation>::value ? m_z : m_a;
+            z.resize(this->m_out_size, nobs);
             // Use m_loc to store the address of each pooling block relative to the beginning of the data
             int* loc_data = m_loc.data();
-            const int channel_end = prev_layer_data.size();
+            const int channel_end = this->m_in_size * nobs;
             const int channel_stride = m_channel_rows * m_channel_cols;
             const int col_end_gap = m_channel_rows * m_pool_cols * m_out_cols;
             const int col_stride = m_channel_rows * m_pool_cols;
@@ -106,8 +83,7 @@ class MaxPooling: public Layer
             // Find the location of the max value in each block
             loc_data = m_loc.data();
             const int* const loc_end = loc_data + m_loc.size();
-            Scalar* z_data = m_z.data();
-            const Scalar* src = prev_layer_data.data();
+            Scalar* z_data = z.data();
 
             for (; loc_data < loc_end; loc_data++, z_data++)
             {
@@ -119,7 +95,53 @@ class MaxPooling: public Layer
 
             // Apply activation function
             m_a.resize(this->m_out_size, nobs);
-            Activation::activate(m_z, m_a);
+            Activation::activate(z, m_a);
+        }
+
+    public:
+        // Currently we only implement the "valid" rule
+        // https://stackoverflow.com/q/37674306
+        ///
+        /// Constructor
+        ///
+        /// \param in_width       Width of the input image in each channel.
+        /// \param in_height      Height of the input image in each channel.
+        /// \param in_channels    Number of input channels.
+        /// \param pooling_width  Width of the pooling window.
+        /// \param pooling_height Height of the pooling window.
+        ///
+        MaxPooling(const int in_width_, const int in_height_, const int in_channels_,
+                   const int pooling_width_, const int pooling_height_) :
+            Layer(in_width_ * in_height_ * in_channels_,
+                  (in_width_ / pooling_width_) * (in_height_ / pooling_height_) * in_channels_),
+            m_channel_rows(in_height_), m_channel_cols(in_width_),
+            m_in_channels(in_channels_),
+            m_pool_rows(pooling_height_), m_pool_cols(pooling_width_),
+            m_out_rows(m_channel_rows / m_pool_rows),
+            m_out_cols(m_channel_cols / m_pool_cols)
+        {}
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng) {}
+
+        void init() {}
+
+        void forward(const Matrix& prev_layer_data)
+        {
+            forward_data(prev_layer_data.data(), prev_layer_data.cols());
+        }
+
+        // The pooling loops need the observations to be stored one after
+        // another, so only other inputs are copied
+        void forward_ref(const ConstRefMat& prev_layer_data)
+        {
+            if (prev_layer_data.cols() <= 1 || prev_layer_data.outerStride() == this->m_in_size)
+            {
+                forward_data(prev_layer_data.data(), prev_layer_data.cols());
+            }
+            else
+            {
+                Layer::forward_ref(prev_layer_data);
+            }
         }
 
         const Matrix& output() const
@@ -131,12 +153,26 @@ class MaxPooling: public Layer
         // next_layer_data: out_size x nobs
         void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
         {
+            backprop_ref(prev_layer_data, next_layer_data);
+        }
+
+        // Only the number of observations is read from the input
+        void backprop_ref(const ConstRefMat& prev_layer_data, const Matrix& next_layer_data)
+        {
+            // This layer has no parameters, so there is nothing to compute
+            // if the gradient of input units is not needed
+            if (!this->m_need_backprop_data)
+            {
+                return;
+            }
+
             const int nobs = prev_layer_data.cols();
-            // After forward stage, m_z contains z = max_pooling(in)
+            // After forward stage, m_z contains z = max_pooling(in) if it is needed
             // Now we need to calculate d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
             // d(L) / d(z) is computed in the next layer, contained in next_layer_data
             // The Jacobian matrix J = d(a) / d(z) is determined by the activation function
-            Matrix& dLz = m_z;
+            // dLz overwrites m_z if the Jacobian needs z, and m_a otherwise
+            Matrix& dLz = internal::JacobianNeedsInput<Activation>::value ? m_z : m_a;
             Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
             // d(L) / d(in_i) = sum_j{ [d(z_j) / d(in_i)] * [d(L) / d(z_j)] }
             // d(z_j) / d(in_i) = 1 if in_i is used to compute z_j and is the maximum
@@ -194,6 +230,33 @@ class MaxPooling: public Layer
             map.insert(std::make_pair("pooling_width" + ind, m_pool_cols));
             map.insert(std::make_pair("pooling_height" + ind, m_pool_rows));
         }
+
+        LayerCost forward_cost(int nobs) const
+        {
+            // Comparisons within each pooling window are counted as floating-point operations
+            const double out = this->m_out_size, n = nobs;
+            const double flops = out * n * m_pool_rows * m_pool_cols + out * n;
+            // Read input and z, write z, a and the locations of maximums
+            const double read = (this->m_in_size * n + out * n) * sizeof(Scalar);
+            const double written = 2 * out * n * sizeof(Scalar) + out * n * sizeof(int);
+            return LayerCost(flops, read, written);
+        }
+
+        LayerCost backprop_cost(int nobs) const
+        {
+            if (!this->m_need_backprop_data)
+            {
+                return LayerCost();
+            }
+
+            // dLz = J * next, and scatter dLz to the locations of maximums
+            const double out = this->m_out_size, n = nobs;
+            const double flops = 2 * out * n;
+            // Read z, a, next, dLz and the locations, write dLz and din
+            const double read = 4 * out * n * sizeof(Scalar) + out * n * sizeof(int);
+            const double written = (out * n + this->m_in_size * n) * sizeof(Scalar);
+            return LayerCost(flops, read, written);
+        }
 };
 
 
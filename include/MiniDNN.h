@@ -6,11 +6,13 @@
 #include "Config.h"
 
 #include "RNG.h"
+#include "RNG/Philox.h"
 
 #include "Layer.h"
 #include "Layer/FullyConnected.h"
 #include "Layer/Convolutional.h"
 #include "Layer/MaxPooling.h"
+#include "Layer/FullyConnectedStatic.h"
 
 #include "Activation/Identity.h"
 #include "Activation/ReLU.h"
@@ -32,8 +34,17 @@
 
 #include "Callback.h"
 #include "Callback/VerboseCallback.h"
+#include "Callback/ProfilerCallback.h"
+
+#include "Tracer.h"
+#include "Tracer/ChromeTracer.h"
+
+#include "NpyArray.h"
 
 #include "Network.h"
+#include "StaticNetwork.h"
+#include "ModelHolder.h"
+#include "BatchPredictor.h"
 
 
 #endif /* MINIDNN_H_ */
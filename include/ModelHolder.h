@@ -0,0 +1,524 @@
+#ifndef MODELHOLDER_H_
+#define MODELHOLDER_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include "Config.h"
+#include "Network.h"
+#include "Utils/Timer.h"
+
+#ifdef MDNN_USE_THREADS
+    #include <memory>
+    #include <atomic>
+    #include <thread>
+    #include <mutex>
+    #include <condition_variable>
+    #include <exception>
+    #include <chrono>
+#endif
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Network
+///
+/// Timing information of the model updates of a ModelHolder
+///
+struct SwapStats
+{
+    long   nswap;            // Number of models published
+    long   nfail;            // Number of background loads that failed
+    double load_time;        // Wall time of reading and warming up the latest model, in seconds
+    double max_load_time;    // Maximum of load_time
+    double publish_time;     // Wall time of the latest pointer swap, which is the only
+                             // step that predictions can observe
+    double max_publish_time; // Maximum of publish_time
+    double retire_time;      // Wall time from the latest swap until the model it
+                             // replaced was released, i.e., until the predictions
+                             // using it had finished
+    double max_retire_time;  // Maximum of retire_time
+
+    SwapStats() :
+        nswap(0), nfail(0), load_time(0.0), max_load_time(0.0),
+        publish_time(0.0), max_publish_time(0.0), retire_time(0.0), max_retire_time(0.0)
+    {}
+};
+
+///
+/// \ingroup Network
+///
+/// Holds the model of a serving process, and replaces it while predictions are
+/// being made
+///
+/// Network::read_net() changes the network in place, so a process that serves
+/// predictions has to stop while a new model is loaded. A ModelHolder instead
+/// loads the new model into separate Network objects, runs a prediction on
+/// them to allocate their buffers and to bring their parameters into memory,
+/// and then publishes the model by atomically swapping a pointer, in the
+/// manner of read-copy-update. Predictions that have started before the swap
+/// finish on the previous model, which is released once the last of them has
+/// returned, and later predictions use the new model. Neither the loading nor
+/// the release of a model happens in a thread that makes predictions.
+///
+/// \code
+/// ModelHolder holder(4);          // Four replicas of each model
+/// holder.load("model_v1.mdnn");   // Wait for the first model
+/// // In the serving threads
+/// Matrix pred = holder.predict(x);
+/// // When a new model is available
+/// holder.load_async("model_v2.mdnn");
+/// \endcode
+///
+/// A Network can only evaluate one prediction at a time, so each model is
+/// loaded into a number of replicas, and concurrent predictions use different
+/// replicas. Since read_net(const std::string&) maps the model file into
+/// memory, the replicas share their parameters in the page cache. If all
+/// replicas are busy, a prediction waits for one of them.
+///
+/// Background loading and concurrent predictions require `MDNN_USE_THREADS`.
+/// Without it, models are loaded in the calling thread, and a single replica
+/// is used.
+///
+class ModelHolder
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+        // The replicas of a published model
+        struct Model
+        {
+            std::vector<Network*> nets;
+            long                  version;
+#ifdef MDNN_USE_THREADS
+            std::unique_ptr<std::mutex[]> locks; // Lock of each replica
+            std::atomic<unsigned>         next;  // Replica to try first in the next prediction
+#endif
+
+            explicit Model(int nreplica) :
+                nets(nreplica, static_cast<Network*>(NULL)), version(0)
+#ifdef MDNN_USE_THREADS
+                , locks(new std::mutex[nreplica]), next(0)
+#endif
+            {}
+
+            ~Model()
+            {
+                for (std::size_t i = 0; i < nets.size(); i++)
+                {
+                    delete nets[i];
+                }
+            }
+        };
+
+        const int m_nreplica;   // Number of replicas of each model loaded from a file
+        const int m_warmup;     // Number of observations of the warm-up prediction
+        long      m_version;    // Version of the latest published model
+        SwapStats m_stats;
+#ifdef MDNN_USE_THREADS
+        std::shared_ptr<Model>  m_current;  // Published model, only accessed atomically
+        // Replaced models, and the time they were replaced
+        std::vector< std::pair<std::shared_ptr<Model>, double> > m_retired;
+        std::string             m_pending;  // File to be loaded in the background
+        bool                    m_has_pending;
+        bool                    m_loading;
+        bool                    m_stop;
+        std::exception_ptr      m_error;    // Error of the last failed background load
+        mutable std::mutex      m_mutex;
+        std::condition_variable m_cond;
+        std::thread             m_thread;
+#else
+        Model*    m_current;
+#endif
+
+        ModelHolder(const ModelHolder&);
+        ModelHolder& operator=(const ModelHolder&);
+
+        // Prepare the first prediction of a network
+        void warm_up(Network& net) const
+        {
+            if (net.num_layers() <= 0)
+            {
+                throw std::invalid_argument("[class ModelHolder]: Network has no layers");
+            }
+
+            if (m_warmup > 0)
+            {
+                net.predict(Matrix::Zero(net.get_layers()[0]->in_size(), m_warmup));
+            }
+        }
+
+        // Read the replicas of a model and warm them up
+        Model* read_model(const std::string& filename)
+        {
+            const double start = internal::wall_time();
+            Model* model = new Model(m_nreplica);
+
+            try
+            {
+                for (int i = 0; i < m_nreplica; i++)
+                {
+                    model->nets[i] = new Network();
+                    model->nets[i]->read_net(filename);
+                    warm_up(*model->nets[i]);
+                }
+            }
+            catch (...)
+            {
+                delete model;
+                throw;
+            }
+
+            const double elapsed = internal::wall_time() - start;
+#ifdef MDNN_USE_THREADS
+            std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+            m_stats.load_time = elapsed;
+            m_stats.max_load_time = std::max(m_stats.max_load_time, elapsed);
+            return model;
+        }
+
+        // Make the model visible to predictions, and retire the previous one
+        void publish_model(Model* model)
+        {
+#ifdef MDNN_USE_THREADS
+            std::shared_ptr<Model> next(model);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                model->version = ++m_version;
+                const double start = internal::wall_time();
+                std::shared_ptr<Model> prev = std::atomic_exchange(&m_current, next);
+                const double now = internal::wall_time();
+                update_publish_stats(now - start);
+
+                // The previous model is released by the worker thread, so that
+                // its destructor does not run in a prediction
+                if (prev)
+                {
+                    m_retired.push_back(std::make_pair(prev, now));
+                }
+            }
+            m_cond.notify_all();
+#else
+            model->version = ++m_version;
+            const double start = internal::wall_time();
+            Model* prev = m_current;
+            m_current = model;
+            const double now = internal::wall_time();
+            update_publish_stats(now - start);
+
+            if (prev)
+            {
+                delete prev;
+                update_retire_stats(internal::wall_time() - now);
+            }
+#endif
+        }
+
+        void update_publish_stats(double elapsed)
+        {
+            m_stats.nswap++;
+            m_stats.publish_time = elapsed;
+            m_stats.max_publish_time = std::max(m_stats.max_publish_time, elapsed);
+        }
+
+        void update_retire_stats(double elapsed)
+        {
+            m_stats.retire_time = elapsed;
+            m_stats.max_retire_time = std::max(m_stats.max_retire_time, elapsed);
+        }
+
+#ifdef MDNN_USE_THREADS
+        // Release the retired models that are no longer used. Called with m_mutex locked
+        void release_retired(std::unique_lock<std::mutex>& lock)
+        {
+            std::vector< std::shared_ptr<Model> > released;
+
+            for (std::size_t i = 0; i < m_retired.size(); )
+            {
+                // Once a model is unpublished, its count can only decrease
+                if (m_retired[i].first.use_count() == 1)
+                {
+                    released.push_back(m_retired[i].first);
+                    update_retire_stats(internal::wall_time() - m_retired[i].second);
+                    m_retired.erase(m_retired.begin() + i);
+                }
+                else
+                {
+                    i++;
+                }
+            }
+
+            // Destroy the networks without holding the lock
+            lock.unlock();
+            released.clear();
+            lock.lock();
+        }
+
+        void worker()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (true)
+            {
+                release_retired(lock);
+
+                if (m_stop)
+                {
+                    return;
+                }
+
+                if (!m_has_pending)
+                {
+                    // Models still in use are checked again after a short while
+                    if (m_retired.empty())
+                    {
+                        m_cond.wait(lock);
+                    }
+                    else
+                    {
+                        m_cond.wait_for(lock, std::chrono::milliseconds(1));
+                    }
+                    continue;
+                }
+
+                const std::string filename = m_pending;
+                m_has_pending = false;
+                m_loading = true;
+                lock.unlock();
+
+                try
+                {
+                    Model* model = read_model(filename);
+                    publish_model(model);
+                    lock.lock();
+                }
+                catch (...)
+                {
+                    lock.lock();
+                    m_error = std::current_exception();
+                    m_stats.nfail++;
+                }
+
+                m_loading = false;
+                m_cond.notify_all();
+            }
+        }
+#endif
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param nreplica Number of replicas of each model loaded from a file,
+        ///                 which is the number of predictions that can run at
+        ///                 the same time. Default is 1. Ignored without
+        ///                 `MDNN_USE_THREADS`.
+        /// \param warmup   Number of observations of the prediction that is made
+        ///                 on each replica before it is published. Default is 1,
+        ///                 and 0 disables the warm-up.
+        ///
+        explicit ModelHolder(int nreplica = 1, int warmup = 1) :
+#ifdef MDNN_USE_THREADS
+            m_nreplica(nreplica),
+#else
+            m_nreplica(1),
+#endif
+            m_warmup(warmup), m_version(0),
+#ifdef MDNN_USE_THREADS
+            m_has_pending(false), m_loading(false), m_stop(false)
+#else
+            m_current(NULL)
+#endif
+        {
+            if (nreplica <= 0)
+            {
+                throw std::invalid_argument("[class ModelHolder]: Number of replicas must be positive");
+            }
+
+#ifdef MDNN_USE_THREADS
+            m_thread = std::thread(&ModelHolder::worker, this);
+#endif
+        }
+
+        ///
+        /// Destructor. A background load that has not started is discarded, and
+        /// no prediction may be running.
+        ///
+        ~ModelHolder()
+        {
+#ifdef MDNN_USE_THREADS
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cond.notify_all();
+            m_thread.join();
+#else
+            delete m_current;
+#endif
+        }
+
+        ///
+        /// Read a model from a file written by Network::export_net(const std::string&, PRECISION),
+        /// and publish it when it is ready. The function returns after the model
+        /// has been published. If reading fails, an exception is thrown, and the
+        /// current model is kept.
+        ///
+        /// \param filename The path of the model file, which must not be modified
+        ///                 while the model is used. A new model should be written
+        ///                 to a new file.
+        ///
+        void load(const std::string& filename)
+        {
+            publish_model(read_model(filename));
+        }
+
+        ///
+        /// Read a model in a background thread, and publish it when it is ready.
+        /// The function returns immediately. If another file is passed before
+        /// the loading has started, only the latest one is loaded. Errors are
+        /// reported by wait().
+        ///
+        /// Without `MDNN_USE_THREADS`, this is the same as load().
+        ///
+        /// \param filename The path of the model file.
+        ///
+        void load_async(const std::string& filename)
+        {
+#ifdef MDNN_USE_THREADS
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending = filename;
+                m_has_pending = true;
+            }
+            m_cond.notify_all();
+#else
+            load(filename);
+#endif
+        }
+
+        ///
+        /// Publish a network that has been built or trained by the caller, for
+        /// example with Network::fit(). The holder takes the ownership of the
+        /// network, which is used as the only replica of the model.
+        ///
+        /// \param net Pointer to a network allocated by `new`.
+        ///
+        void publish(Network* net)
+        {
+            Model* model = new Model(1);
+            model->nets[0] = net;
+
+            try
+            {
+                warm_up(*net);
+            }
+            catch (...)
+            {
+                delete model;
+                throw;
+            }
+
+            publish_model(model);
+        }
+
+        ///
+        /// Wait until the background loads have finished, and rethrow the error
+        /// of a failed load, if any
+        ///
+        void wait()
+        {
+#ifdef MDNN_USE_THREADS
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return !m_has_pending && !m_loading; });
+
+            if (m_error)
+            {
+                std::exception_ptr error = m_error;
+                m_error = std::exception_ptr();
+                std::rethrow_exception(error);
+            }
+#endif
+        }
+
+        ///
+        /// Use the current model to make predictions. This function can be
+        /// called from several threads at the same time, and while a new model
+        /// is being loaded.
+        ///
+        /// \param x The predictors. Each column is an observation.
+        ///
+        Matrix predict(const Matrix& x)
+        {
+#ifdef MDNN_USE_THREADS
+            // Holding the pointer keeps the model alive until the prediction returns
+            std::shared_ptr<Model> model = std::atomic_load(&m_current);
+
+            if (!model)
+            {
+                throw std::runtime_error("[class ModelHolder]: No model has been published");
+            }
+
+            // Take the first free replica, or wait for one of them
+            const int nreplica = model->nets.size();
+            const int first = model->next.fetch_add(1, std::memory_order_relaxed) % nreplica;
+
+            for (int i = 0; i < nreplica; i++)
+            {
+                const int k = (first + i) % nreplica;
+                std::unique_lock<std::mutex> lock(model->locks[k], std::try_to_lock);
+
+                if (lock.owns_lock())
+                {
+                    return model->nets[k]->predict(x);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(model->locks[first]);
+            return model->nets[first]->predict(x);
+#else
+            if (!m_current)
+            {
+                throw std::runtime_error("[class ModelHolder]: No model has been published");
+            }
+
+            return m_current->nets[0]->predict(x);
+#endif
+        }
+
+        ///
+        /// Version of the current model, which is increased by one each time a
+        /// model is published, or 0 if no model has been published
+        ///
+        long version() const
+        {
+#ifdef MDNN_USE_THREADS
+            std::shared_ptr<Model> model = std::atomic_load(&m_current);
+#else
+            const Model* model = m_current;
+#endif
+            return model ? model->version : 0;
+        }
+
+        ///
+        /// Timing information of the model updates
+        ///
+        SwapStats swap_stats() const
+        {
+#ifdef MDNN_USE_THREADS
+            std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+            return m_stats;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* MODELHOLDER_H_ */
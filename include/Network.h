@@ -5,12 +5,27 @@
 #include <vector>
 #include <map>
 #include <stdexcept>
+#include <string>
+#include <algorithm>
 #include "Config.h"
+#ifdef MDNN_USE_THREADS
+    #include <future>
+#endif
 #include "RNG.h"
+#include "RNG/Philox.h"
 #include "Layer.h"
 #include "Output.h"
 #include "Callback.h"
+#include "Profiler.h"
+#include "AllocTracker.h"
+#include "Tracer.h"
 #include "Utils/Random.h"
+#include "Utils/Timer.h"
+#include "Utils/ThreadPool.h"
+#include "Utils/MappedFile.h"
+#include "Utils/ModelFile.h"
+#include "Utils/Checkpoint.h"
+#include "Utils/CodeGen.h"
 #include "Utils/IO.h"
 #include "Utils/Factory.h"
 
@@ -33,6 +48,8 @@ class Network
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef Eigen::Ref<Matrix> RefMat;
         typedef Eigen::RowVectorXi IntegerVector;
         typedef std::map<std::string, int> MetaInfo;
 
@@ -44,6 +61,26 @@ class Network
         Callback            m_default_callback; // Default callback function
         Callback*           m_callback;         // Points to user-provided callback function,
                                                 // otherwise points to m_default_callback
+        bool                m_prefetch;         // Whether to gather mini-batches in a background thread
+        bool                m_feature_cache;    // Whether to cache the outputs of the frozen prefix in fit()
+        bool                m_deterministic;    // Whether results must not depend on the number of threads
+        std::string         m_feature_cache_file; // File to store the cached outputs, or empty to use memory
+        internal::MappedFile m_model_file;      // Model file whose parameters are used by the layers
+        internal::Checkpointer* m_checkpointer; // Writes checkpoints during fit(), or NULL
+        int                 m_checkpoint_epochs;  // Epochs between checkpoints, or 0
+        int                 m_checkpoint_batches; // Mini-batches between checkpoints, or 0
+        Profiler            m_profiler;         // Timing information of the hot path
+        Tracer              m_default_tracer;   // Default tracer that records nothing
+        Tracer*             m_tracer;           // Points to user-provided tracer,
+                                                // otherwise points to m_default_tracer
+        internal::ThreadPool* m_pool;           // Worker threads for concurrent computations in layers, or NULL
+        internal::ThreadPool* m_update_pool;    // Single worker thread that applies optimizer updates, or NULL
+        internal::ThreadPool* m_prefetch_pool;  // Single worker thread that gathers mini-batches, or NULL
+#ifdef MDNN_USE_THREADS
+        std::vector< std::future<void> > m_pending_updates; // Updates being applied in m_update_pool
+        std::vector<int>    m_pending_layers;   // Layers of the pending updates
+        std::vector<double> m_update_time;      // Wall time of the latest update of each layer
+#endif
 
         // Check dimensions of layers
         void check_unit_sizes() const
@@ -64,37 +101,279 @@ class Network
             }
         }
 
+        // The instrumentation of the hot path below is removed at compile time
+        // if MDNN_NO_PROFILER is defined, including the calls to the tracer
+
+        // Whether spans are recorded in the tracer
+        bool tracing() const
+        {
+#ifdef MDNN_NO_PROFILER
+            return false;
+#else
+            return m_tracer->enabled();
+#endif
+        }
+
+        // Whether the hot path needs to be timed
+        bool timing() const
+        {
+#ifdef MDNN_NO_PROFILER
+            return false;
+#else
+            return m_profiler.enabled() || m_tracer->enabled();
+#endif
+        }
+
+        // Read the clock if the hot path needs to be timed
+        double timer_now() const
+        {
+#ifdef MDNN_NO_PROFILER
+            return 0.0;
+#else
+            return timing() ? internal::wall_time() : 0.0;
+#endif
+        }
+
+        // Start time and allocation counters at the beginning of a profiled call
+        struct TimerStart
+        {
+            double     time;
+            AllocStats alloc;
+        };
+
+        TimerStart timer_start() const
+        {
+            TimerStart start;
+#ifndef MDNN_NO_PROFILER
+            start.time = timer_now();
+
+            // Measure the peak working set of the call from now on
+            // The previous peak is restored in timer_stop(), so calls can be nested
+            if (m_profiler.enabled() && AllocTracker::installed())
+            {
+                start.alloc = AllocTracker::stats();
+                AllocTracker::reset_peak();
+            }
+#endif
+            return start;
+        }
+
+        // Record a call started at "start" in the profiler and the tracer
+        // layer is the index of the hidden layer, or -1 if the call is not associated with any hidden layer
+        void timer_stop(const TimerStart& start, int layer, Profiler::PHASE phase, int in_rows, int in_cols)
+        {
+#ifndef MDNN_NO_PROFILER
+            if (!timing())
+            {
+                return;
+            }
+
+            const double end = internal::wall_time();
+
+            if (m_profiler.enabled())
+            {
+                AllocStats alloc;
+
+                if (AllocTracker::installed())
+                {
+                    alloc = AllocTracker::stats();
+                    AllocTracker::restore_peak(start.alloc.peak);
+                }
+
+                LayerCost cost;
+
+                if (layer >= 0 && phase == Profiler::FORWARD)
+                {
+                    cost = m_layers[layer]->forward_cost(in_cols);
+                }
+                else if (layer >= 0 && phase == Profiler::BACKPROP)
+                {
+                    cost = m_layers[layer]->backprop_cost(in_cols);
+                }
+
+                m_profiler.record(layer, phase, end - start.time, in_rows, in_cols, cost.flops,
+                                  cost.bytes_read + cost.bytes_written,
+                                  alloc.count - start.alloc.count,
+                                  alloc.bytes - start.alloc.bytes,
+                                  alloc.peak - start.alloc.live);
+            }
+
+            trace(start.time, end, layer, phase, in_rows, in_cols);
+#endif
+        }
+
+        // Record a span in the tracer. Unlike the profiler, the tracer is thread-safe,
+        // so this function can be called from a background thread
+        void trace(double start, double end, int layer, Profiler::PHASE phase,
+                   int in_rows, int in_cols) const
+        {
+#ifndef MDNN_NO_PROFILER
+            if (!m_tracer->enabled())
+            {
+                return;
+            }
+
+            const std::string phase_name = Profiler::phase_name(phase);
+            Tracer::Arguments args;
+            args["rows"] = in_rows;
+            args["cols"] = in_cols;
+
+            if (layer < 0)
+            {
+                m_tracer->add_span(phase_name, phase_name, start, end, args);
+                return;
+            }
+
+            args["layer"] = layer;
+            const std::string name = m_layers[layer]->layer_type() + "[" +
+                                     internal::to_string(layer) + "] " + phase_name;
+            m_tracer->add_span(name, phase_name, start, end, args);
+#endif
+        }
+
+        // Stop the worker threads
+        void release_thread_pools()
+        {
+#ifdef MDNN_USE_THREADS
+            delete m_pool;
+            delete m_update_pool;
+#endif
+            m_pool = NULL;
+            m_update_pool = NULL;
+        }
+
         // Let each layer compute its output
-        void forward(const Matrix& input)
+        // If given, only the layers first, first + 1, ..., end - 1 are computed,
+        // and input is the input of layer first
+        void forward(const Matrix& input, int first = 0, int end = -1)
         {
-            const int nlayer = num_layers();
+            const int nlayer = (end < 0) ? num_layers() : end;
 
-            if (nlayer <= 0)
+            if (nlayer <= first)
             {
                 return;
             }
 
             // First layer
-            if (input.rows() != m_layers[0]->in_size())
+            if (input.rows() != m_layers[first]->in_size())
+            {
+                throw std::invalid_argument("[class Network]: Input data have incorrect dimension");
+            }
+
+            for (int i = first; i < nlayer; i++)
+            {
+                // The input of the first layer is the data, and the input of the
+                // following layers is the output of the previous layer
+                const Matrix& prev_layer_data = (i == first) ? input : m_layers[i - 1]->output();
+                const TimerStart start = timer_start();
+                m_layers[i]->forward(prev_layer_data);
+                timer_stop(start, i, Profiler::FORWARD, prev_layer_data.rows(),
+                            prev_layer_data.cols());
+            }
+        }
+
+        // Same as forward(), with an input that layer first reads in place
+        void forward_ref(const ConstRefMat& input, int first = 0)
+        {
+            if (input.rows() != m_layers[first]->in_size())
             {
                 throw std::invalid_argument("[class Network]: Input data have incorrect dimension");
             }
 
-            m_layers[0]->forward(input);
+            const TimerStart start = timer_start();
+            m_layers[first]->forward_ref(input);
+            timer_stop(start, first, Profiler::FORWARD, input.rows(), input.cols());
+            // The following layers read the output of the first one
+            this->forward(m_layers[first]->output(), first + 1);
+        }
 
-            // The following layers
-            for (int i = 1; i < nlayer; i++)
+        // Update the parameters of a layer after its gradients have been computed
+        // If the update thread exists, the update is applied there, and the
+        // function returns immediately. wait_updates() must then be called
+        void schedule_update(int layer, Optimizer& opt)
+        {
+            if (!m_layers[layer]->trainable())
             {
-                m_layers[i]->forward(m_layers[i - 1]->output());
+                return;
             }
+
+#ifdef MDNN_USE_THREADS
+
+            if (m_update_pool)
+            {
+                // The profiler is not thread-safe, so the time is recorded in wait_updates()
+                Optimizer* popt = &opt;
+                m_pending_layers.push_back(layer);
+                m_pending_updates.push_back(m_update_pool->submit([this, layer, popt]()
+                {
+                    const double start = timer_now();
+                    m_layers[layer]->update(*popt);
+                    const double end = timer_now();
+                    m_update_time[layer] = end - start;
+                    trace(start, end, layer, Profiler::UPDATE, 0, 0);
+                }));
+                return;
+            }
+
+#endif
+            const TimerStart start = timer_start();
+            m_layers[layer]->update(opt);
+            timer_stop(start, layer, Profiler::UPDATE, 0, 0);
+        }
+
+        // Wait for the updates applied in the update thread, and rethrow the
+        // exception of the first failed update, if any
+        void wait_updates()
+        {
+#ifdef MDNN_USE_THREADS
+            const int npending = m_pending_updates.size();
+
+            // All updates must finish before any exception is rethrown, since
+            // they refer to the optimizer
+            for (int k = 0; k < npending; k++)
+            {
+                m_pending_updates[k].wait();
+
+                if (m_profiler.enabled())
+                {
+                    const int layer = m_pending_layers[k];
+                    m_profiler.record(layer, Profiler::UPDATE, m_update_time[layer], 0, 0);
+                }
+            }
+
+            try
+            {
+                for (int k = 0; k < npending; k++)
+                {
+                    m_pending_updates[k].get();
+                }
+            }
+            catch (...)
+            {
+                m_pending_updates.clear();
+                m_pending_layers.clear();
+                throw;
+            }
+
+            m_pending_updates.clear();
+            m_pending_layers.clear();
+#endif
         }
 
         // Let each layer compute its gradients of the parameters
         // target has two versions: Matrix and RowVectorXi
         // The RowVectorXi version is used in classification problems where each
         // element is a class label
+        // If opt is not NULL, the parameters are also updated. With the update
+        // thread, each layer is updated as soon as its gradients are ready, from
+        // the last hidden layer to the first one, which does not affect the layers
+        // below since they only use its input gradients. Otherwise the layers are
+        // updated afterwards from the first one to the last one, see update()
+        // If first_layer is given, the layers below it are not computed, and
+        // input is the input of layer first_layer
         template <typename TargetType>
-        void backprop(const Matrix& input, const TargetType& target)
+        void backprop(const ConstRefMat& input, const TargetType& target, Optimizer* opt = NULL,
+                      int first_layer = 0)
         {
             const int nlayer = num_layers();
 
@@ -103,49 +382,365 @@ class Network
                 return;
             }
 
-            Layer* first_layer = m_layers[0];
             Layer* last_layer = m_layers[nlayer - 1];
             // Let output layer compute back-propagation data
             m_output->check_target_data(target);
+            const TimerStart start = timer_start();
             m_output->evaluate(last_layer->output(), target);
+            timer_stop(start, -1, Profiler::EVALUATE, last_layer->output().rows(),
+                        last_layer->output().cols());
 
-            // If there is only one hidden layer, "prev_layer_data" will be the input data
-            if (nlayer == 1)
+            // Back-propagation stops at the lowest trainable layer, since the
+            // layers below it need neither parameter gradients nor input gradients
+            int first = first_layer;
+
+            while (first < nlayer && !m_layers[first]->trainable())
             {
-                first_layer->backprop(input, m_output->backprop_data());
-                return;
+                first++;
             }
 
-            // Compute gradients for the last hidden layer
-            last_layer->backprop(m_layers[nlayer - 2]->output(), m_output->backprop_data());
+#ifdef MDNN_USE_THREADS
+            m_update_time.resize(nlayer);
+#endif
 
-            // Compute gradients for all the hidden layers except for the first one and the last one
-            for (int i = nlayer - 2; i > 0; i--)
+            try
             {
-                m_layers[i]->backprop(m_layers[i - 1]->output(),
-                                      m_layers[i + 1]->backprop_data());
+                // Compute gradients from the last hidden layer to the lowest trainable one
+                for (int i = nlayer - 1; i >= first; i--)
+                {
+                    // "prev_layer_data" of the first layer is the input data, and
+                    // "next_layer_data" of the last layer comes from the output layer
+                    const Matrix& next_layer_data = (i == nlayer - 1) ?
+                                                    m_output->backprop_data() :
+                                                    m_layers[i + 1]->backprop_data();
+                    // The gradient of the input units of the lowest trainable layer,
+                    // including the input data, is never used
+                    m_layers[i]->set_need_backprop_data(i > first);
+                    m_layers[i]->set_thread_pool(m_pool);
+                    const TimerStart start = timer_start();
+
+                    // The input data are read in place, as in forward_ref()
+                    if (i == first_layer)
+                    {
+                        m_layers[i]->backprop_ref(input, next_layer_data);
+                    }
+                    else
+                    {
+                        m_layers[i]->backprop(m_layers[i - 1]->output(), next_layer_data);
+                    }
+
+                    timer_stop(start, i, Profiler::BACKPROP, m_layers[i]->in_size(),
+                                next_layer_data.cols());
+
+                    if (opt && m_update_pool)
+                    {
+                        schedule_update(i, *opt);
+                    }
+                }
+            }
+            catch (...)
+            {
+                // Exceptions of the pending updates are superseded by this one
+                try
+                {
+                    wait_updates();
+                }
+                catch (...) {}
+
+                throw;
             }
 
-            // Compute gradients for the first layer
-            first_layer->backprop(input, m_layers[1]->backprop_data());
+            wait_updates();
+
+            if (opt && !m_update_pool)
+            {
+                this->update(*opt, first);
+            }
         }
 
-        // Update parameters
-        void update(Optimizer& opt)
+        // Update the parameters of the layers starting from first_layer, in the
+        // order of the layers
+        // The order matters for optimizers whose state advances on every call,
+        // such as the bias correction of Adam
+        void update(Optimizer& opt, int first_layer = 0)
         {
             const int nlayer = num_layers();
 
-            if (nlayer <= 0)
+            for (int i = first_layer; i < nlayer; i++)
             {
-                return;
+                schedule_update(i, opt);
             }
+        }
 
-            for (int i = 0; i < nlayer; i++)
+        // Run the epochs of fit() on the validated data, training the layers
+        // starting from first_layer, whose input is x
+        template <typename DerivedX, typename DerivedY>
+        void fit_batches(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+                         const Eigen::MatrixBase<DerivedY>& y,
+                         int batch_size, int epoch, int first_layer)
+        {
+            // We do not directly use PlainObjectX since it may be row-majored if x is passed as mat.transpose()
+            // We want to force XType and YType to be column-majored
+            typedef typename Eigen::MatrixBase<DerivedX>::PlainObject PlainObjectX;
+            typedef typename Eigen::MatrixBase<DerivedY>::PlainObject PlainObjectY;
+            typedef Eigen::Matrix<typename PlainObjectX::Scalar, PlainObjectX::RowsAtCompileTime, PlainObjectX::ColsAtCompileTime>
+            XType;
+            typedef Eigen::Matrix<typename PlainObjectY::Scalar, PlainObjectY::RowsAtCompileTime, PlainObjectY::ColsAtCompileTime>
+            YType;
+            const int nobs = x.cols();
+            const int nbatch = (nobs - 1) / batch_size + 1;
+            const int last_batch_size = nobs - (nbatch - 1) * batch_size;
+            // Observation IDs, shuffled at the beginning of each epoch
+            // Mini-batches are gathered from the original data according to the IDs,
+            // so the data are never copied as a whole
+            Eigen::VectorXi id = Eigen::VectorXi::LinSpaced(nobs, 0, nobs - 1);
+            // Two sets of mini-batch buffers that are reused across batches and epochs
+            // When prefetching is enabled, one is being trained while the other is filled
+            XType x_batch[2];
+            YType y_batch[2];
+            // Set up callback parameters
+            m_callback->m_nbatch = nbatch;
+            m_callback->m_nepoch = epoch;
+            int ntrained = 0;
+
+            // Iterations on the whole data set
+            for (int k = 0; k < epoch; k++)
             {
-                m_layers[i]->update(opt);
+                m_callback->m_epoch_id = k;
+                internal::shuffle(id.data(), nobs, m_rng);
+                const TimerStart start = timer_start();
+                internal::gather_batch(x, y, id.data(), (nbatch == 1) ? last_batch_size : batch_size,
+                                       x_batch[0], y_batch[0]);
+                timer_stop(start, -1, Profiler::GATHER, x_batch[0].rows(), x_batch[0].cols());
+
+                // Train on each mini-batch
+                for (int i = 0; i < nbatch; i++)
+                {
+                    const int cur = i % 2;
+                    const int next = 1 - cur;
+                    const int next_offset = (i + 1) * batch_size;
+                    const int next_size = (i + 1 == nbatch - 1) ? last_batch_size : batch_size;
+                    bool prefetched = false;
+#ifdef MDNN_USE_THREADS
+                    // Gather the next mini-batch in the prefetch thread
+                    // The profiler is not thread-safe, so the time is recorded after
+                    // the task finishes
+                    std::future<void> prefetcher;
+                    double prefetch_time = 0.0;
+
+                    if (m_prefetch_pool && i + 1 < nbatch)
+                    {
+                        prefetcher = m_prefetch_pool->submit([&]()
+                        {
+                            const double start = timer_now();
+                            internal::gather_batch(x, y, id.data() + next_offset, next_size,
+                                                   x_batch[next], y_batch[next]);
+                            const double end = timer_now();
+                            prefetch_time = end - start;
+                            trace(start, end, -1, Profiler::GATHER, x_batch[next].rows(),
+                                  x_batch[next].cols());
+                        });
+                        prefetched = true;
+                    }
+
+                    try
+                    {
+#endif
+                        const double start = timer_now();
+                        m_callback->m_batch_id = i;
+                        m_callback->pre_training_batch(this, x_batch[cur], y_batch[cur]);
+                        this->train_batch(opt, x_batch[cur], y_batch[cur], first_layer);
+                        m_callback->post_training_batch(this, x_batch[cur], y_batch[cur]);
+
+                        if (tracing())
+                        {
+                            Tracer::Arguments args;
+                            args["epoch"] = k;
+                            args["batch"] = i;
+                            args["cols"] = x_batch[cur].cols();
+                            m_tracer->add_span("batch", "batch", start, internal::wall_time(), args);
+                        }
+#ifdef MDNN_USE_THREADS
+                    }
+                    catch (...)
+                    {
+                        if (prefetched)
+                        {
+                            prefetcher.wait();
+                        }
+
+                        throw;
+                    }
+
+                    if (prefetched)
+                    {
+                        prefetcher.get();
+
+                        if (m_profiler.enabled())
+                        {
+                            m_profiler.record(-1, Profiler::GATHER, prefetch_time,
+                                              x_batch[next].rows(), x_batch[next].cols());
+                        }
+                    }
+
+#endif
+
+                    if (!prefetched && i + 1 < nbatch)
+                    {
+                        const TimerStart start = timer_start();
+                        internal::gather_batch(x, y, id.data() + next_offset, next_size,
+                                               x_batch[next], y_batch[next]);
+                        timer_stop(start, -1, Profiler::GATHER, x_batch[next].rows(),
+                                    x_batch[next].cols());
+                    }
+
+                    ntrained++;
+
+                    if (checkpoint_due(k, i, nbatch, ntrained))
+                    {
+                        checkpoint(k, i);
+                    }
+                }
+            }
+        }
+
+        // Whether a checkpoint is written after batch i of epoch k, where
+        // ntrained is the number of mini-batches trained so far in fit()
+        bool checkpoint_due(int k, int i, int nbatch, int ntrained) const
+        {
+            if (m_checkpointer == NULL)
+            {
+                return false;
             }
+
+            const bool epoch_due = (m_checkpoint_epochs > 0) && (i + 1 == nbatch) &&
+                                   ((k + 1) % m_checkpoint_epochs == 0);
+            const bool batch_due = (m_checkpoint_batches > 0) &&
+                                   (ntrained % m_checkpoint_batches == 0);
+            return epoch_due || batch_due;
         }
 
+        // Hand a snapshot of the parameters after batch i of epoch k to the
+        // checkpoint writer. The training thread only copies the parameters,
+        // and the file is written in the background.
+        void checkpoint(int k, int i)
+        {
+            const double start = timer_now();
+            const int nlayer = num_layers();
+            internal::Checkpointer::Snapshot& snapshot = m_checkpointer->begin();
+            snapshot.meta = this->get_meta_info();
+            snapshot.meta["CheckpointEpoch"] = k;
+            snapshot.meta["CheckpointBatch"] = i;
+            snapshot.params.resize(nlayer);
+            // The writer records the span of the write
+            snapshot.tracer = tracing() ? m_tracer : NULL;
+
+            // The parameters are copied to the vectors of an earlier snapshot
+            for (int j = 0; j < nlayer; j++)
+            {
+                m_layers[j]->copy_parameters(snapshot.params[j]);
+            }
+
+            if (tracing())
+            {
+                Tracer::Arguments args;
+                args["epoch"] = k;
+                args["batch"] = i;
+                m_tracer->add_span("checkpoint snapshot", "checkpoint", start, internal::wall_time(), args);
+            }
+
+            m_checkpointer->commit();
+        }
+
+        // Train the layers starting from first_layer on a mini-batch, whose
+        // predictors are the input of first_layer
+        template <typename TargetType>
+        void train_batch(Optimizer& opt, const ConstRefMat& x, const TargetType& y, int first_layer)
+        {
+            const TimerStart start = timer_start();
+            this->forward_ref(x, first_layer);
+            this->backprop(x, y, &opt, first_layer);
+            timer_stop(start, -1, Profiler::TRAIN_STEP, x.rows(), x.cols());
+        }
+
+        // Number of leading layers whose outputs are cached in fit(), i.e.,
+        // the layers that are frozen or have no parameters, as long as some
+        // layer after them is trainable
+        int cached_prefix() const
+        {
+            if (!m_feature_cache)
+            {
+                return 0;
+            }
+
+            const int nlayer = num_layers();
+            int n = 0;
+
+            while (n < nlayer && (!m_layers[n]->trainable() || m_layers[n]->num_parameters() == 0))
+            {
+                n++;
+            }
+
+            return (n < nlayer) ? n : 0;
+        }
+
+        // In deterministic mode, Eigen's own parallelization (OpenMP) is limited
+        // to one thread in the scope of this object, since its blocking of matrix
+        // products, and hence the order of the sums, depends on the thread count
+        // The limit is set by omp_set_num_threads(), which only applies to the
+        // calling thread, and the workers of the thread pools are always limited
+        // to one thread. Only if the thread count of Eigen was fixed globally by
+        // Eigen::setNbThreads() is the global value changed, see set_deterministic()
+        class DeterministicScope
+        {
+            private:
+                int m_omp_nthread;    // Previous OpenMP limit of this thread, or 0
+                int m_eigen_nthread;  // Previous global thread count of Eigen, or 0
+
+                DeterministicScope(const DeterministicScope&);
+                DeterministicScope& operator=(const DeterministicScope&);
+
+            public:
+                DeterministicScope(bool deterministic) :
+                    m_omp_nthread(0), m_eigen_nthread(0)
+                {
+#ifdef EIGEN_HAS_OPENMP
+
+                    if (!deterministic || Eigen::nbThreads() <= 1)
+                    {
+                        return;
+                    }
+
+                    m_omp_nthread = omp_get_max_threads();
+                    omp_set_num_threads(1);
+
+                    if (Eigen::nbThreads() > 1)
+                    {
+                        m_eigen_nthread = Eigen::nbThreads();
+                        Eigen::setNbThreads(1);
+                    }
+
+#endif
+                }
+
+                ~DeterministicScope()
+                {
+#ifdef EIGEN_HAS_OPENMP
+
+                    if (m_eigen_nthread > 0)
+                    {
+                        Eigen::setNbThreads(m_eigen_nthread);
+                    }
+
+                    if (m_omp_nthread > 0)
+                    {
+                        omp_set_num_threads(m_omp_nthread);
+                    }
+
+#endif
+                }
+        };
+
         // Get the meta information of the network, used to export the NN model
         MetaInfo get_meta_info() const
         {
@@ -171,7 +766,18 @@ class Network
             m_rng(m_default_rng),
             m_output(NULL),
             m_default_callback(),
-            m_callback(&m_default_callback)
+            m_callback(&m_default_callback),
+            m_prefetch(false),
+            m_feature_cache(false),
+            m_deterministic(false),
+            m_checkpointer(NULL),
+            m_checkpoint_epochs(0),
+            m_checkpoint_batches(0),
+            m_default_tracer(),
+            m_tracer(&m_default_tracer),
+            m_pool(NULL),
+            m_update_pool(NULL),
+            m_prefetch_pool(NULL)
         {}
 
         ///
@@ -185,7 +791,18 @@ class Network
             m_rng(rng),
             m_output(NULL),
             m_default_callback(),
-            m_callback(&m_default_callback)
+            m_callback(&m_default_callback),
+            m_prefetch(false),
+            m_feature_cache(false),
+            m_deterministic(false),
+            m_checkpointer(NULL),
+            m_checkpoint_epochs(0),
+            m_checkpoint_batches(0),
+            m_default_tracer(),
+            m_tracer(&m_default_tracer),
+            m_pool(NULL),
+            m_update_pool(NULL),
+            m_prefetch_pool(NULL)
         {}
 
         ///
@@ -204,6 +821,12 @@ class Network
             {
                 delete m_output;
             }
+
+            release_thread_pools();
+#ifdef MDNN_USE_THREADS
+            delete m_prefetch_pool;
+#endif
+            delete m_checkpointer;
         }
 
         ///
@@ -282,6 +905,229 @@ class Network
             m_callback = &m_default_callback;
         }
 
+        ///
+        /// Set whether mini-batches are prefetched during model fitting
+        ///
+        /// If enabled, the next mini-batch is gathered from the data set in a
+        /// background thread while the current one is being trained. The thread
+        /// is started here and kept until prefetching is disabled or the network
+        /// is destroyed. This requires C++11 support, and has no effect otherwise.
+        ///
+        /// \param prefetch Whether to enable prefetching. Default is `false`.
+        ///
+        void set_prefetch(bool prefetch)
+        {
+            m_prefetch = prefetch;
+#ifdef MDNN_USE_THREADS
+
+            if (prefetch && !m_prefetch_pool)
+            {
+                m_prefetch_pool = new internal::ThreadPool(1);
+            }
+            else if (!prefetch)
+            {
+                delete m_prefetch_pool;
+                m_prefetch_pool = NULL;
+            }
+
+#endif
+        }
+
+        ///
+        /// Set whether fit() caches the outputs of the frozen prefix of the network
+        ///
+        /// The frozen prefix consists of the leading layers that are frozen by
+        /// Layer::set_trainable() or that have no parameters, such as MaxPooling.
+        /// If enabled, fit() computes the outputs of the prefix over the whole
+        /// data set once, and then trains only the remaining layers on these
+        /// features in each epoch, which is typical when fine-tuning the top
+        /// layers of a trained network. Note that the callback then receives the
+        /// cached features instead of the original predictors.
+        ///
+        /// \param cache    Whether to cache the outputs. Default is `false`.
+        /// \param filename If not empty, the cached outputs are stored in a
+        ///                 memory-mapped file of this name instead of the heap,
+        ///                 which lets them exceed the physical memory. The file
+        ///                 is overwritten.
+        ///
+        void set_feature_cache(bool cache, const std::string& filename = "")
+        {
+            m_feature_cache = cache;
+            m_feature_cache_file = filename;
+        }
+
+        ///
+        /// Set the number of worker threads used in the backward pass
+        ///
+        /// With one or more threads, the optimizer update of each layer is applied
+        /// in a background thread as soon as its gradients are ready, while the
+        /// back-propagation of the layers below continues. With two or more threads,
+        /// the remaining threads also compute the parameter gradients of a layer
+        /// concurrently with its input gradients. This requires C++11 support, and
+        /// has no effect otherwise.
+        ///
+        /// Without worker threads, the layers are updated from the first one to
+        /// the last one after the backward pass. With worker threads, they are
+        /// updated in the reverse order, as their gradients become ready. Both
+        /// orders give the same results for optimizers without shared state, such
+        /// as SGD, but the results of optimizers whose state advances on every
+        /// update, such as the bias correction of Adam, differ slightly between
+        /// zero and one or more threads. The results are identical for any number
+        /// of threads from one on.
+        ///
+        /// \param nthread Number of worker threads. Default is 0, meaning that
+        ///                everything runs in the calling thread.
+        ///
+        void set_num_threads(int nthread)
+        {
+            release_thread_pools();
+#ifdef MDNN_USE_THREADS
+
+            if (nthread >= 1)
+            {
+                Eigen::initParallel();
+                m_update_pool = new internal::ThreadPool(1);
+            }
+
+            if (nthread >= 2)
+            {
+                m_pool = new internal::ThreadPool(nthread - 1);
+            }
+
+#endif
+        }
+
+        ///
+        /// Switch on or off the deterministic mode
+        ///
+        /// In deterministic mode, init() and fit() with the same seed give
+        /// bit-for-bit identical parameters regardless of the number of threads
+        /// that Eigen uses, and of set_num_threads() from one thread on, for
+        /// example for audits. See set_num_threads() for the update order without
+        /// worker threads.
+        /// Reductions such as the gradients of the bias and filter parameters and
+        /// the loss are always computed in a fixed order by a single thread. In
+        /// addition, this mode
+        ///
+        /// - limits Eigen's own parallelization (OpenMP) to one thread in fit() and
+        ///   train_step(), since Eigen's blocking of matrix products depends on its
+        ///   thread count. The limit is set with `omp_set_num_threads()`, which
+        ///   only applies to the calling thread, so other threads that use Eigen
+        ///   are not affected. However, if the thread count was fixed with
+        ///   `Eigen::setNbThreads()`, which is process-wide, it is set to 1 during
+        ///   training and restored afterwards. This changes the thread count of
+        ///   every other user of Eigen in the meantime, and is not safe if another
+        ///   thread calls `Eigen::setNbThreads()` or trains a network in
+        ///   deterministic mode at the same time, and
+        /// - initializes the `i`-th hidden layer from stream `i` of a Philox
+        ///   generator seeded by init(), so that the parameters of each layer do not
+        ///   depend on the other layers, and layers can be initialized in parallel.
+        ///   The network's %RNG is still used to shuffle the data in fit().
+        ///
+        /// \param deterministic Whether to enable the deterministic mode. Default is `false`.
+        ///
+        void set_deterministic(bool deterministic)
+        {
+            m_deterministic = deterministic;
+        }
+
+        ///
+        /// Write checkpoints of the model periodically in fit()
+        ///
+        /// A checkpoint is a model file in the format of export_net(const std::string&),
+        /// and can be loaded with read_net(const std::string&). Its meta information
+        /// also contains the keys `CheckpointEpoch` and `CheckpointBatch`, the
+        /// zero-based indices of the last trained epoch and mini-batch. The state
+        /// of the optimizer is not saved.
+        ///
+        /// Training only pauses to copy the parameters. The file is written in a
+        /// background thread when `MDNN_USE_THREADS` is defined, and otherwise
+        /// in the calling thread. It is first written to a temporary file with the
+        /// suffix `.tmp`, which is flushed to disk and then renamed, so the
+        /// checkpoint file is always complete, even if the process is killed or
+        /// the system loses power during writing. If the writer
+        /// falls behind, intermediate checkpoints are skipped. fit() waits for
+        /// the last checkpoint before it returns, and throws if a write failed.
+        ///
+        /// \param filename     The path of the checkpoint file. An empty string
+        ///                     disables checkpointing.
+        /// \param every_nepoch Write a checkpoint after every `every_nepoch` epochs,
+        ///                     or never if it is zero. Default is 1.
+        /// \param every_nbatch Write a checkpoint after every `every_nbatch` mini-batches,
+        ///                     counted from the start of fit(), or never if it is
+        ///                     zero. Default is 0.
+        ///
+        void set_checkpoint(const std::string& filename, int every_nepoch = 1, int every_nbatch = 0)
+        {
+            if (every_nepoch < 0 || every_nbatch < 0)
+            {
+                throw std::invalid_argument("[class Network]: Checkpoint intervals must be non-negative");
+            }
+
+            if (m_checkpointer == NULL || m_checkpointer->filename() != filename)
+            {
+                delete m_checkpointer;
+                m_checkpointer = filename.empty() ? NULL : new internal::Checkpointer(filename);
+            }
+
+            m_checkpoint_epochs = every_nepoch;
+            m_checkpoint_batches = every_nbatch;
+        }
+
+        ///
+        /// Switch on or off the profiler at runtime
+        ///
+        /// When enabled, the network records the wall time, number of calls,
+        /// and input dimensions of the forward pass, back-propagation and
+        /// parameter update of each hidden layer, the evaluation of the output
+        /// layer, and the gathering of mini-batches. See the Profiler class and
+        /// the ProfilerCallback class.
+        ///
+        /// \param enabled Whether to enable the profiler. Default is `false`.
+        ///
+        void set_profiling(bool enabled)
+        {
+            m_profiler.set_enabled(enabled);
+        }
+
+        ///
+        /// Get the profiler that contains the aggregated timing information
+        ///
+        const Profiler& get_profiler() const
+        {
+            return m_profiler;
+        }
+
+        ///
+        /// Get the profiler that contains the aggregated timing information,
+        /// for example to reset the records
+        ///
+        Profiler& get_profiler()
+        {
+            return m_profiler;
+        }
+
+        ///
+        /// Set the tracer that records the timeline of model fitting and prediction
+        ///
+        /// No spans are recorded if the macro `MDNN_NO_PROFILER` is defined.
+        ///
+        /// \param tracer A user-provided tracer object that inherits from the
+        ///               default Tracer class, for example ChromeTracer.
+        ///
+        void set_tracer(Tracer& tracer)
+        {
+            m_tracer = &tracer;
+        }
+
+        ///
+        /// Set the default tracer that records nothing
+        ///
+        void set_default_tracer()
+        {
+            m_tracer = &m_default_tracer;
+        }
+
         ///
         /// Initialize layer parameters in the network using normal distribution
         ///
@@ -302,9 +1148,76 @@ class Network
 
             const int nlayer = num_layers();
 
+            if (!m_deterministic)
+            {
+                for (int i = 0; i < nlayer; i++)
+                {
+                    m_layers[i]->init(mu, sigma, m_rng);
+                }
+
+                return;
+            }
+
+            // In deterministic mode each layer has its own stream, so the layers
+            // can be initialized in any order, or concurrently
+            const unsigned long base_seed = (seed > 0) ? seed :
+                                            (unsigned long)(m_rng.rand() * 2147483647.0);
+#ifdef MDNN_USE_THREADS
+
+            if (m_pool)
+            {
+                std::vector< std::future<void> > tasks;
+
+                for (int i = 0; i < nlayer; i++)
+                {
+                    Layer* layer = m_layers[i];
+                    tasks.push_back(m_pool->submit([layer, mu, sigma, base_seed, i]()
+                    {
+                        Philox rng(base_seed, i);
+                        layer->init(mu, sigma, rng);
+                    }));
+                }
+
+                for (int i = 0; i < nlayer; i++)
+                {
+                    tasks[i].wait();
+                }
+
+                for (int i = 0; i < nlayer; i++)
+                {
+                    tasks[i].get();
+                }
+
+                return;
+            }
+
+#endif
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                Philox rng(base_seed, i);
+                m_layers[i]->init(mu, sigma, rng);
+            }
+        }
+
+        ///
+        /// Store the parameters of all hidden layers in a compact format to save
+        /// memory for inference, see Layer::set_storage_precision()
+        ///
+        /// FullyConnected and Convolutional layers keep their weights and filters
+        /// in 16 bits and convert them block by block during the forward pass.
+        /// Training converts the parameters of the updated layers back to Scalar.
+        ///
+        /// \param precision FP16_PRECISION or BF16_PRECISION, or SCALAR_PRECISION to
+        ///                  restore full precision.
+        ///
+        void set_storage_precision(PRECISION precision)
+        {
+            const int nlayer = num_layers();
+
             for (int i = 0; i < nlayer; i++)
             {
-                m_layers[i]->init(mu, sigma, m_rng);
+                m_layers[i]->set_storage_precision(precision);
             }
         }
 
@@ -385,10 +1298,11 @@ class Network
             {
                 // Randomly select a layer
                 const int layer_id = int(m_rng.rand() * nlayer);
-                // Randomly pick a parameter, note that some layers may have no parameters
+                // Randomly pick a parameter, note that some layers may have no parameters,
+                // and the gradients of frozen layers are not computed
                 const int nparam = deriv[layer_id].size();
 
-                if (nparam < 1)
+                if (nparam < 1 || !m_layers[layer_id]->trainable())
                 {
                     continue;
                 }
@@ -420,6 +1334,10 @@ class Network
         ///
         /// Fit the model based on the given data
         ///
+        /// The observations are reshuffled at the beginning of each epoch, and
+        /// each mini-batch is gathered from `x` and `y` into a reused buffer.
+        /// See also set_prefetch() and set_feature_cache().
+        ///
         /// \param opt        An object that inherits from the Optimizer class, indicating the optimization algorithm to use.
         /// \param x          The predictors. Each column is an observation.
         /// \param y          The response variable. Each column is an observation.
@@ -433,14 +1351,6 @@ class Network
                  const Eigen::MatrixBase<DerivedY>& y,
                  int batch_size, int epoch, int seed = -1)
         {
-            // We do not directly use PlainObjectX since it may be row-majored if x is passed as mat.transpose()
-            // We want to force XType and YType to be column-majored
-            typedef typename Eigen::MatrixBase<DerivedX>::PlainObject PlainObjectX;
-            typedef typename Eigen::MatrixBase<DerivedY>::PlainObject PlainObjectY;
-            typedef Eigen::Matrix<typename PlainObjectX::Scalar, PlainObjectX::RowsAtCompileTime, PlainObjectX::ColsAtCompileTime>
-            XType;
-            typedef Eigen::Matrix<typename PlainObjectY::Scalar, PlainObjectY::RowsAtCompileTime, PlainObjectY::ColsAtCompileTime>
-            YType;
             const int nlayer = num_layers();
 
             if (nlayer <= 0)
@@ -451,37 +1361,105 @@ class Network
             // Reset optimizer
             opt.reset();
 
-            // Create shuffled mini-batches
+            // Set the random seed used to shuffle the data
             if (seed > 0)
             {
                 m_rng.seed(seed);
             }
 
-            std::vector<XType> x_batches;
-            std::vector<YType> y_batches;
-            const int nbatch = internal::create_shuffled_batches(x, y, batch_size, m_rng,
-                               x_batches, y_batches);
-            // Set up callback parameters
-            m_callback->m_nbatch = nbatch;
-            m_callback->m_nepoch = epoch;
+            const int nobs = x.cols();
 
-            // Iterations on the whole data set
-            for (int k = 0; k < epoch; k++)
+            if (y.cols() != nobs)
             {
-                m_callback->m_epoch_id = k;
+                throw std::invalid_argument("[class Network]: Input X and Y have different number of observations");
+            }
 
-                // Train on each mini-batch
-                for (int i = 0; i < nbatch; i++)
+            // Compute batch size
+            if (batch_size > nobs)
+            {
+                batch_size = nobs;
+            }
+
+            const DeterministicScope scope(m_deterministic);
+
+            // Outputs of the frozen prefix of the network, computed once
+            const int ncached = cached_prefix();
+
+            if (ncached > 0)
+            {
+                Matrix features_mem;
+                internal::MappedFile features_file;
+                const int nfeature = m_layers[ncached - 1]->out_size();
+                Scalar* features_data;
+
+                if (m_feature_cache_file.empty())
+                {
+                    features_mem.resize(nfeature, nobs);
+                    features_data = features_mem.data();
+                }
+                else
                 {
-                    m_callback->m_batch_id = i;
-                    m_callback->pre_training_batch(this, x_batches[i], y_batches[i]);
-                    this->forward(x_batches[i]);
-                    this->backprop(x_batches[i], y_batches[i]);
-                    this->update(opt);
-                    m_callback->post_training_batch(this, x_batches[i], y_batches[i]);
+                    features_file.create(m_feature_cache_file,
+                                         std::size_t(nfeature) * nobs * sizeof(Scalar));
+                    features_data = static_cast<Scalar*>(features_file.data());
                 }
+
+                Eigen::Map<Matrix> features(features_data, nfeature, nobs);
+                Matrix chunk;
+
+                for (int j = 0; j < nobs; j += batch_size)
+                {
+                    const int size = std::min(batch_size, nobs - j);
+                    chunk = x.middleCols(j, size);
+                    this->forward(chunk, 0, ncached);
+                    features.middleCols(j, size) = m_layers[ncached - 1]->output();
+                }
+
+                fit_batches(opt, features, y, batch_size, epoch, ncached);
+            }
+            else
+            {
+                fit_batches(opt, x, y, batch_size, epoch, 0);
+            }
+
+            // Wait for the last checkpoint, and report a failed write
+            if (m_checkpointer)
+            {
+                m_checkpointer->flush();
+            }
+
+            return true;
+        }
+
+        ///
+        /// Train the model on a single mini-batch
+        ///
+        /// Unlike fit(), this function does not reset the optimizer and does not
+        /// shuffle or copy the data, so it can be called repeatedly to update the
+        /// model incrementally as new observations arrive, for example in online
+        /// learning. The optimizer keeps its historical information across calls,
+        /// until Optimizer::reset() is called explicitly or fit() is called.
+        ///
+        /// \param opt An object that inherits from the Optimizer class, indicating the optimization algorithm to use.
+        /// \param x   The predictors of the mini-batch. Each column is an observation.
+        ///            As in predict(), a Matrix, a block of columns or an
+        ///            `Eigen::Map` over a buffer of the caller is read in place.
+        /// \param y   The response variable of the mini-batch. Each column is an observation.
+        ///            It can also be an integer vector of class labels for
+        ///            classification problems.
+        ///
+        template <typename TargetType>
+        bool train_step(Optimizer& opt, const ConstRefMat& x, const TargetType& y)
+        {
+            const int nlayer = num_layers();
+
+            if (nlayer <= 0)
+            {
+                return false;
             }
 
+            const DeterministicScope scope(m_deterministic);
+            this->train_batch(opt, x, y, 0);
             return true;
         }
 
@@ -499,10 +1477,141 @@ class Network
                 return Matrix();
             }
 
+            const TimerStart start = timer_start();
             this->forward(x);
+            timer_stop(start, -1, Profiler::PREDICT, x.rows(), x.cols());
             return m_layers[nlayer - 1]->output();
         }
 
+        ///
+        /// Use the fitted model to make predictions, without copying the input
+        /// and without allocating the result
+        ///
+        /// The input is read in place if its columns are stored with a constant
+        /// stride, as in a Matrix, a block of columns or rows of a matrix, or a Map
+        /// over a buffer of the caller, for example
+        ///
+        /// \code
+        /// Eigen::Map<const Matrix> x(request_data, in_size, nobs);
+        /// Eigen::Map<Matrix> y(response_data, out_size, nobs);
+        /// net.predict(x, y);
+        /// \endcode
+        ///
+        /// Other inputs, such as row-major matrices, are converted to a temporary
+        /// column-major matrix. Convolutional and max-pooling layers read their
+        /// input as a contiguous array, so if one of them is the first layer, an
+        /// input with more than one column needs an outer stride equal to its
+        /// number of rows to be used in place. The output of the last layer is
+        /// copied to `y`.
+        ///
+        /// \param x The predictors. Each column is an observation.
+        /// \param y The buffer that receives the predictions. It must have as many
+        ///          rows as the output of the last layer, and as many columns as `x`.
+        ///
+        void predict(const ConstRefMat& x, RefMat y)
+        {
+            const int nlayer = num_layers();
+
+            if (nlayer <= 0)
+            {
+                return;
+            }
+
+            if (y.rows() != m_layers[nlayer - 1]->out_size() || y.cols() != x.cols())
+            {
+                throw std::invalid_argument("[class Network]: Output buffer has incorrect dimension");
+            }
+
+            const TimerStart start = timer_start();
+            this->forward_ref(x);
+            timer_stop(start, -1, Profiler::PREDICT, x.rows(), x.cols());
+            y = m_layers[nlayer - 1]->output();
+        }
+
+        ///
+        /// Use the fitted model to make predictions on observations stored in a
+        /// buffer of the caller, and write the results to another buffer
+        ///
+        /// \param x        Pointer to the predictors of the first observation.
+        ///                 Each observation consists of `in_size` consecutive
+        ///                 values, where `in_size` is the input size of the first layer.
+        /// \param x_stride Distance between the first values of two consecutive
+        ///                 observations in `x`, at least `in_size`.
+        /// \param nobs     Number of observations.
+        /// \param y        Pointer to the buffer that receives the predictions,
+        ///                 with `out_size` consecutive values per observation,
+        ///                 where `out_size` is the output size of the last layer.
+        /// \param y_stride Distance between the first values of two consecutive
+        ///                 observations in `y`, at least `out_size`.
+        ///
+        void predict(const Scalar* x, int x_stride, int nobs, Scalar* y, int y_stride)
+        {
+            typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<> > ConstStridedMapMat;
+            typedef Eigen::Map<Matrix, 0, Eigen::OuterStride<> > StridedMapMat;
+            const int nlayer = num_layers();
+
+            if (nlayer <= 0)
+            {
+                return;
+            }
+
+            const int in_size = m_layers[0]->in_size();
+            const int out_size = m_layers[nlayer - 1]->out_size();
+
+            if (x_stride < in_size || y_stride < out_size || nobs < 0)
+            {
+                throw std::invalid_argument("[class Network]: Invalid buffer dimensions");
+            }
+
+            this->predict(ConstStridedMapMat(x, in_size, nobs, Eigen::OuterStride<>(x_stride)),
+                          StridedMapMat(y, out_size, nobs, Eigen::OuterStride<>(y_stride)));
+        }
+
+        ///
+        /// Use the fitted model to make predictions, processing the observations
+        /// in chunks
+        ///
+        /// Each chunk of `x` is evaluated before the next one is copied, so `x`
+        /// can be any Eigen expression, such as a view of a memory-mapped data
+        /// set (see NpyArray) or a lazy `.cast<Scalar>()` of it, without creating
+        /// a full copy of it. The intermediate results of the layers are also
+        /// bounded by the chunk size.
+        ///
+        /// \param x          The predictors. Each column is an observation.
+        /// \param batch_size Number of observations evaluated at a time.
+        ///
+        template <typename Derived>
+        Matrix predict(const Eigen::MatrixBase<Derived>& x, int batch_size)
+        {
+            const int nlayer = num_layers();
+
+            if (nlayer <= 0)
+            {
+                return Matrix();
+            }
+
+            if (batch_size <= 0)
+            {
+                throw std::invalid_argument("[class Network]: Batch size must be positive");
+            }
+
+            const int nobs = x.cols();
+            Matrix res(m_layers[nlayer - 1]->out_size(), nobs);
+            Matrix chunk;
+
+            for (int j = 0; j < nobs; j += batch_size)
+            {
+                const int size = std::min(batch_size, nobs - j);
+                chunk = x.middleCols(j, size);
+                const TimerStart start = timer_start();
+                this->forward(chunk);
+                timer_stop(start, -1, Profiler::PREDICT, chunk.rows(), chunk.cols());
+                res.middleCols(j, size) = m_layers[nlayer - 1]->output();
+            }
+
+            return res;
+        }
+
         ///
         /// Export the network to files.
         ///
@@ -543,6 +1652,118 @@ class Network
             this->set_parameters(params);
             this->set_output(internal::create_output(map));
         }
+
+        ///
+        /// Export the network to a single binary file.
+        ///
+        /// The file contains a versioned header, the meta information of the
+        /// network, a table of layers, and the parameters of each layer aligned
+        /// to 64 bytes, so that read_net(const std::string&) can use them in place.
+        /// See Utils/ModelFile.h for the layout. The file can only be read on
+        /// machines with the same byte order, and, with the default precision,
+        /// the same Scalar type.
+        ///
+        /// With FP16_PRECISION or BF16_PRECISION, the parameters are rounded to
+        /// 16 bits, which makes the file four times smaller than with double as
+        /// Scalar. Layers that support compact storage, see set_storage_precision(),
+        /// keep using the 16-bit values in place after read_net(const std::string&).
+        /// FP16_PRECISION is more accurate for parameters of moderate magnitude, and
+        /// BF16_PRECISION has the same range as float.
+        ///
+        /// \param filename  The path of the file.
+        /// \param precision The format in which the parameters are stored. Default
+        ///                  is SCALAR_PRECISION, which keeps them exact.
+        ///
+        void export_net(const std::string& filename, PRECISION precision = SCALAR_PRECISION) const
+        {
+            internal::write_model_file(filename, this->get_meta_info(), this->get_parameters(),
+                                       precision);
+        }
+
+        ///
+        /// Read in a network from a single file written by export_net(const std::string&).
+        ///
+        /// The file is mapped into memory instead of being read, and the layers
+        /// use their parameters in place, so loading takes constant time regardless
+        /// of the model size, and processes that load the same file share its
+        /// pages in the page cache. A layer copies its parameters to its own
+        /// memory before they are changed, for example by training. The file must
+        /// not be modified while the network uses it, so a new model should be
+        /// written to a new file and then renamed.
+        ///
+        /// \param filename The path of the file.
+        ///
+        void read_net(const std::string& filename)
+        {
+            MetaInfo map;
+            std::vector<const void*> params;
+            std::vector<int> sizes;
+            PRECISION precision;
+            internal::MappedFile file;
+            internal::map_model_file(filename, file, map, params, sizes, precision);
+            const int nlayer = params.size();
+
+            if (map.find("Nlayers") == map.end() || map.find("Nlayers")->second != nlayer)
+            {
+                throw std::invalid_argument("[class Network]: Model file is inconsistent");
+            }
+
+            // Keep the new mapping, and release the previous one
+            m_model_file.swap(file);
+            m_layers.clear();
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                this->add_layer(internal::create_layer(map, i));
+
+                if (precision == SCALAR_PRECISION)
+                {
+                    m_layers[i]->map_parameters(static_cast<const Scalar*>(params[i]), sizes[i]);
+                }
+                else
+                {
+                    m_layers[i]->map_compact_parameters(static_cast<const uint16_t*>(params[i]),
+                                                        sizes[i], precision);
+                }
+            }
+
+            this->set_output(internal::create_output(map));
+        }
+
+        ///
+        /// Export the network as a self-contained C++ header for inference.
+        ///
+        /// The header defines `name::predict(x, y)`, which computes the same result
+        /// as predict() for one observation stored in `x`, and writes it to `y`, and
+        /// `name::predict(x, y, n)` for `n` observations stored one after another,
+        /// i.e., as the columns of a matrix. The parameters are aligned constant
+        /// arrays read through Eigen maps, fully connected layers are a single
+        /// matrix-vector product, and convolutional layers are matrix products of
+        /// blocks of input patches and the filters. The generated code only depends
+        /// on Eigen, makes no virtual calls, and keeps the intermediate results on
+        /// the stack. It uses the current Scalar type, so it agrees with predict()
+        /// up to rounding.
+        ///
+        /// This is meant for deploying a trained model to a latency-sensitive
+        /// application. Since the parameters are compiled into the program, the
+        /// header is practical for networks of up to a few million parameters.
+        ///
+        /// \param filename The path of the header file.
+        /// \param name     The namespace of the generated code, which must be a
+        ///                 valid C++ identifier.
+        ///
+        void export_cpp(const std::string& filename, const std::string& name = "mdnn_model") const
+        {
+            std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::trunc);
+            if (ofs.fail())
+                throw std::runtime_error("Error while opening file");
+
+            internal::write_cpp_model(ofs, this->get_meta_info(), this->get_parameters(), name);
+
+            ofs.close();
+            if (ofs.fail())
+                throw std::runtime_error("Error while writing file");
+        }
 };
 
 
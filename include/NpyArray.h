@@ -0,0 +1,235 @@
+#ifndef NPYARRAY_H_
+#define NPYARRAY_H_
+
+#include <Eigen/Core>
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+#include "Config.h"
+#include "Utils/MappedFile.h"
+#include "Utils/Npy.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \defgroup Data Data Sources
+///
+
+///
+/// \ingroup Data
+///
+/// A one- or two-dimensional NumPy array in a `.npy` file, or in a member of
+/// an `.npz` archive, that is memory-mapped instead of being read
+///
+/// A two-dimensional array of shape `(n, p)` is viewed as a `p x n` matrix, so
+/// that each of its `n` rows is an observation, which is the usual layout of
+/// data sets in NumPy. A one-dimensional array of length `n`, such as a vector
+/// of class labels, is viewed as a `1 x n` matrix. The views returned by
+/// matrix() and row_vector() read the mapped file in place, using strides for
+/// two-dimensional arrays, so arrays in C and Fortran order are both used
+/// without copying or transposing them. They can be passed to Network::fit(),
+/// which gathers each mini-batch directly from the file, and to the chunked
+/// Network::predict(), for example
+///
+/// \code
+/// NpyArray x("x.npy"), y("y.npz", "labels");
+/// net.fit(opt, x.matrix<float>().cast<Scalar>(), y.row_vector<int>(), 64, 10);
+/// Matrix pred = net.predict(x.matrix<float>().cast<Scalar>(), 1024);
+/// \endcode
+///
+/// Only the pages that are used are read from disk, and the operating system
+/// can evict them under memory pressure, so the data set may exceed the
+/// physical memory. The object must outlive the views.
+///
+/// Members of `.npz` archives must be stored without compression, which is
+/// the default of `numpy.savez()`. Compressed members, written by
+/// `numpy.savez_compressed()`, are not supported.
+///
+class NpyArray
+{
+    public:
+        typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> Stride;
+
+        ///
+        /// View of the data as a matrix of element type `T`
+        ///
+        template <typename T>
+        struct MatrixView
+        {
+            typedef Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>,
+                               Eigen::Unaligned, Stride> Type;
+        };
+
+        ///
+        /// View of the data as a row vector of element type `T`
+        ///
+        template <typename T>
+        struct RowVectorView
+        {
+            typedef Eigen::Map<const Eigen::Matrix<T, 1, Eigen::Dynamic>, Eigen::Unaligned> Type;
+        };
+
+    private:
+        internal::MappedFile m_file;
+        internal::NpyHeader  m_header;
+        const char*          m_data;  // Start of the array data in the mapping
+
+        NpyArray(const NpyArray&);
+        NpyArray& operator=(const NpyArray&);
+
+        // Parse the NPY data starting at offset in the mapping
+        void init(std::size_t offset)
+        {
+            const char* data = static_cast<const char*>(m_file.data());
+            internal::parse_npy_header(data + offset, m_file.size() - offset, m_header);
+
+            if (m_header.shape.size() < 1 || m_header.shape.size() > 2)
+                throw std::invalid_argument("[class NpyArray]: Only 1-D and 2-D arrays are supported");
+            if (m_header.shape[0] > 0x7FFFFFFFu ||
+                    (m_header.shape.size() == 2 && m_header.shape[1] > 0x7FFFFFFFu))
+                throw std::invalid_argument("[class NpyArray]: Array is too large");
+
+            m_data = data + offset + m_header.data_offset;
+        }
+
+        // Whether the elements are of type T
+        template <typename T>
+        bool is_type() const
+        {
+            const char type = (T(-1) > T(0)) ? 'u' : (T(0.5) != T(0) ? 'f' : 'i');
+            return m_header.type == type && m_header.word_size == int(sizeof(T));
+        }
+
+    public:
+        ///
+        /// Map a `.npy` file
+        ///
+        /// \param filename The path of the file.
+        ///
+        explicit NpyArray(const std::string& filename) :
+            m_data(NULL)
+        {
+            m_file.open(filename);
+            init(0);
+        }
+
+        ///
+        /// Map a member of an `.npz` archive
+        ///
+        /// \param filename The path of the archive.
+        /// \param name     The name of the array, which is the keyword argument
+        ///                 of `numpy.savez()`, or `arr_0`, `arr_1`, ... for
+        ///                 positional arguments.
+        ///
+        NpyArray(const std::string& filename, const std::string& name) :
+            m_data(NULL)
+        {
+            m_file.open(filename);
+            int method;
+            const std::size_t offset = internal::find_zip_member(
+                static_cast<const char*>(m_file.data()), m_file.size(), name + ".npy", method);
+
+            if (method != 0)
+                throw std::invalid_argument("[class NpyArray]: Compressed NPZ members are not supported");
+
+            init(offset);
+        }
+
+        ///
+        /// Number of variables of each observation, i.e., `p` for an array of
+        /// shape `(n, p)`, and 1 for a one-dimensional array
+        ///
+        int rows() const
+        {
+            return (m_header.shape.size() == 2) ? int(m_header.shape[1]) : 1;
+        }
+
+        ///
+        /// Number of observations, i.e., the length of the first dimension
+        ///
+        int cols() const
+        {
+            return int(m_header.shape[0]);
+        }
+
+        ///
+        /// Whether the array is stored in Fortran (column-major) order
+        ///
+        bool fortran_order() const
+        {
+            return m_header.fortran_order;
+        }
+
+        ///
+        /// The NumPy kind of the element type: `'f'` for floating-point numbers,
+        /// `'i'` for signed and `'u'` for unsigned integers, and `'b'` for booleans
+        ///
+        char type() const
+        {
+            return m_header.type;
+        }
+
+        ///
+        /// Size of each element in bytes
+        ///
+        int word_size() const
+        {
+            return m_header.word_size;
+        }
+
+        ///
+        /// View the array as a `rows() x cols()` matrix without copying it
+        ///
+        /// The response variable of regression problems and the predictors
+        /// are typically viewed in this way.
+        ///
+        /// The element type `T` must match the type of the array, for example
+        /// `float` for `float32`, and `int` for `int32`. Use `.cast<Scalar>()` on the
+        /// view to convert the elements lazily, when they are gathered.
+        ///
+        template <typename T>
+        typename MatrixView<T>::Type matrix() const
+        {
+            if (!is_type<T>())
+                throw std::invalid_argument("[class NpyArray]: Element type does not match the array");
+
+            const T* data = reinterpret_cast<const T*>(m_data);
+            const int nrow = rows(), ncol = cols();
+
+            // Element (i, j), the i-th variable of the j-th observation, is at
+            // j * p + i in C order, and at i * n + j in Fortran order
+            if (m_header.fortran_order && m_header.shape.size() == 2)
+            {
+                return typename MatrixView<T>::Type(data, nrow, ncol, Stride(1, ncol));
+            }
+
+            return typename MatrixView<T>::Type(data, nrow, ncol, Stride(nrow, 1));
+        }
+
+        ///
+        /// View an array with one variable, i.e., `rows() == 1`, as a row vector
+        /// without copying it
+        ///
+        /// This is typically used for the class labels of classification problems,
+        /// whose type in Network::fit() is a row vector of `int`. Labels of other
+        /// integer types can be converted lazily with `.cast<int>()`.
+        ///
+        template <typename T>
+        typename RowVectorView<T>::Type row_vector() const
+        {
+            if (!is_type<T>())
+                throw std::invalid_argument("[class NpyArray]: Element type does not match the array");
+            if (rows() != 1)
+                throw std::invalid_argument("[class NpyArray]: Array has more than one variable");
+
+            return typename RowVectorView<T>::Type(reinterpret_cast<const T*>(m_data), cols());
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* NPYARRAY_H_ */
@@ -0,0 +1,234 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <vector>
+#include "Config.h"
+#include "Utils/Timer.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \defgroup Profiling Profiling Tools
+///
+
+///
+/// \ingroup Profiling
+///
+/// Aggregated timing information of one phase of a layer, for example the
+/// forward pass of the second hidden layer.
+///
+struct ProfileRecord
+{
+    long   ncall;   // Number of calls
+    double time;    // Total wall time of the calls, in seconds
+    int    in_rows; // Number of rows of the input in the most recent call
+    int    in_cols; // Number of columns of the input in the most recent call,
+                    // typically the number of observations
+    double flops;   // Total number of floating-point operations of the calls, see LayerCost
+    double bytes;   // Total number of bytes read and written by the calls, see LayerCost
+    long   allocs;      // Total number of heap allocations of the calls, see AllocTracker
+    double alloc_bytes; // Total number of bytes allocated by the calls
+    double peak_bytes;  // Maximum over the calls of the peak working set allocated during a call
+
+    ProfileRecord() :
+        ncall(0), time(0.0), in_rows(0), in_cols(0), flops(0.0), bytes(0.0),
+        allocs(0), alloc_bytes(0.0), peak_bytes(0.0)
+    {}
+
+    ///
+    /// Achieved computing throughput in GFLOP/s
+    ///
+    double gflops() const
+    {
+        return (time > 0.0) ? (flops / time * 1e-9) : 0.0;
+    }
+
+    ///
+    /// Achieved memory bandwidth in GB/s
+    ///
+    double gbytes() const
+    {
+        return (time > 0.0) ? (bytes / time * 1e-9) : 0.0;
+    }
+};
+
+///
+/// \ingroup Profiling
+///
+/// A simple profiler that accumulates the wall time spent in the hot path of
+/// the network, including the forward pass, back-propagation and parameter
+/// update of each hidden layer, the evaluation of the output layer, the
+/// gathering of mini-batches during model fitting, and each training step and
+/// prediction as a whole.
+///
+/// For the forward pass and back-propagation, the analytical costs reported by
+/// Layer::forward_cost() and Layer::backprop_cost() are also accumulated, so
+/// that the achieved GFLOP/s and GB/s of each layer can be compared with the
+/// roofline of the hardware. If the allocation hooks of AllocTracker are
+/// installed, the heap allocations of each call are accumulated as well.
+///
+/// The profiler is owned by the Network class, and it is disabled by default.
+/// It can be switched on at runtime by Network::set_profiling(), and the
+/// results can be retrieved by Network::get_profiler(). Defining the macro
+/// `MDNN_NO_PROFILER` removes the instrumentation at compile time, including
+/// the clock reads and the calls to the tracer (see Network::set_tracer()), so
+/// that the hot path contains no profiling code at all.
+///
+class Profiler
+{
+    public:
+        ///
+        /// The phases that are profiled
+        ///
+        enum PHASE
+        {
+            FORWARD = 0, // Layer::forward()
+            BACKPROP,    // Layer::backprop()
+            UPDATE,      // Layer::update()
+            EVALUATE,    // Output::evaluate(), not associated with any hidden layer
+            GATHER,      // Gathering mini-batches, not associated with any hidden layer
+            TRAIN_STEP,  // Network::train_step() on one mini-batch, not associated with any hidden layer
+            PREDICT,     // Network::predict(), not associated with any hidden layer
+            NPHASE
+        };
+
+    private:
+        bool                       m_enabled;
+        std::vector<ProfileRecord> m_layer_records; // Records of hidden layers, m_layer_records[layer * NPHASE + phase]
+        ProfileRecord              m_net_records[NPHASE]; // Records not associated with any hidden layer
+
+    public:
+        Profiler() :
+            m_enabled(false)
+        {}
+
+        ///
+        /// Whether the profiler is enabled. Always returns `false` if the macro
+        /// `MDNN_NO_PROFILER` is defined.
+        ///
+        bool enabled() const
+        {
+#ifdef MDNN_NO_PROFILER
+            return false;
+#else
+            return m_enabled;
+#endif
+        }
+
+        ///
+        /// Switch on or off the profiler
+        ///
+        void set_enabled(bool enabled)
+        {
+            m_enabled = enabled;
+        }
+
+        ///
+        /// Clear all the records
+        ///
+        void reset()
+        {
+            m_layer_records.clear();
+
+            for (int i = 0; i < NPHASE; i++)
+            {
+                m_net_records[i] = ProfileRecord();
+            }
+        }
+
+        ///
+        /// Add the timing information of one call
+        ///
+        /// \param layer   Index of the hidden layer, or -1 if the call is not
+        ///                associated with any hidden layer.
+        /// \param phase   The phase of the call.
+        /// \param elapsed Wall time of the call, in seconds.
+        /// \param in_rows Number of rows of the input data.
+        /// \param in_cols Number of columns of the input data.
+        /// \param flops   Analytical number of floating-point operations of the call.
+        /// \param bytes   Analytical number of bytes read and written by the call.
+        /// \param allocs  Number of heap allocations of the call.
+        /// \param alloc_bytes Number of bytes allocated by the call.
+        /// \param peak_bytes  Peak working set allocated during the call, in bytes.
+        ///
+        void record(int layer, PHASE phase, double elapsed, int in_rows, int in_cols,
+                    double flops = 0.0, double bytes = 0.0,
+                    long allocs = 0, double alloc_bytes = 0.0, double peak_bytes = 0.0)
+        {
+            ProfileRecord* rec;
+
+            if (layer < 0)
+            {
+                rec = &m_net_records[phase];
+            }
+            else
+            {
+                const std::size_t id = std::size_t(layer) * NPHASE + phase;
+
+                if (id >= m_layer_records.size())
+                {
+                    m_layer_records.resize((layer + 1) * NPHASE);
+                }
+
+                rec = &m_layer_records[id];
+            }
+
+            rec->ncall++;
+            rec->time += elapsed;
+            rec->in_rows = in_rows;
+            rec->in_cols = in_cols;
+            rec->flops += flops;
+            rec->bytes += bytes;
+            rec->allocs += allocs;
+            rec->alloc_bytes += alloc_bytes;
+
+            if (peak_bytes > rec->peak_bytes)
+            {
+                rec->peak_bytes = peak_bytes;
+            }
+        }
+
+        ///
+        /// Number of hidden layers that have records
+        ///
+        int num_layers() const
+        {
+            return m_layer_records.size() / NPHASE;
+        }
+
+        ///
+        /// Get the record of a phase
+        ///
+        /// \param layer Index of the hidden layer, or -1 for the phases that are
+        ///              not associated with any hidden layer.
+        /// \param phase The phase to query.
+        ///
+        ProfileRecord get_record(int layer, PHASE phase) const
+        {
+            if (layer < 0)
+            {
+                return m_net_records[phase];
+            }
+
+            const std::size_t id = std::size_t(layer) * NPHASE + phase;
+            return (id < m_layer_records.size()) ? m_layer_records[id] : ProfileRecord();
+        }
+
+        ///
+        /// Name of a phase
+        ///
+        static const char* phase_name(PHASE phase)
+        {
+            static const char* names[NPHASE] = { "forward", "backprop", "update", "evaluate", "gather",
+                                                   "train_step", "predict" };
+            return names[phase];
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* PROFILER_H_ */
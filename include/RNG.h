@@ -1,6 +1,9 @@
 #ifndef RNG_H_
 #define RNG_H_
 
+#include <cmath>     // std::sqrt, std::log, std::cos, std::sin
+#include <algorithm> // std::min
+
 namespace MiniDNN
 {
 
@@ -11,6 +14,9 @@ namespace MiniDNN
 /// This default implementation is based on the public domain code by Ray Gardner
 /// <http://stjarnhimlen.se/snippets/rg_rand.c>.
 ///
+/// Derived classes need to implement seed() and rand(), and can override
+/// fill_uniform() to generate many numbers at a time more efficiently.
+///
 class RNG
 {
     private:
@@ -60,6 +66,62 @@ class RNG
             m_rand = next_long_rand(m_rand);
             return Scalar(m_rand) / Scalar(m_max);
         }
+
+        ///
+        /// Fill an array with uniform random numbers, which are the same
+        /// as the results of calling rand() `n` times.
+        ///
+        /// \param arr Pointer to the array.
+        /// \param n   Length of the array.
+        ///
+        virtual void fill_uniform(Scalar* arr, const int n)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                arr[i] = rand();
+            }
+        }
+
+        ///
+        /// Fill an array with \f$N(\mu, \sigma^2)\f$ random numbers.
+        ///
+        /// \param arr   Pointer to the array.
+        /// \param n     Length of the array.
+        /// \param mu    Mean of the normal distribution.
+        /// \param sigma Standard deviation of the normal distribution.
+        ///
+        virtual void fill_normal(Scalar* arr, const int n,
+                                 const Scalar& mu = Scalar(0),
+                                 const Scalar& sigma = Scalar(1))
+        {
+            // For simplicity we use Box-Muller transform to generate normal random variates
+            // Each pair of uniform random numbers gives two normal random numbers,
+            // and the uniform random numbers are generated in chunks
+            const double two_pi = 6.283185307179586476925286766559;
+            const int chunk = 128;
+            const int npair = (n + 1) / 2;
+            Scalar u[2 * chunk];
+
+            for (int start = 0; start < npair; start += chunk)
+            {
+                const int m = std::min(chunk, npair - start);
+                fill_uniform(u, 2 * m);
+
+                for (int k = 0; k < m; k++)
+                {
+                    const double t1 = sigma * std::sqrt(-2 * std::log(u[2 * k]));
+                    const double t2 = two_pi * u[2 * k + 1];
+                    const int i = 2 * (start + k);
+                    arr[i] = t1 * std::cos(t2) + mu;
+
+                    // The second number is dropped if n is odd
+                    if (i + 1 < n)
+                    {
+                        arr[i + 1] = t1 * std::sin(t2) + mu;
+                    }
+                }
+            }
+        }
 };
 
 
@@ -0,0 +1,184 @@
+#ifndef RNG_PHILOX_H_
+#define RNG_PHILOX_H_
+
+#include <stdint.h>
+#include "../Config.h"
+#include "../RNG.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// A counter-based random number generator using the Philox4x32-10 algorithm
+/// of Salmon et al. (2011), "Parallel random numbers: as easy as 1, 2, 3".
+///
+/// The i-th number of a stream is a function of the seed, the stream ID, and
+/// i only. Hence the generator can jump to any position in constant time
+/// (see discard()), and an array can be filled in parts, possibly by copies
+/// of the generator in different threads, with the same results as filling
+/// it at once. Different streams of the same seed are independent.
+///
+/// fill_uniform() computes several counters at a time in a form that the
+/// compiler can vectorize.
+///
+class Philox: public RNG
+{
+    private:
+        // Number of counters computed at a time in fill_uniform()
+        static const int Lanes = 8;
+
+        uint32_t m_key[2];     // Key, given by the seed
+        uint32_t m_stream[2];  // Upper half of the counter, given by the stream ID
+        uint64_t m_pos;        // Position in the stream, i.e., the number of 32-bit
+                               // outputs that have been consumed
+        uint64_t m_cached;            // First counter of the block stored in m_buffer
+        uint32_t m_buffer[4][Lanes];  // Outputs of the last block of counters used by rand()
+
+        // Compute the outputs of the counters start, start + 1, ..., start + Lanes - 1,
+        // and store the k-th output of counter (start + j) in out[k][j]
+        void generate(uint64_t start, uint32_t out[4][Lanes]) const
+        {
+            const uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+            const uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+            uint32_t* x0 = out[0];
+            uint32_t* x1 = out[1];
+            uint32_t* x2 = out[2];
+            uint32_t* x3 = out[3];
+
+            for (int j = 0; j < Lanes; j++)
+            {
+                const uint64_t ctr = start + j;
+                x0[j] = uint32_t(ctr);
+                x1[j] = uint32_t(ctr >> 32);
+                x2[j] = m_stream[0];
+                x3[j] = m_stream[1];
+            }
+
+            uint32_t k0 = m_key[0], k1 = m_key[1];
+
+            for (int round = 0; round < 10; round++)
+            {
+                for (int j = 0; j < Lanes; j++)
+                {
+                    const uint64_t p0 = uint64_t(M0) * x0[j];
+                    const uint64_t p1 = uint64_t(M1) * x2[j];
+                    const uint32_t y0 = uint32_t(p1 >> 32) ^ x1[j] ^ k0;
+                    const uint32_t y2 = uint32_t(p0 >> 32) ^ x3[j] ^ k1;
+                    x1[j] = uint32_t(p1);
+                    x3[j] = uint32_t(p0);
+                    x0[j] = y0;
+                    x2[j] = y2;
+                }
+
+                k0 += W0;
+                k1 += W1;
+            }
+        }
+
+        // Map a 32-bit integer to (0, 1)
+        static Scalar to_uniform(uint32_t x)
+        {
+            return Scalar((double(x) + 0.5) * 2.3283064365386962890625e-10);
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param init_seed The random seed.
+        /// \param stream    ID of the stream. Generators with the same seed and
+        ///                  different stream IDs give independent sequences.
+        ///
+        Philox(unsigned long init_seed, unsigned long stream = 0) :
+            RNG(init_seed)
+        {
+            const uint64_t id = stream;
+            m_stream[0] = uint32_t(id);
+            m_stream[1] = uint32_t(id >> 32);
+            seed(init_seed);
+        }
+
+        void seed(unsigned long seed)
+        {
+            const uint64_t key = seed;
+            m_key[0] = uint32_t(key);
+            m_key[1] = uint32_t(key >> 32);
+            m_pos = 0;
+            m_cached = 0;
+            generate(m_cached, m_buffer);
+        }
+
+        ///
+        /// Skip the next `n` random numbers of the stream
+        ///
+        void discard(uint64_t n)
+        {
+            m_pos += n;
+        }
+
+        ///
+        /// The number of random numbers that have been generated since the last seeding
+        ///
+        uint64_t position() const
+        {
+            return m_pos;
+        }
+
+        Scalar rand()
+        {
+            // Compute the block of counters that contains the current position
+            const uint64_t ctr = m_pos / 4;
+            const uint64_t start = ctr - ctr % Lanes;
+
+            if (start != m_cached)
+            {
+                generate(start, m_buffer);
+                m_cached = start;
+            }
+
+            const uint32_t x = m_buffer[m_pos % 4][ctr - start];
+            m_pos++;
+            return to_uniform(x);
+        }
+
+        void fill_uniform(Scalar* arr, const int n)
+        {
+            const int block = 4 * Lanes;
+            int i = 0;
+
+            // Use rand() until the position is aligned with a block of counters
+            for (; i < n && m_pos % block != 0; i++)
+            {
+                arr[i] = rand();
+            }
+
+            // Whole blocks
+            uint32_t out[4][Lanes];
+
+            for (; i + block <= n; i += block, m_pos += block)
+            {
+                generate(m_pos / 4, out);
+
+                for (int j = 0; j < Lanes; j++)
+                {
+                    for (int k = 0; k < 4; k++)
+                    {
+                        arr[i + 4 * j + k] = to_uniform(out[k][j]);
+                    }
+                }
+            }
+
+            // Remaining numbers
+            for (; i < n; i++)
+            {
+                arr[i] = rand();
+            }
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* RNG_PHILOX_H_ */
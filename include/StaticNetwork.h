@@ -0,0 +1,494 @@
+#ifndef STATICNETWORK_H_
+#define STATICNETWORK_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "Config.h"
+#include "RNG.h"
+#include "Output.h"
+#include "Optimizer.h"
+#include "Utils/Random.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Placeholder for the unused layer slots of StaticNetwork
+struct StaticNoLayer {};
+
+// The hidden layers of a StaticNetwork, stored as the first layer followed by
+// the remaining ones, so that all calls between layers are resolved at
+// compile time
+template <typename L1, typename L2, typename L3, typename L4,
+          typename L5, typename L6, typename L7, typename L8>
+class StaticLayers
+{
+    private:
+        typedef StaticLayers<L2, L3, L4, L5, L6, L7, L8, StaticNoLayer> Rest;
+
+        // Fails to compile if the output size of L1 is not the input size of L2
+        typedef char unit_sizes_must_match[(L1::out_size == Rest::in_size) ? 1 : -1];
+
+        L1   m_layer;
+        Rest m_rest;
+
+    public:
+        static const int in_size = L1::in_size;
+        static const int out_size = Rest::out_size;
+        static const int num_layers = Rest::num_layers + 1;
+
+        typedef typename L1::InputVector    InputVector;
+        typedef typename Rest::OutputVector OutputVector;
+        typedef typename L1::InputMatrix    InputMatrix;
+        typedef typename Rest::OutputMatrix OutputMatrix;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+        {
+            m_layer.init(mu, sigma, rng);
+            m_rest.init(mu, sigma, rng);
+        }
+
+        OutputVector predict(const InputVector& x) const
+        {
+            return m_rest.predict(m_layer.predict(x));
+        }
+
+        void forward(const InputMatrix& input)
+        {
+            m_layer.forward(input);
+            m_rest.forward(m_layer.output());
+        }
+
+        const OutputMatrix& output() const
+        {
+            return m_rest.output();
+        }
+
+        // Compute the gradients from the last layer to this one. As in Network,
+        // the parameters of each layer are updated right after its gradients
+        // are computed if opt is not NULL
+        void backprop(const InputMatrix& input, const OutputMatrix& next_layer_data,
+                      Optimizer* opt, bool need_backprop_data)
+        {
+            m_rest.backprop(m_layer.output(), next_layer_data, opt, true);
+            m_layer.backprop(input, m_rest.backprop_data(), need_backprop_data);
+
+            if (opt)
+            {
+                m_layer.update(*opt);
+            }
+        }
+
+        const InputMatrix& backprop_data() const
+        {
+            return m_layer.backprop_data();
+        }
+
+        void get_parameters(std::vector< std::vector<Scalar> >& params) const
+        {
+            params.push_back(m_layer.get_parameters());
+            m_rest.get_parameters(params);
+        }
+
+        void set_parameters(const std::vector< std::vector<Scalar> >& params, int index)
+        {
+            m_layer.set_parameters(params[index]);
+            m_rest.set_parameters(params, index + 1);
+        }
+
+        void get_derivatives(std::vector< std::vector<Scalar> >& dparams) const
+        {
+            dparams.push_back(m_layer.get_derivatives());
+            m_rest.get_derivatives(dparams);
+        }
+};
+
+// The last hidden layer
+template <typename L1>
+class StaticLayers<L1, StaticNoLayer, StaticNoLayer, StaticNoLayer,
+                   StaticNoLayer, StaticNoLayer, StaticNoLayer, StaticNoLayer>
+{
+    private:
+        L1 m_layer;
+
+    public:
+        static const int in_size = L1::in_size;
+        static const int out_size = L1::out_size;
+        static const int num_layers = 1;
+
+        typedef typename L1::InputVector  InputVector;
+        typedef typename L1::OutputVector OutputVector;
+        typedef typename L1::InputMatrix  InputMatrix;
+        typedef typename L1::OutputMatrix OutputMatrix;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+        {
+            m_layer.init(mu, sigma, rng);
+        }
+
+        OutputVector predict(const InputVector& x) const
+        {
+            return m_layer.predict(x);
+        }
+
+        void forward(const InputMatrix& input)
+        {
+            m_layer.forward(input);
+        }
+
+        const OutputMatrix& output() const
+        {
+            return m_layer.output();
+        }
+
+        void backprop(const InputMatrix& input, const OutputMatrix& next_layer_data,
+                      Optimizer* opt, bool need_backprop_data)
+        {
+            m_layer.backprop(input, next_layer_data, need_backprop_data);
+
+            if (opt)
+            {
+                m_layer.update(*opt);
+            }
+        }
+
+        const InputMatrix& backprop_data() const
+        {
+            return m_layer.backprop_data();
+        }
+
+        void get_parameters(std::vector< std::vector<Scalar> >& params) const
+        {
+            params.push_back(m_layer.get_parameters());
+        }
+
+        void set_parameters(const std::vector< std::vector<Scalar> >& params, int index)
+        {
+            m_layer.set_parameters(params[index]);
+        }
+
+        void get_derivatives(std::vector< std::vector<Scalar> >& dparams) const
+        {
+            dparams.push_back(m_layer.get_derivatives());
+        }
+};
+
+
+} // namespace internal
+
+
+///
+/// \ingroup Network
+///
+/// A neural network whose hidden layers and their dimensions are fixed at
+/// compile time, for small models that are evaluated many times
+///
+/// The hidden layers are given as template arguments, currently up to eight
+/// FullyConnectedStatic layers, for example
+///
+/// \code
+/// StaticNetwork< FullyConnectedStatic<16, 32, ReLU>,
+///                FullyConnectedStatic<32, 32, ReLU>,
+///                FullyConnectedStatic<32, 1, Identity> > net;
+/// net.set_output(new RegressionMSE());
+/// net.init(0, 0.1, 123);
+/// net.fit(opt, x, y, 64, 10);
+/// StaticNetwork<...>::OutputVector y1 = net.predict(x1);
+/// \endcode
+///
+/// Since the layers are not accessed through the virtual interface of Layer,
+/// and all dimensions are known to the compiler, predict() on a single
+/// observation of type InputVector is fully inlined, uses fixed-size matrix
+/// products, and allocates no memory. This removes most of the overhead that
+/// dominates Network::predict() for models with a few thousand parameters.
+/// Mini-batches, whose sizes are only known at run time, are used in fit()
+/// and in predict() on a matrix.
+///
+/// The network computes the same function as a Network with the corresponding
+/// FullyConnected layers, and the parameters returned by get_parameters() can
+/// be passed to Network::set_parameters(), and vice versa. For example, a model
+/// can be trained and exported with Network, and evaluated with StaticNetwork.
+/// Given the same seed, init() and fit() also draw the same random numbers as
+/// in Network.
+///
+template <typename L1,
+          typename L2 = internal::StaticNoLayer, typename L3 = internal::StaticNoLayer,
+          typename L4 = internal::StaticNoLayer, typename L5 = internal::StaticNoLayer,
+          typename L6 = internal::StaticNoLayer, typename L7 = internal::StaticNoLayer,
+          typename L8 = internal::StaticNoLayer>
+class StaticNetwork
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef internal::StaticLayers<L1, L2, L3, L4, L5, L6, L7, L8> Layers;
+
+    public:
+        static const int in_size = Layers::in_size;
+        static const int out_size = Layers::out_size;
+        static const int num_layers = Layers::num_layers;
+
+        typedef typename Layers::InputVector  InputVector;  ///< A single observation
+        typedef typename Layers::OutputVector OutputVector; ///< Output of a single observation
+        typedef typename Layers::InputMatrix  InputMatrix;  ///< Observations in columns
+        typedef typename Layers::OutputMatrix OutputMatrix; ///< Outputs of observations in columns
+
+    private:
+        Layers  m_layers;
+        RNG     m_default_rng;  // Built-in RNG
+        RNG&    m_rng;          // Reference to the RNG provided by the user,
+                                // otherwise reference to m_default_rng
+        Output* m_output;       // The output layer
+        Matrix  m_last_output;  // Output of the last hidden layer, as taken by Output
+        OutputMatrix m_output_grad; // Derivative of the output of the last hidden layer
+
+        StaticNetwork(const StaticNetwork&);
+        StaticNetwork& operator=(const StaticNetwork&);
+
+        // Train the layers on a mini-batch
+        template <typename TargetType>
+        void train_batch(Optimizer& opt, const InputMatrix& x, const TargetType& y)
+        {
+            m_layers.forward(x);
+            m_output->check_target_data(y);
+            m_last_output = m_layers.output();
+            m_output->evaluate(m_last_output, y);
+            m_output_grad = m_output->backprop_data();
+            // The gradient of the input data is never used
+            m_layers.backprop(x, m_output_grad, &opt, false);
+        }
+
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        ///
+        /// Default constructor
+        ///
+        StaticNetwork() :
+            m_default_rng(1),
+            m_rng(m_default_rng),
+            m_output(NULL)
+        {}
+
+        ///
+        /// Constructor with a user-provided random number generator
+        ///
+        /// \param rng A user-provided random number generator object that inherits
+        ///            from the default RNG class.
+        ///
+        StaticNetwork(RNG& rng) :
+            m_default_rng(1),
+            m_rng(rng),
+            m_output(NULL)
+        {}
+
+        ///
+        /// Destructor that frees the output layer
+        ///
+        ~StaticNetwork()
+        {
+            delete m_output;
+        }
+
+        ///
+        /// Set the output layer of the neural network
+        ///
+        /// \param output A pointer to an Output object, such as RegressionMSE.
+        ///               **NOTE**: the pointer will be handled and freed by the
+        ///               network object, so do not delete it manually.
+        ///
+        void set_output(Output* output)
+        {
+            delete m_output;
+            m_output = output;
+        }
+
+        ///
+        /// Get the output layer
+        ///
+        const Output* get_output() const
+        {
+            return m_output;
+        }
+
+        ///
+        /// Initialize layer parameters in the network using normal distribution
+        ///
+        /// \param mu    Mean of the normal distribution.
+        /// \param sigma Standard deviation of the normal distribution.
+        /// \param seed  Set the random seed of the %RNG if `seed > 0`, otherwise
+        ///              use the current random state.
+        ///
+        void init(const Scalar& mu = Scalar(0), const Scalar& sigma = Scalar(0.01),
+                  int seed = -1)
+        {
+            if (seed > 0)
+            {
+                m_rng.seed(seed);
+            }
+
+            m_layers.init(mu, sigma, m_rng);
+        }
+
+        ///
+        /// Get the serialized layer parameters, in the same format as
+        /// Network::get_parameters()
+        ///
+        std::vector< std::vector<Scalar> > get_parameters() const
+        {
+            std::vector< std::vector<Scalar> > res;
+            res.reserve(num_layers);
+            m_layers.get_parameters(res);
+            return res;
+        }
+
+        ///
+        /// Set the layer parameters, for example from Network::get_parameters()
+        ///
+        /// \param param Serialized layer parameters
+        ///
+        void set_parameters(const std::vector< std::vector<Scalar> >& param)
+        {
+            if (static_cast<int>(param.size()) != num_layers)
+            {
+                throw std::invalid_argument("[class StaticNetwork]: Parameter size does not match");
+            }
+
+            m_layers.set_parameters(param, 0);
+        }
+
+        ///
+        /// Get the serialized derivatives of layer parameters
+        ///
+        std::vector< std::vector<Scalar> > get_derivatives() const
+        {
+            std::vector< std::vector<Scalar> > res;
+            res.reserve(num_layers);
+            m_layers.get_derivatives(res);
+            return res;
+        }
+
+        ///
+        /// Fit the model based on the given data
+        ///
+        /// The observations are reshuffled at the beginning of each epoch, as in
+        /// Network::fit().
+        ///
+        /// \param opt        An object that inherits from the Optimizer class, indicating the optimization algorithm to use.
+        /// \param x          The predictors. Each column is an observation.
+        /// \param y          The response variable. Each column is an observation.
+        /// \param batch_size Mini-batch size.
+        /// \param epoch      Number of epochs of training.
+        /// \param seed       Set the random seed of the %RNG if `seed > 0`, otherwise
+        ///                   use the current random state.
+        ///
+        template <typename DerivedX, typename DerivedY>
+        bool fit(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+                 const Eigen::MatrixBase<DerivedY>& y,
+                 int batch_size, int epoch, int seed = -1)
+        {
+            typedef typename Eigen::MatrixBase<DerivedY>::PlainObject PlainObjectY;
+            typedef Eigen::Matrix<typename PlainObjectY::Scalar, PlainObjectY::RowsAtCompileTime, PlainObjectY::ColsAtCompileTime>
+            YType;
+
+            if (!m_output)
+            {
+                throw std::invalid_argument("[class StaticNetwork]: Output layer is not set");
+            }
+
+            if (x.rows() != in_size)
+            {
+                throw std::invalid_argument("[class StaticNetwork]: Input data have incorrect dimension");
+            }
+
+            // Reset optimizer
+            opt.reset();
+
+            // Set the random seed used to shuffle the data
+            if (seed > 0)
+            {
+                m_rng.seed(seed);
+            }
+
+            const int nobs = x.cols();
+
+            if (y.cols() != nobs)
+            {
+                throw std::invalid_argument("[class StaticNetwork]: Input X and Y have different number of observations");
+            }
+
+            if (nobs < 1)
+            {
+                return false;
+            }
+
+            batch_size = std::min(batch_size, nobs);
+            const int nbatch = (nobs - 1) / batch_size + 1;
+            Eigen::VectorXi id = Eigen::VectorXi::LinSpaced(nobs, 0, nobs - 1);
+            InputMatrix x_batch;
+            YType y_batch;
+
+            for (int k = 0; k < epoch; k++)
+            {
+                internal::shuffle(id.data(), nobs, m_rng);
+
+                for (int i = 0; i < nbatch; i++)
+                {
+                    const int offset = i * batch_size;
+                    internal::gather_batch(x, y, id.data() + offset,
+                                           std::min(batch_size, nobs - offset), x_batch, y_batch);
+                    train_batch(opt, x_batch, y_batch);
+                }
+            }
+
+            return true;
+        }
+
+        ///
+        /// Compute the output of a single observation, without any heap allocation
+        ///
+        /// \param x The predictors of one observation.
+        ///
+        OutputVector predict(const InputVector& x) const
+        {
+            return m_layers.predict(x);
+        }
+
+        // Non-const overload, so that the call on a non-const network is not
+        // ambiguous with the template below
+        OutputVector predict(const InputVector& x)
+        {
+            return m_layers.predict(x);
+        }
+
+        ///
+        /// Compute the outputs of a number of observations
+        ///
+        /// \param x The predictors. Each column is an observation.
+        ///
+        template <typename Derived>
+        OutputMatrix predict(const Eigen::MatrixBase<Derived>& x)
+        {
+            if (x.rows() != in_size)
+            {
+                throw std::invalid_argument("[class StaticNetwork]: Input data have incorrect dimension");
+            }
+
+            m_layers.forward(x);
+            return m_layers.output();
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* STATICNETWORK_H_ */
@@ -0,0 +1,62 @@
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include <string>
+#include <map>
+#include "Config.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \defgroup Tracers Timeline Tracers
+///
+
+///
+/// \ingroup Tracers
+///
+/// The interface and default implementation of the tracer that records a
+/// timeline of the spans in model fitting and prediction, for example the
+/// training of each mini-batch, and the forward pass and back-propagation of
+/// each layer.
+///
+/// This default implementation is disabled and records nothing, so that the
+/// network does not need to time the hot path. See the ChromeTracer class for
+/// an implementation that exports the timeline in the Chrome trace event format.
+///
+class Tracer
+{
+    public:
+        typedef std::map<std::string, int> Arguments;
+
+        virtual ~Tracer() {}
+
+        ///
+        /// Whether the tracer records spans. If it returns `false`, the network
+        /// will not call add_span().
+        ///
+        virtual bool enabled() const
+        {
+            return false;
+        }
+
+        ///
+        /// Record a span. This function may be called from different threads.
+        ///
+        /// \param name     Name of the span, e.g. "FullyConnected[1] forward".
+        /// \param category Category of the span, e.g. "forward".
+        /// \param start    Start time in seconds, as returned by internal::wall_time().
+        /// \param end      End time in seconds, as returned by internal::wall_time().
+        /// \param args     Additional information of the span, such as the layer
+        ///                 index and the input dimensions.
+        ///
+        virtual void add_span(const std::string& name, const std::string& category,
+                              double start, double end, const Arguments& args) {}
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* TRACER_H_ */
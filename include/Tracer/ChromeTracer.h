@@ -0,0 +1,194 @@
+#ifndef TRACER_CHROMETRACER_H_
+#define TRACER_CHROMETRACER_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Tracer.h"
+#include "../Utils/Timer.h"
+#ifdef MDNN_USE_THREADS
+    #include <thread>
+    #include <mutex>
+    #include <atomic>
+#endif
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Tracers
+///
+/// Tracer that exports the timeline in the Chrome trace event format, which
+/// can be viewed in `chrome://tracing` or <https://ui.perfetto.dev>. Each span
+/// is tagged with the thread that executes it.
+///
+/// Typical usage:
+///
+/// \code
+/// ChromeTracer tracer;
+/// net.set_tracer(tracer);
+/// net.fit(opt, x, y, 100, 10);
+/// tracer.write("trace.json");
+/// \endcode
+///
+class ChromeTracer: public Tracer
+{
+    private:
+        struct Event
+        {
+            std::string name;
+            std::string category;
+            double      start;  // In microseconds, relative to m_origin
+            double      dur;    // In microseconds
+            int         tid;
+            Arguments   args;
+        };
+
+#ifdef MDNN_USE_THREADS
+        std::atomic<bool>  m_enabled; // Read by the update and prefetch threads of the network
+#else
+        bool               m_enabled;
+#endif
+        const double       m_origin; // Time when the tracer is created
+        std::vector<Event> m_events;
+#ifdef MDNN_USE_THREADS
+        mutable std::mutex             m_mutex;
+        std::map<std::thread::id, int> m_threads; // Map thread IDs to small integers
+#endif
+
+        // Escape a string in JSON
+        static std::string escape(const std::string& str)
+        {
+            std::string res;
+            res.reserve(str.size());
+
+            for (std::size_t i = 0; i < str.size(); i++)
+            {
+                if (str[i] == '"' || str[i] == '\\')
+                {
+                    res.push_back('\\');
+                }
+
+                res.push_back(str[i]);
+            }
+
+            return res;
+        }
+
+    public:
+        ChromeTracer() :
+            m_enabled(true), m_origin(internal::wall_time())
+        {}
+
+        bool enabled() const
+        {
+            return m_enabled;
+        }
+
+        ///
+        /// Pause or resume recording. This may be called while the network is
+        /// being trained in another thread.
+        ///
+        void set_enabled(bool enabled)
+        {
+            m_enabled = enabled;
+        }
+
+        void add_span(const std::string& name, const std::string& category,
+                      double start, double end, const Arguments& args)
+        {
+            Event event;
+            event.name = name;
+            event.category = category;
+            event.start = (start - m_origin) * 1e6;
+            event.dur = (end - start) * 1e6;
+            event.args = args;
+#ifdef MDNN_USE_THREADS
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // Thread 0 is the first thread that records a span, typically the main thread
+            std::map<std::thread::id, int>::iterator it = m_threads.find(std::this_thread::get_id());
+
+            if (it == m_threads.end())
+            {
+                it = m_threads.insert(std::make_pair(std::this_thread::get_id(),
+                                                     int(m_threads.size()))).first;
+            }
+
+            event.tid = it->second;
+#else
+            event.tid = 0;
+#endif
+            m_events.push_back(event);
+        }
+
+        ///
+        /// Number of recorded spans
+        ///
+        int num_events() const
+        {
+#ifdef MDNN_USE_THREADS
+            std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+            return m_events.size();
+        }
+
+        ///
+        /// Remove all recorded spans
+        ///
+        void clear()
+        {
+#ifdef MDNN_USE_THREADS
+            std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+            m_events.clear();
+        }
+
+        ///
+        /// Write the recorded spans to a JSON file
+        ///
+        /// \param filename The filename of the output.
+        ///
+        void write(const std::string& filename) const
+        {
+            std::ofstream ofs(filename.c_str(), std::ios::out);
+            if (ofs.fail())
+                throw std::runtime_error("Error while opening file");
+
+#ifdef MDNN_USE_THREADS
+            std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+            ofs.precision(15);
+            ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+            for (std::size_t i = 0; i < m_events.size(); i++)
+            {
+                const Event& event = m_events[i];
+                ofs << (i == 0 ? "\n" : ",\n")
+                    << "{\"name\":\"" << escape(event.name) << "\""
+                    << ",\"cat\":\"" << escape(event.category) << "\""
+                    << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.tid
+                    << ",\"ts\":" << event.start << ",\"dur\":" << event.dur
+                    << ",\"args\":{";
+
+                for (Arguments::const_iterator it = event.args.begin(); it != event.args.end(); it++)
+                {
+                    ofs << (it == event.args.begin() ? "" : ",")
+                        << "\"" << escape(it->first) << "\":" << it->second;
+                }
+
+                ofs << "}}";
+            }
+
+            ofs << "\n]}" << std::endl;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* TRACER_CHROMETRACER_H_ */
@@ -0,0 +1,56 @@
+#ifndef UTILS_ACTIVATIONTRAITS_H_
+#define UTILS_ACTIVATIONTRAITS_H_
+
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Whether the backprop of an activation function needs its input Z
+//
+// An activation declares it with a member
+//     static const bool jacobian_needs_input = ...;
+// Activations that do not declare it, such as user-defined activations written
+// for earlier versions, are assumed to need Z, which is always correct.
+template <typename Activation>
+class JacobianNeedsInput
+{
+    private:
+        typedef char Yes;
+        typedef char No[2];
+
+        template <typename T, T> struct Check {};
+
+        template <typename A>
+        static Yes& test(Check<const bool*, &A::jacobian_needs_input>*);
+        template <typename A>
+        static No& test(...);
+
+        template <typename A, bool HasMember>
+        struct Value
+        {
+            static const bool value = true;
+        };
+
+        template <typename A>
+        struct Value<A, true>
+        {
+            static const bool value = A::jacobian_needs_input;
+        };
+
+    public:
+        static const bool value =
+            Value<Activation, sizeof(test<Activation>(0)) == sizeof(Yes)>::value;
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_ACTIVATIONTRAITS_H_ */
@@ -0,0 +1,229 @@
+#ifndef UTILS_CHECKPOINT_H_
+#define UTILS_CHECKPOINT_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "../Config.h"
+#include "../Tracer.h"
+#include "IO.h"
+#include "Timer.h"
+#include "ModelFile.h"
+
+#ifdef MDNN_USE_THREADS
+    #include <thread>
+    #include <mutex>
+    #include <condition_variable>
+    #include <exception>
+#endif
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+///
+/// Writes snapshots of a network to a model file in the background
+///
+/// There are two snapshot buffers. The training thread fills the buffer that
+/// is not being written, and hands it to a writer thread, which writes it to a
+/// temporary file, flushes it to disk and renames the file to the target name,
+/// so the target file is always complete. If a snapshot is handed over before the previous one has
+/// been written, only the latest one is written. Without `MDNN_USE_THREADS`,
+/// snapshots are written immediately in the calling thread.
+///
+/// Snapshots only contain the model. The state of the optimizer, such as the
+/// moment estimates of Adam, is not saved, since optimizers keep it per
+/// parameter address and cannot export it, so training that resumes from a
+/// checkpoint starts with a fresh optimizer state.
+///
+class Checkpointer
+{
+    public:
+        struct Snapshot
+        {
+            std::map<std::string, int>         meta;    // Meta information of the network
+            std::vector< std::vector<Scalar> > params;  // Parameters of each layer
+            Tracer*                            tracer;  // Records the span of the write, or NULL
+
+            Snapshot() : tracer(NULL) {}
+        };
+
+    private:
+        const std::string m_filename;
+        Snapshot          m_snapshot[2];
+        int               m_filling;     // Buffer being filled by the training thread
+#ifdef MDNN_USE_THREADS
+        int                     m_pending;  // Buffer waiting to be written, or -1
+        int                     m_writing;  // Buffer being written, or -1
+        bool                    m_stop;
+        std::exception_ptr      m_error;    // Error of the last failed write
+        std::mutex              m_mutex;
+        std::condition_variable m_cond;
+        std::thread             m_thread;
+#endif
+
+        Checkpointer(const Checkpointer&);
+        Checkpointer& operator=(const Checkpointer&);
+
+        void write(const Snapshot& snapshot) const
+        {
+            const double start = snapshot.tracer ? wall_time() : 0.0;
+            const std::string tmp = m_filename + ".tmp";
+            write_model_file(tmp, snapshot.meta, snapshot.params);
+            replace_file(tmp, m_filename);
+
+            if (snapshot.tracer)
+            {
+                Tracer::Arguments args;
+                args["epoch"] = snapshot.meta.find("CheckpointEpoch")->second;
+                args["batch"] = snapshot.meta.find("CheckpointBatch")->second;
+                snapshot.tracer->add_span("checkpoint write", "checkpoint", start, wall_time(), args);
+            }
+        }
+
+#ifdef MDNN_USE_THREADS
+        void worker()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (true)
+            {
+                m_cond.wait(lock, [this]() { return m_stop || m_pending >= 0; });
+
+                // Pending snapshots are still written when the writer is stopped
+                if (m_pending < 0)
+                {
+                    return;
+                }
+
+                m_writing = m_pending;
+                m_pending = -1;
+                lock.unlock();
+
+                try
+                {
+                    write(m_snapshot[m_writing]);
+                }
+                catch (...)
+                {
+                    lock.lock();
+                    m_error = std::current_exception();
+                    m_writing = -1;
+                    m_cond.notify_all();
+                    continue;
+                }
+
+                lock.lock();
+                m_writing = -1;
+                m_cond.notify_all();
+            }
+        }
+#endif
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param filename Name of the checkpoint file. A temporary file with the
+        ///                 suffix `.tmp` is created in the same directory.
+        ///
+        explicit Checkpointer(const std::string& filename) :
+            m_filename(filename), m_filling(0)
+#ifdef MDNN_USE_THREADS
+            , m_pending(-1), m_writing(-1), m_stop(false)
+#endif
+        {
+#ifdef MDNN_USE_THREADS
+            m_thread = std::thread(&Checkpointer::worker, this);
+#endif
+        }
+
+        ///
+        /// Destructor, which finishes the pending snapshot
+        ///
+        ~Checkpointer()
+        {
+#ifdef MDNN_USE_THREADS
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cond.notify_all();
+            m_thread.join();
+#endif
+        }
+
+        ///
+        /// Name of the checkpoint file
+        ///
+        const std::string& filename() const
+        {
+            return m_filename;
+        }
+
+        ///
+        /// Get a buffer for the next snapshot, which is not being written.
+        /// The buffer keeps the content of an earlier snapshot, so its vectors
+        /// can be reused.
+        ///
+        Snapshot& begin()
+        {
+#ifdef MDNN_USE_THREADS
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_filling = (m_writing == 0) ? 1 : 0;
+
+            // A snapshot that has not been picked up yet is superseded
+            if (m_pending == m_filling)
+            {
+                m_pending = -1;
+            }
+#endif
+            return m_snapshot[m_filling];
+        }
+
+        ///
+        /// Hand the buffer returned by begin() to the writer
+        ///
+        void commit()
+        {
+#ifdef MDNN_USE_THREADS
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending = m_filling;
+            }
+            m_cond.notify_all();
+#else
+            write(m_snapshot[m_filling]);
+#endif
+        }
+
+        ///
+        /// Wait until the committed snapshots have been written, and rethrow the
+        /// error of a failed write, if any
+        ///
+        void flush()
+        {
+#ifdef MDNN_USE_THREADS
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_pending < 0 && m_writing < 0; });
+
+            if (m_error)
+            {
+                std::exception_ptr error = m_error;
+                m_error = std::exception_ptr();
+                std::rethrow_exception(error);
+            }
+#endif
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_CHECKPOINT_H_ */
@@ -0,0 +1,423 @@
+#ifndef UTILS_CODEGEN_H_
+#define UTILS_CODEGEN_H_
+
+#include <map>       // std::map
+#include <string>    // std::string
+#include <vector>    // std::vector
+#include <sstream>   // std::ostringstream
+#include <ostream>   // std::ostream
+#include <cmath>     // std::ceil
+#include <cctype>    // std::toupper, std::isalnum
+#include <algorithm> // std::max
+#include <limits>    // std::numeric_limits
+#include <stdexcept> // std::invalid_argument
+#include <fstream>   // std::ofstream
+#include "../Config.h"
+#include "IO.h"
+#include "Enum.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Name of the Scalar type in the generated code
+template <typename T>
+inline const char* cpp_type_name()
+{
+    return "long double";
+}
+
+template <>
+inline const char* cpp_type_name<float>()
+{
+    return "float";
+}
+
+template <>
+inline const char* cpp_type_name<double>()
+{
+    return "double";
+}
+
+// A literal that is read back as exactly the same Scalar value
+inline std::string cpp_literal(const Scalar& x)
+{
+    if (!(x - x == Scalar(0)))
+        throw std::invalid_argument("[function write_cpp_model]: Parameters must be finite");
+
+    // Number of decimal digits needed to distinguish all values of Scalar
+    const int digits = int(std::ceil(1 + std::numeric_limits<Scalar>::digits * 0.30102999566398));
+    std::ostringstream ss;
+    ss.precision(digits - 1);
+    ss << std::scientific << x;
+
+    if (sizeof(Scalar) == sizeof(float))
+        ss << "f";
+    else if (sizeof(Scalar) > sizeof(double))
+        ss << "L";
+
+    return ss.str();
+}
+
+// Write a constant array, where values[index[k]] is the k-th element
+inline void write_cpp_array(std::ostream& os, const std::string& name,
+                            const std::vector<Scalar>& values, const std::vector<int>& index)
+{
+    os << "MDNN_GEN_ALIGN static const Scalar " << name << "[" << index.size() << "] = {";
+
+    for (std::size_t k = 0; k < index.size(); k++)
+    {
+        os << ((k % 6 == 0) ? "\n    " : " ") << cpp_literal(values[index[k]]) << ",";
+    }
+
+    os << "\n};\n\n";
+}
+
+// Indices [start, start + n)
+inline std::vector<int> cpp_range(int start, int n)
+{
+    std::vector<int> index(n);
+
+    for (int i = 0; i < n; i++)
+    {
+        index[i] = start + i;
+    }
+
+    return index;
+}
+
+// Statement that applies the activation function to the n values at out, with
+// the same expressions as the activation classes
+inline std::string cpp_activation(int act_id, int n)
+{
+    const std::string a = "    VectorMap a(out, " + to_string(n) + ");\n";
+
+    switch (act_id)
+    {
+        case IDENTITY:
+            return "";
+        case RELU:
+            return a + "    a = a.cwiseMax(Scalar(0));\n";
+        case SIGMOID:
+            return a + "    a.array() = Scalar(1) / (Scalar(1) + (-a.array()).exp());\n";
+        case TANH:
+            return a + "    a.array() = a.array().tanh();\n";
+        case MISH:
+            return "    for (int k = 0; k < " + to_string(n) + "; k++)\n        out[k] = mish(out[k]);\n";
+        case SOFTMAX:
+            return a + "    a.array() = (a.array() - a.maxCoeff()).exp();\n"
+                   "    a /= a.sum();\n";
+        default:
+            throw std::invalid_argument("[function write_cpp_model]: Activation is not of a known type");
+    }
+}
+
+inline int meta_value(const std::map<std::string, int>& map, const std::string& key)
+{
+    std::map<std::string, int>::const_iterator it = map.find(key);
+
+    if (it == map.end())
+        throw std::invalid_argument("[function write_cpp_model]: Meta information is incomplete");
+
+    return it->second;
+}
+
+// Write the constants and the forward function of a fully connected layer
+inline void write_cpp_fully_connected(std::ostream& os, const std::map<std::string, int>& map,
+                                      int index, const std::vector<Scalar>& param)
+{
+    const std::string ind = to_string(index);
+    const int in_size = meta_value(map, "in_size" + ind);
+    const int out_size = meta_value(map, "out_size" + ind);
+    const std::string name = "layer" + ind;
+
+    // z = W' * in + b, where the product is Eigen's matrix-vector kernel on the
+    // constant array of W, as in FullyConnected
+    os << "// Layer " << index << ": fully connected, " << in_size << " -> " << out_size << "\n";
+    write_cpp_array(os, name + "_weight", param, cpp_range(0, in_size * out_size));
+    write_cpp_array(os, name + "_bias", param, cpp_range(in_size * out_size, out_size));
+    os << "inline void " << name << "(const Scalar* in, Scalar* out)\n{\n"
+       << "    const ConstMatrixMap w(" << name << "_weight, " << in_size << ", " << out_size << ");\n"
+       << "    VectorMap z(out, " << out_size << ");\n"
+       << "    z.noalias() = w.transpose() * ConstVectorMap(in, " << in_size << ");\n"
+       << "    z += ConstVectorMap(" << name << "_bias, " << out_size << ");\n"
+       << cpp_activation(meta_value(map, "Activation" + ind), out_size)
+       << "}\n\n";
+}
+
+// Write the constants and the forward function of a convolutional layer
+// See Utils/Convolution.h for the layout of the images and filters
+inline void write_cpp_convolutional(std::ostream& os, const std::map<std::string, int>& map,
+                                    int index, const std::vector<Scalar>& param)
+{
+    const std::string ind = to_string(index);
+    const int cols = meta_value(map, "in_width" + ind);
+    const int rows = meta_value(map, "in_height" + ind);
+    const int in_channels = meta_value(map, "in_channels" + ind);
+    const int out_channels = meta_value(map, "out_channels" + ind);
+    const int filter_cols = meta_value(map, "window_width" + ind);
+    const int filter_rows = meta_value(map, "window_height" + ind);
+    const int conv_rows = rows - filter_rows + 1;
+    const int conv_cols = cols - filter_cols + 1;
+    const int filter_size = filter_rows * filter_cols;
+    const int nfilter = in_channels * out_channels * filter_size;
+    const int depth = in_channels * filter_size;
+    const std::string name = "layer" + ind;
+
+    // The filters are stored as a (in_channels * filter_size) x out_channels
+    // matrix, so that each block of output columns is a single product of a
+    // patch matrix, whose rows are the inputs read by each output, and the filters
+    std::vector<int> filter_index(nfilter);
+
+    for (int oc = 0, k = 0; oc < out_channels; oc++)
+    {
+        for (int ic = 0; ic < in_channels; ic++)
+        {
+            for (int f = 0; f < filter_size; f++, k++)
+            {
+                filter_index[k] = (ic * out_channels + oc) * filter_size + f;
+            }
+        }
+    }
+
+    // Number of output columns in a block, so that the patch matrix takes at most
+    // 4096 values on the stack
+    const int block_cols = std::max(1, std::min(conv_cols, 4096 / (conv_rows * depth)));
+
+    os << "// Layer " << index << ": convolutional, " << in_channels << " x " << rows << " x " << cols
+       << " -> " << out_channels << " x " << conv_rows << " x " << conv_cols << "\n";
+    write_cpp_array(os, name + "_filter", param, filter_index);
+    write_cpp_array(os, name + "_bias", param, cpp_range(nfilter, out_channels));
+    os << "inline void " << name << "(const Scalar* in, Scalar* out)\n{\n"
+       << "    const ConstMatrixMap w(" << name << "_filter, " << depth << ", " << out_channels << ");\n"
+       << "    MDNN_GEN_ALIGN Scalar patch[" << block_cols * conv_rows * depth << "];\n\n"
+       << "    for (int j0 = 0; j0 < " << conv_cols << "; j0 += " << block_cols << ")\n"
+       << "    {\n"
+       << "        const int nj = (" << conv_cols << " - j0 < " << block_cols << ") ? (" << conv_cols
+       << " - j0) : " << block_cols << ";\n"
+       << "        Scalar* dest = patch;\n\n"
+       << "        for (int ic = 0; ic < " << in_channels << "; ic++)\n"
+       << "            for (int fj = 0; fj < " << filter_cols << "; fj++)\n"
+       << "                for (int fi = 0; fi < " << filter_rows << "; fi++)\n"
+       << "                {\n"
+       << "                    const Scalar* src = in + ic * " << rows * cols << " + (j0 + fj) * " << rows
+       << " + fi;\n\n"
+       << "                    for (int j = 0; j < nj; j++, src += " << rows << ", dest += " << conv_rows << ")\n"
+       << "                        for (int i = 0; i < " << conv_rows << "; i++)\n"
+       << "                            dest[i] = src[i];\n"
+       << "                }\n\n"
+       << "        const int np = nj * " << conv_rows << ";\n"
+       << "        StridedMatrixMap z(out + j0 * " << conv_rows << ", np, " << out_channels
+       << ", Eigen::OuterStride<>(" << conv_rows * conv_cols << "));\n"
+       << "        z.noalias() = ConstMatrixMap(patch, np, " << depth << ") * w;\n"
+       << "    }\n\n"
+       << "    MatrixMap z(out, " << conv_rows * conv_cols << ", " << out_channels << ");\n"
+       << "    z.rowwise() += ConstVectorMap(" << name << "_bias, " << out_channels << ").transpose();\n"
+       << cpp_activation(meta_value(map, "Activation" + ind), out_channels * conv_rows * conv_cols)
+       << "}\n\n";
+}
+
+// Write the forward function of a max-pooling layer
+inline void write_cpp_max_pooling(std::ostream& os, const std::map<std::string, int>& map, int index)
+{
+    const std::string ind = to_string(index);
+    const int cols = meta_value(map, "in_width" + ind);
+    const int rows = meta_value(map, "in_height" + ind);
+    const int channels = meta_value(map, "in_channels" + ind);
+    const int pool_cols = meta_value(map, "pooling_width" + ind);
+    const int pool_rows = meta_value(map, "pooling_height" + ind);
+    const int out_rows = rows / pool_rows;
+    const int out_cols = cols / pool_cols;
+    const std::string name = "layer" + ind;
+
+    os << "// Layer " << index << ": max pooling, " << channels << " x " << rows << " x " << cols
+       << " -> " << channels << " x " << out_rows << " x " << out_cols << "\n"
+       << "inline void " << name << "(const Scalar* in, Scalar* out)\n{\n"
+       << "    for (int c = 0; c < " << channels << "; c++)\n"
+       << "        for (int oj = 0; oj < " << out_cols << "; oj++)\n"
+       << "            for (int oi = 0; oi < " << out_rows << "; oi++)\n"
+       << "            {\n"
+       << "                const Scalar* src = in + c * " << rows * cols << " + oj * " << pool_cols * rows
+       << " + oi * " << pool_rows << ";\n"
+       << "                Scalar m = src[0];\n\n"
+       << "                for (int pj = 0; pj < " << pool_cols << "; pj++)\n"
+       << "                    for (int pi = 0; pi < " << pool_rows << "; pi++)\n"
+       << "                        m = (src[pj * " << rows << " + pi] > m) ? src[pj * " << rows << " + pi] : m;\n\n"
+       << "                out[(c * " << out_cols << " + oj) * " << out_rows << " + oi] = m;\n"
+       << "            }\n\n"
+       << cpp_activation(meta_value(map, "Activation" + ind), channels * out_rows * out_cols)
+       << "}\n\n";
+}
+
+///
+/// Write a self-contained C++ header that computes the output of a network,
+/// with the parameters as constant arrays and all dimensions fixed
+///
+/// \param os     The output stream
+/// \param map    The meta information of the network
+/// \param params The serialized parameters of each layer
+/// \param name   The namespace of the generated code
+///
+inline void write_cpp_model(std::ostream& os, const std::map<std::string, int>& map,
+                            const std::vector< std::vector<Scalar> >& params,
+                            const std::string& name)
+{
+    const int nlayer = params.size();
+
+    if (nlayer < 1)
+        throw std::invalid_argument("[function write_cpp_model]: Network has no layers");
+
+    bool valid_name = !name.empty() && !std::isdigit(name[0]);
+
+    for (std::size_t i = 0; i < name.size(); i++)
+    {
+        valid_name = valid_name && (std::isalnum(name[i]) || name[i] == '_');
+    }
+
+    if (!valid_name)
+        throw std::invalid_argument("[function write_cpp_model]: Name must be a C++ identifier");
+
+    // Input and output sizes of the layers, from the meta information
+    std::vector<int> out_sizes(nlayer);
+    int in_size = 0;
+
+    for (int i = 0; i < nlayer; i++)
+    {
+        const std::string ind = to_string(i);
+        const int layer_type = meta_value(map, "Layer" + ind);
+        int layer_in, layer_out;
+
+        if (layer_type == FULLY_CONNECTED)
+        {
+            layer_in = meta_value(map, "in_size" + ind);
+            layer_out = meta_value(map, "out_size" + ind);
+        }
+        else if (layer_type == CONVOLUTIONAL)
+        {
+            const int rows = meta_value(map, "in_height" + ind);
+            const int cols = meta_value(map, "in_width" + ind);
+            layer_in = rows * cols * meta_value(map, "in_channels" + ind);
+            layer_out = (rows - meta_value(map, "window_height" + ind) + 1) *
+                        (cols - meta_value(map, "window_width" + ind) + 1) *
+                        meta_value(map, "out_channels" + ind);
+        }
+        else if (layer_type == MAX_POOLING)
+        {
+            const int rows = meta_value(map, "in_height" + ind);
+            const int cols = meta_value(map, "in_width" + ind);
+            const int channels = meta_value(map, "in_channels" + ind);
+            layer_in = rows * cols * channels;
+            layer_out = (rows / meta_value(map, "pooling_height" + ind)) *
+                        (cols / meta_value(map, "pooling_width" + ind)) * channels;
+        }
+        else
+        {
+            throw std::invalid_argument("[function write_cpp_model]: Layer is not of a known type");
+        }
+
+        if (i == 0)
+            in_size = layer_in;
+
+        out_sizes[i] = layer_out;
+    }
+
+    // Largest intermediate result
+    int buffer_size = 0;
+
+    for (int i = 0; i < nlayer - 1; i++)
+    {
+        buffer_size = std::max(buffer_size, out_sizes[i]);
+    }
+
+    std::string guard = name + "_H_";
+
+    for (std::size_t i = 0; i < guard.size(); i++)
+    {
+        guard[i] = std::toupper(guard[i]);
+    }
+
+    os << "// Standalone predictor generated by MiniDNN from a trained network\n"
+       << "//\n"
+       << "// " << name << "::predict(x, y) computes the output y of the network for one\n"
+       << "// observation x, and " << name << "::predict(x, y, n) for n observations stored\n"
+       << "// one after another, as in the columns of a matrix. The results agree with\n"
+       << "// Network::predict() up to rounding. The code only depends on Eigen, and\n"
+       << "// the intermediate results are kept on the stack.\n\n"
+       << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+       << "#include <cmath>\n"
+       << "#include <Eigen/Core>\n\n"
+       << "// The constant arrays are read through aligned Eigen maps, so MDNN_GEN_ALIGN\n"
+       << "// must align to at least 16 bytes\n"
+       << "#ifndef MDNN_GEN_ALIGN\n"
+       << "#define MDNN_GEN_ALIGN EIGEN_ALIGN_TO_BOUNDARY(64)\n"
+       << "#endif\n\n"
+       << "namespace " << name << "\n{\n\n\n"
+       << "typedef " << cpp_type_name<Scalar>() << " Scalar;\n\n"
+       << "// Number of input and output units\n"
+       << "const int in_size = " << in_size << ";\n"
+       << "const int out_size = " << out_sizes[nlayer - 1] << ";\n\n"
+       << "namespace detail\n{\n\n\n"
+       << "typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;\n"
+       << "typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;\n"
+       << "typedef Eigen::Map<const Matrix, Eigen::Aligned16> ConstMatrixMap;\n"
+       << "typedef Eigen::Map<Matrix> MatrixMap;\n"
+       << "typedef Eigen::Map<Matrix, 0, Eigen::OuterStride<> > StridedMatrixMap;\n"
+       << "typedef Eigen::Map<const Vector> ConstVectorMap;\n"
+       << "typedef Eigen::Map<Vector> VectorMap;\n\n"
+       << "inline Scalar mish(Scalar x)\n{\n"
+       << "    const Scalar s = std::exp(-std::abs(x));\n"
+       << "    const Scalar t = (s + Scalar(1)) * (s + Scalar(1));\n"
+       << "    const Scalar u = (x >= Scalar(0)) ? s * s : Scalar(1);\n"
+       << "    return x * (t - u) / (t + u);\n}\n\n";
+
+    for (int i = 0; i < nlayer; i++)
+    {
+        const int layer_type = meta_value(map, "Layer" + to_string(i));
+
+        if (layer_type == FULLY_CONNECTED)
+            write_cpp_fully_connected(os, map, i, params[i]);
+        else if (layer_type == CONVOLUTIONAL)
+            write_cpp_convolutional(os, map, i, params[i]);
+        else
+            write_cpp_max_pooling(os, map, i);
+    }
+
+    os << "\n} // namespace detail\n\n"
+       << "inline void predict(const Scalar* x, Scalar* y)\n{\n";
+
+    if (nlayer == 1)
+    {
+        os << "    detail::layer0(x, y);\n";
+    }
+    else
+    {
+        os << "    MDNN_GEN_ALIGN Scalar buffer[2][" << buffer_size << "];\n"
+           << "    detail::layer0(x, buffer[0]);\n";
+
+        for (int i = 1; i < nlayer - 1; i++)
+        {
+            os << "    detail::layer" << i << "(buffer[" << (i - 1) % 2 << "], buffer[" << i % 2 << "]);\n";
+        }
+
+        os << "    detail::layer" << nlayer - 1 << "(buffer[" << (nlayer - 2) % 2 << "], y);\n";
+    }
+
+    os << "}\n\n"
+       << "inline void predict(const Scalar* x, Scalar* y, int n)\n{\n"
+       << "    for (int j = 0; j < n; j++)\n"
+       << "        predict(x + j * in_size, y + j * out_size);\n"
+       << "}\n\n\n"
+       << "} // namespace " << name << "\n\n"
+       << "#endif /* " << guard << " */\n";
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_CODEGEN_H_ */
@@ -2,7 +2,10 @@
 #define UTILS_CONVOLUTION_H_
 
 #include <Eigen/Core>
+#include <vector>
+#include <cstring>
 #include "../Config.h"
+#include "HalfFloat.h"
 
 namespace MiniDNN
 {
@@ -149,11 +152,52 @@ inline void moving_product(
                 row1, row2) * mat2;
     }
 }
+// Filters stored as Scalar, which are used in place
+class ScalarFilters
+{
+    private:
+        const Scalar* m_data;
+
+    public:
+        explicit ScalarFilters(const Scalar* data) :
+            m_data(data)
+        {}
+
+        // Filters of the input channels [start, start + size)
+        const Scalar* get(int start, int size)
+        {
+            return m_data + start;
+        }
+};
+
+// Filters stored in a 16-bit format, which are converted to Scalar
+// one input channel at a time
+class CompactFilters
+{
+    private:
+        const CompactStorage& m_storage;
+        std::vector<Scalar>   m_buffer;
+
+    public:
+        explicit CompactFilters(const CompactStorage& storage) :
+            m_storage(storage)
+        {}
+
+        const Scalar* get(int start, int size)
+        {
+            m_buffer.resize(size);
+            m_storage.unpack(start, size, &m_buffer[0]);
+            return &m_buffer[0];
+        }
+};
+
 // The main convolution function using the "valid" rule
+// 'filters' is ScalarFilters or CompactFilters
+template <typename FilterSource>
 inline void convolve_valid(
     const ConvDims& dim,
     const Scalar* src, const bool image_outer_loop, const int n_obs,
-    const Scalar* filter_data,
+    FilterSource& filters,
     Scalar* dest)
 {
     typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
@@ -179,13 +223,12 @@ inline void convolve_valid(
     const int filter_size = dim.filter_rows * dim.filter_cols;
     const int filter_stride = filter_size * dim.out_channels;
 
-    for (int i = 0; i < dim.in_channels;
-            i++, src += channel_stride, filter_data += filter_stride)
+    for (int i = 0; i < dim.in_channels; i++, src += channel_stride)
     {
         // Flatten source image
         flatten_mat(dim, src, img_stride, n_obs, flat_mat);
         // Compute the convolution result
-        ConstMapMat filter(filter_data, filter_size, dim.out_channels);
+        ConstMapMat filter(filters.get(i * filter_stride, filter_stride), filter_size, dim.out_channels);
         moving_product(step, flat_mat, filter, res);
     }
 
@@ -236,6 +279,80 @@ inline void convolve_valid(
     }
 }
 
+inline void convolve_valid(
+    const ConvDims& dim,
+    const Scalar* src, const bool image_outer_loop, const int n_obs,
+    const Scalar* filter_data,
+    Scalar* dest)
+{
+    ScalarFilters filters(filter_data);
+    convolve_valid(dim, src, image_outer_loop, n_obs, filters, dest);
+}
+
+// The "valid" convolution of a single image, computed by one matrix product
+// 'patch' is a workspace that receives the (conv_rows * conv_cols) x
+// (in_channels * filter_rows * filter_cols) matrix of image patches, whose
+// row c * conv_rows + r holds the elements of all channels that are covered by
+// the filters at output location [r, c]. The sum over the input channels of
+// the products of the columns of 'patch' that belong to a channel and the
+// filters of the channel, a (filter_rows * filter_cols) x out_channels matrix,
+// then has the layout of 'dest', so no reordering is needed. This avoids the
+// per-column products of moving_product(), which are too small to be efficient
+// when there is only one image
+template <typename FilterSource>
+inline void convolve_valid_single(
+    const ConvDims& dim, const Scalar* src,
+    FilterSource& filters,
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& patch,
+    Scalar* dest)
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Map<const Matrix> ConstMapMat;
+    typedef Eigen::Map<Matrix> MapMat;
+    const int conv_size = dim.conv_rows * dim.conv_cols;
+    const int filter_size = dim.filter_rows * dim.filter_cols;
+    const int channel_size = dim.channel_rows * dim.channel_cols;
+    const std::size_t copy_bytes = sizeof(Scalar) * dim.conv_rows;
+    patch.resize(conv_size, dim.in_channels * filter_size);
+    Scalar* writer = patch.data();
+
+    // Filter element [p, q] of channel i covers the input elements
+    // [r + p, c + q], so each column of the output locations is a segment of
+    // a column of the channel
+    for (int i = 0; i < dim.in_channels; i++, src += channel_size)
+    {
+        for (int q = 0; q < dim.filter_cols; q++)
+        {
+            for (int p = 0; p < dim.filter_rows; p++)
+            {
+                const Scalar* reader = src + q * dim.channel_rows + p;
+
+                for (int c = 0; c < dim.conv_cols; c++, reader += dim.channel_rows, writer += dim.conv_rows)
+                {
+                    std::memcpy(writer, reader, copy_bytes);
+                }
+            }
+        }
+    }
+
+    MapMat res(dest, conv_size, dim.out_channels);
+    const int filter_stride = filter_size * dim.out_channels;
+
+    for (int i = 0; i < dim.in_channels; i++)
+    {
+        ConstMapMat filter(filters.get(i * filter_stride, filter_stride), filter_size, dim.out_channels);
+
+        if (i == 0)
+        {
+            res.noalias() = patch.leftCols(filter_size) * filter;
+        }
+        else
+        {
+            res.noalias() += patch.middleCols(i * filter_size, filter_size) * filter;
+        }
+    }
+}
+
 
 
 // The moving_product() function for the "full" rule
@@ -0,0 +1,239 @@
+#ifndef UTILS_HALFFLOAT_H_
+#define UTILS_HALFFLOAT_H_
+
+#include <vector>    // std::vector
+#include <cstring>   // std::memcpy
+#include <stdexcept> // std::invalid_argument
+#include <stdint.h>  // uint16_t, uint32_t
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// Storage formats of layer parameters, see Layer::set_storage_precision()
+///
+enum PRECISION
+{
+    SCALAR_PRECISION = 0, // The Scalar type
+    FP16_PRECISION,       // IEEE 754 half precision, 5 exponent and 10 mantissa bits
+    BF16_PRECISION        // bfloat16, 8 exponent and 7 mantissa bits
+};
+
+
+namespace internal
+{
+
+
+// Conversions between float and 16-bit formats, rounding to nearest even
+// Doubles are converted through float, which gives the same result except in
+// rare ties
+inline uint32_t float_bits(float x)
+{
+    uint32_t u;
+    std::memcpy(&u, &x, 4);
+    return u;
+}
+
+inline float bits_float(uint32_t u)
+{
+    float x;
+    std::memcpy(&x, &u, 4);
+    return x;
+}
+
+// F. Giesen, "float_to_half_fast3_rtne", https://gist.github.com/rygorous/2156668
+inline uint16_t float_to_fp16(float x)
+{
+    const uint32_t f32_infty = 255u << 23;
+    const uint32_t f16_max = (127u + 16u) << 23;
+    const uint32_t denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+    uint32_t u = float_bits(x);
+    const uint32_t sign = u & 0x80000000u;
+    u ^= sign;
+    uint32_t h;
+
+    if (u >= f16_max)
+    {
+        // Overflow to infinity, or NaN
+        h = (u > f32_infty) ? 0x7E00u : 0x7C00u;
+    }
+    else if (u < (113u << 23))
+    {
+        // Subnormal results, rounded by the floating-point addition
+        h = float_bits(bits_float(u) + bits_float(denorm_magic)) - denorm_magic;
+    }
+    else
+    {
+        const uint32_t mant_odd = (u >> 13) & 1u;
+        u += (uint32_t(15 - 127) << 23) + 0xFFFu + mant_odd;
+        h = u >> 13;
+    }
+
+    return uint16_t(h | (sign >> 16));
+}
+
+inline float fp16_to_float(uint16_t h)
+{
+    const uint32_t shifted_exp = 0x7C00u << 13;
+    uint32_t u = uint32_t(h & 0x7FFFu) << 13;
+    const uint32_t exp = u & shifted_exp;
+    u += uint32_t(127 - 15) << 23;
+
+    if (exp == shifted_exp)
+    {
+        // Infinity or NaN
+        u += uint32_t(128 - 16) << 23;
+    }
+    else if (exp == 0)
+    {
+        // Zero or subnormal, renormalized by the floating-point subtraction
+        u = float_bits(bits_float(u + (1u << 23)) - bits_float(113u << 23));
+    }
+
+    return bits_float(u | (uint32_t(h & 0x8000u) << 16));
+}
+
+inline uint16_t float_to_bf16(float x)
+{
+    const uint32_t u = float_bits(x);
+
+    // Keep NaN a NaN, which could otherwise be rounded to infinity
+    if ((u & 0x7FFFFFFFu) > 0x7F800000u)
+    {
+        return uint16_t((u >> 16) | 0x40u);
+    }
+
+    return uint16_t((u + 0x7FFFu + ((u >> 16) & 1u)) >> 16);
+}
+
+inline float bf16_to_float(uint16_t h)
+{
+    return bits_float(uint32_t(h) << 16);
+}
+
+// Convert n values to a 16-bit format
+inline void pack_scalars(const Scalar* src, int n, uint16_t* dest, PRECISION precision)
+{
+    if (precision == FP16_PRECISION)
+    {
+        for (int i = 0; i < n; i++)
+            dest[i] = float_to_fp16(float(src[i]));
+    }
+    else if (precision == BF16_PRECISION)
+    {
+        for (int i = 0; i < n; i++)
+            dest[i] = float_to_bf16(float(src[i]));
+    }
+    else
+    {
+        throw std::invalid_argument("[function pack_scalars]: Not a 16-bit format");
+    }
+}
+
+// Convert n values from a 16-bit format
+// The loops are simple enough for the compiler to vectorize
+inline void unpack_scalars(const uint16_t* src, int n, Scalar* dest, PRECISION precision)
+{
+    if (precision == FP16_PRECISION)
+    {
+        for (int i = 0; i < n; i++)
+            dest[i] = Scalar(fp16_to_float(src[i]));
+    }
+    else if (precision == BF16_PRECISION)
+    {
+        for (int i = 0; i < n; i++)
+            dest[i] = Scalar(bf16_to_float(src[i]));
+    }
+    else
+    {
+        throw std::invalid_argument("[function unpack_scalars]: Not a 16-bit format");
+    }
+}
+
+///
+/// Parameters stored in a 16-bit format, either in its own memory, or in
+/// external memory such as a memory-mapped model file, which is never written
+///
+class CompactStorage
+{
+    private:
+        PRECISION             m_precision; // SCALAR_PRECISION if nothing is stored
+        std::vector<uint16_t> m_owned;     // Own storage, unless the data are mapped
+        const uint16_t*       m_data;      // Points to m_owned or to external memory
+        int                   m_size;
+
+        CompactStorage(const CompactStorage&);
+        CompactStorage& operator=(const CompactStorage&);
+
+    public:
+        CompactStorage() :
+            m_precision(SCALAR_PRECISION), m_data(NULL), m_size(0)
+        {}
+
+        // Format of the stored data, or SCALAR_PRECISION if the storage is empty
+        PRECISION precision() const
+        {
+            return m_precision;
+        }
+
+        bool empty() const
+        {
+            return m_precision == SCALAR_PRECISION;
+        }
+
+        int size() const
+        {
+            return m_size;
+        }
+
+        // Convert and store n values
+        void pack(const Scalar* src, int n, PRECISION precision)
+        {
+            m_owned.resize(n);
+            pack_scalars(src, n, n > 0 ? &m_owned[0] : NULL, precision);
+            m_precision = precision;
+            m_data = n > 0 ? &m_owned[0] : NULL;
+            m_size = n;
+        }
+
+        // Use n values in external memory
+        void map(const uint16_t* data, int n, PRECISION precision)
+        {
+            if (precision == SCALAR_PRECISION)
+                throw std::invalid_argument("[class CompactStorage]: Not a 16-bit format");
+
+            std::vector<uint16_t>().swap(m_owned);
+            m_precision = precision;
+            m_data = data;
+            m_size = n;
+        }
+
+        // Convert n values starting from the start-th one to Scalar
+        void unpack(int start, int n, Scalar* dest) const
+        {
+            unpack_scalars(m_data + start, n, dest, m_precision);
+        }
+
+        void unpack(Scalar* dest) const
+        {
+            unpack(0, m_size, dest);
+        }
+
+        void release()
+        {
+            std::vector<uint16_t>().swap(m_owned);
+            m_precision = SCALAR_PRECISION;
+            m_data = NULL;
+            m_size = 0;
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_HALFFLOAT_H_ */
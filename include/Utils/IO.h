@@ -5,15 +5,20 @@
 #include <string>    // std::string
 #include <sstream>   // std::ostringstream
 #include <fstream>   // std::ofstream, std::ifstream
-#include <iterator>  // std::ostream_iterator, std::istreambuf_iterator, std::back_inserter
+#include <istream>   // std::istream
+#include <ostream>   // std::ostream
 #include <vector>    // std::vector
 #include <stdexcept> // std::runtime_error, std::invalid_argument
 #include <cstdlib>   // atoi
+#include <cstdio>    // std::rename
 
 #ifdef _WIN32
     #include <direct.h>     // _mkdir
+    #include <windows.h>    // MoveFileExA
 #else
     #include <sys/stat.h> // mkdir
+    #include <fcntl.h>    // open
+    #include <unistd.h>   // fsync, close
 #endif
 
 #include "../Config.h"
@@ -55,6 +60,62 @@ inline bool create_directory(const std::string& dir)
 #endif
 }
 
+#ifndef _WIN32
+///
+/// Flush a file or a directory from the operating system's cache to disk
+///
+/// \param filename  Name of the file or directory
+/// \return          \c true if the data are successfully flushed
+///
+inline bool sync_file(const std::string& filename)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    const bool success = fsync(fd) == 0;
+    close(fd);
+    return success;
+}
+#endif
+
+///
+/// Atomically replace a file by another one, so that readers see either the
+/// old or the new content, but never a partially written file
+///
+/// The new file is flushed to disk before it is renamed, and the rename is
+/// flushed afterwards, so that the result also survives a power loss.
+///
+/// \param from   Name of the new file, which is typically a temporary file
+///               in the same directory
+/// \param to     Name of the file to be replaced
+///
+inline void replace_file(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+    const bool success = MoveFileExA(from.c_str(), to.c_str(),
+                                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    if (!sync_file(from))
+        throw std::runtime_error("Error while flushing file");
+
+    const bool success = std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+
+    if (!success)
+        throw std::runtime_error("Error while renaming file");
+
+#ifndef _WIN32
+    // The rename is an entry of the directory that contains the file
+    const std::string::size_type slash = to.rfind('/');
+    const std::string dir = (slash == std::string::npos) ? std::string(".") :
+                            (slash == 0) ? std::string("/") : to.substr(0, slash);
+
+    if (!sync_file(dir))
+        throw std::runtime_error("Error while flushing directory");
+#endif
+}
+
 ///
 /// Write an std::vector<Scalar> vector to file
 ///
@@ -69,10 +130,10 @@ inline void write_vector_to_file(
     if (ofs.fail())
         throw std::runtime_error("Error while opening file");
 
-    std::ostream_iterator<char> osi(ofs);
-    const char* begin_byte = reinterpret_cast<const char*>(&vec[0]);
-    const char* end_byte = begin_byte + vec.size() * sizeof(Scalar);
-    std::copy(begin_byte, end_byte, osi);
+    if (!vec.empty())
+        ofs.write(reinterpret_cast<const char*>(&vec[0]), vec.size() * sizeof(Scalar));
+    if (ofs.fail())
+        throw std::runtime_error("Error while writing file");
 }
 
 ///
@@ -107,12 +168,16 @@ inline std::vector<Scalar> read_vector_from_file(const std::string& filename)
     if (ifs.fail())
         throw std::runtime_error("Error while opening file");
 
-    std::vector<char> buffer;
-    std::istreambuf_iterator<char> iter(ifs);
-    std::istreambuf_iterator<char> end;
-    std::copy(iter, end, std::back_inserter(buffer));
-    std::vector<Scalar> vec(buffer.size() / sizeof(Scalar));
-    std::copy(&buffer[0], &buffer[0] + buffer.size(), reinterpret_cast<char*>(&vec[0]));
+    // Read the file directly into the vector
+    ifs.seekg(0, std::ios::end);
+    const std::streamoff size = ifs.tellg();
+    ifs.seekg(0, std::ios::beg);
+    std::vector<Scalar> vec(size / sizeof(Scalar));
+    if (!vec.empty())
+        ifs.read(reinterpret_cast<char*>(&vec[0]), vec.size() * sizeof(Scalar));
+    if (ifs.fail())
+        throw std::runtime_error("Error while reading file");
+
     return vec;
 }
 
@@ -139,6 +204,20 @@ inline std::vector< std::vector< Scalar> > read_parameters(
     return params;
 }
 
+///
+/// Write a map object to a stream, one `key=value` pair per line
+///
+/// \param os           The output stream
+/// \param map          The map object to be exported
+///
+inline void write_map(std::ostream& os, const std::map<std::string, int>& map)
+{
+    for (std::map<std::string, int>::const_iterator it = map.begin(); it != map.end(); it++)
+    {
+        os << it->first << "=" << it->second << std::endl;
+    }
+}
+
 ///
 /// Write a map object to file
 ///
@@ -154,27 +233,20 @@ inline void write_map(const std::string& filename, const std::map<std::string, i
     if (ofs.fail())
         throw std::runtime_error("Error while opening file");
 
-    for (std::map<std::string, int>::const_iterator it = map.begin(); it != map.end(); it++)
-    {
-        ofs << it->first << "=" << it->second << std::endl;
-    }
+    write_map(ofs, map);
 }
 
 ///
-/// Read in a map object from file
+/// Read in a map object from a stream written by write_map()
 ///
-/// \param filename     The filename of the input
+/// \param is           The input stream
 /// \param map          The output map object
 ///
-inline void read_map(const std::string& filename, std::map<std::string, int>& map)
+inline void read_map(std::istream& is, std::map<std::string, int>& map)
 {
-    std::ifstream ifs(filename.c_str(), std::ios::in);
-    if (ifs.fail())
-        throw std::runtime_error("Error while opening file");
-
     map.clear();
     std::string buf;
-    while (std::getline(ifs, buf))
+    while (std::getline(is, buf))
     {
         std::size_t sep = buf.find('=');
         if (sep == std::string::npos)
@@ -186,6 +258,21 @@ inline void read_map(const std::string& filename, std::map<std::string, int>& ma
     }
 }
 
+///
+/// Read in a map object from file
+///
+/// \param filename     The filename of the input
+/// \param map          The output map object
+///
+inline void read_map(const std::string& filename, std::map<std::string, int>& map)
+{
+    std::ifstream ifs(filename.c_str(), std::ios::in);
+    if (ifs.fail())
+        throw std::runtime_error("Error while opening file");
+
+    read_map(ifs, map);
+}
+
 
 } // namespace internal
 
@@ -0,0 +1,214 @@
+#ifndef UTILS_MAPPEDFILE_H_
+#define UTILS_MAPPEDFILE_H_
+
+#include <string>    // std::string
+#include <cstddef>   // std::size_t
+#include <stdexcept> // std::runtime_error
+#include <algorithm> // std::swap
+#ifdef _WIN32
+    #include <windows.h>    // CreateFileMapping, MapViewOfFile
+#else
+    #include <sys/mman.h>   // mmap, munmap
+    #include <sys/stat.h>   // fstat
+    #include <fcntl.h>      // open
+    #include <unistd.h>     // close, ftruncate
+#endif
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+///
+/// A file mapped into memory, which lets large arrays live in the page cache
+/// instead of the heap. The mapping is released by the destructor.
+///
+class MappedFile
+{
+    private:
+        void*       m_data;
+        std::size_t m_size;
+#ifdef _WIN32
+        HANDLE      m_file;
+        HANDLE      m_mapping;
+#else
+        int         m_fd;
+#endif
+
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+    public:
+        MappedFile() :
+            m_data(NULL), m_size(0),
+#ifdef _WIN32
+            m_file(INVALID_HANDLE_VALUE), m_mapping(NULL)
+#else
+            m_fd(-1)
+#endif
+        {}
+
+        ~MappedFile()
+        {
+            close();
+        }
+
+        ///
+        /// Create a file of the given size, or truncate an existing one, and map
+        /// it for reading and writing. Changes are written back to the file.
+        ///
+        /// \param filename The path of the file.
+        /// \param size     Size of the file in bytes.
+        ///
+        void create(const std::string& filename, std::size_t size)
+        {
+            close();
+
+            if (size == 0)
+            {
+                throw std::invalid_argument("[class MappedFile]: Size of the mapped file must be positive");
+            }
+
+#ifdef _WIN32
+            m_file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                                 CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (m_file == INVALID_HANDLE_VALUE)
+                throw std::runtime_error("Error while creating file");
+
+            const unsigned long long size64 = size;
+            m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, DWORD(size64 >> 32),
+                                           DWORD(size64 & 0xFFFFFFFFu), NULL);
+            m_data = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, size) : NULL;
+#else
+            m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (m_fd < 0)
+                throw std::runtime_error("Error while creating file");
+
+            if (ftruncate(m_fd, off_t(size)) == 0)
+            {
+                m_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+                if (m_data == MAP_FAILED)
+                    m_data = NULL;
+            }
+#endif
+
+            if (!m_data)
+            {
+                close();
+                throw std::runtime_error("Error while mapping file");
+            }
+
+            m_size = size;
+        }
+
+        ///
+        /// Map an existing file for reading. The mapping is shared, so processes
+        /// that map the same file also share its pages in the page cache.
+        ///
+        /// \param filename The path of the file.
+        ///
+        void open(const std::string& filename)
+        {
+            close();
+
+#ifdef _WIN32
+            m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (m_file == INVALID_HANDLE_VALUE)
+                throw std::runtime_error("Error while opening file");
+
+            LARGE_INTEGER size64;
+            if (GetFileSizeEx(m_file, &size64) && size64.QuadPart > 0)
+            {
+                m_size = std::size_t(size64.QuadPart);
+                m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+                m_data = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+            }
+#else
+            m_fd = ::open(filename.c_str(), O_RDONLY);
+            if (m_fd < 0)
+                throw std::runtime_error("Error while opening file");
+
+            struct stat st;
+            if (fstat(m_fd, &st) == 0 && st.st_size > 0)
+            {
+                m_size = std::size_t(st.st_size);
+                m_data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+                if (m_data == MAP_FAILED)
+                    m_data = NULL;
+            }
+#endif
+
+            if (!m_data)
+            {
+                close();
+                throw std::runtime_error("Error while mapping file");
+            }
+        }
+
+        ///
+        /// Unmap the file
+        ///
+        void close()
+        {
+#ifdef _WIN32
+            if (m_data)
+                UnmapViewOfFile(m_data);
+            if (m_mapping)
+                CloseHandle(m_mapping);
+            if (m_file != INVALID_HANDLE_VALUE)
+                CloseHandle(m_file);
+            m_mapping = NULL;
+            m_file = INVALID_HANDLE_VALUE;
+#else
+            if (m_data)
+                munmap(m_data, m_size);
+            if (m_fd >= 0)
+                ::close(m_fd);
+            m_fd = -1;
+#endif
+            m_data = NULL;
+            m_size = 0;
+        }
+
+        ///
+        /// Exchange the mappings of two objects
+        ///
+        void swap(MappedFile& other)
+        {
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+#ifdef _WIN32
+            std::swap(m_file, other.m_file);
+            std::swap(m_mapping, other.m_mapping);
+#else
+            std::swap(m_fd, other.m_fd);
+#endif
+        }
+
+        ///
+        /// Pointer to the mapped data, or `NULL` if no file is mapped
+        ///
+        void* data() const
+        {
+            return m_data;
+        }
+
+        ///
+        /// Size of the mapped data in bytes
+        ///
+        std::size_t size() const
+        {
+            return m_size;
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_MAPPEDFILE_H_ */
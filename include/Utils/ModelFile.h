@@ -0,0 +1,240 @@
+#ifndef UTILS_MODELFILE_H_
+#define UTILS_MODELFILE_H_
+
+#include <map>       // std::map
+#include <string>    // std::string
+#include <vector>    // std::vector
+#include <sstream>   // std::ostringstream, std::istringstream
+#include <fstream>   // std::ofstream
+#include <cstring>   // std::memcpy, std::memcmp
+#include <stdexcept> // std::runtime_error, std::invalid_argument
+#include <stdint.h>  // uint32_t, uint64_t
+
+#include "../Config.h"
+#include "IO.h"
+#include "MappedFile.h"
+#include "HalfFloat.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Layout of the single-file model format, all integers in native byte order
+//
+//   Offset  Size  Content
+//   0       8     Magic bytes "MiniDNN\0"
+//   8       4     Format version, currently 1
+//   12      4     0x01020304, to detect a different byte order
+//   16      4     Size of each parameter value in bytes
+//   20      4     Number of layers, n
+//   24      8     Offset of the meta information
+//   32      8     Size of the meta information in bytes
+//   40      8     Offset of the layer table
+//   48      4     Format of the parameter values, a PRECISION value
+//   52      12    Reserved, zero
+//
+// The meta information is the text written by write_map(). The layer table
+// contains n pairs of 64-bit integers, the offset and the number of values of
+// the serialized parameters of each layer (see Layer::get_parameters()).
+// Parameters are stored as Scalar with SCALAR_PRECISION, in which case the
+// value size must match sizeof(Scalar), and as 16-bit values otherwise, which
+// can be read with any Scalar type.
+// Sections and parameters start at multiples of model_file_alignment, so the
+// parameters can be used in place after the file is mapped into memory.
+const char model_file_magic[8] = { 'M', 'i', 'n', 'i', 'D', 'N', 'N', '\0' };
+const uint32_t model_file_version = 1;
+const uint32_t model_file_byte_order = 0x01020304u;
+const uint64_t model_file_alignment = 64;
+const uint64_t model_file_header_size = 64;
+
+// Round up to a multiple of model_file_alignment
+inline uint64_t model_file_align(uint64_t offset)
+{
+    return (offset + model_file_alignment - 1) / model_file_alignment * model_file_alignment;
+}
+
+// Pad the stream with zeros up to the given offset
+inline void model_file_pad(std::ostream& os, uint64_t from, uint64_t to)
+{
+    static const char zeros[64] = { 0 };
+
+    for (; from < to; from += model_file_alignment)
+    {
+        const uint64_t n = (to - from < model_file_alignment) ? (to - from) : model_file_alignment;
+        os.write(zeros, std::streamsize(n));
+    }
+}
+
+///
+/// Write the meta information and parameters of an NN model to a single file
+///
+/// \param filename  The filename of the output
+/// \param map       The meta information of the model
+/// \param params    The serialized parameters of each layer
+/// \param precision The format in which the parameters are stored
+///
+inline void write_model_file(
+    const std::string& filename, const std::map<std::string, int>& map,
+    const std::vector< std::vector<Scalar> >& params,
+    PRECISION precision = SCALAR_PRECISION
+)
+{
+    std::ostringstream meta_stream;
+    write_map(meta_stream, map);
+    const std::string meta = meta_stream.str();
+    const uint32_t nlayer = params.size();
+    const uint32_t value_size = (precision == SCALAR_PRECISION) ? sizeof(Scalar) : sizeof(uint16_t);
+    const uint32_t format = precision;
+
+    // Compute the layout
+    const uint64_t meta_offset = model_file_header_size;
+    const uint64_t table_offset = model_file_align(meta_offset + meta.size());
+    std::vector<uint64_t> table(2 * nlayer);
+    uint64_t end = table_offset + table.size() * sizeof(uint64_t);
+
+    for (uint32_t i = 0; i < nlayer; i++)
+    {
+        table[2 * i] = model_file_align(end);
+        table[2 * i + 1] = params[i].size();
+        end = table[2 * i] + params[i].size() * value_size;
+    }
+
+    char header[model_file_header_size] = { 0 };
+    const uint64_t meta_size = meta.size();
+    std::memcpy(header, model_file_magic, 8);
+    std::memcpy(header + 8, &model_file_version, 4);
+    std::memcpy(header + 12, &model_file_byte_order, 4);
+    std::memcpy(header + 16, &value_size, 4);
+    std::memcpy(header + 20, &nlayer, 4);
+    std::memcpy(header + 24, &meta_offset, 8);
+    std::memcpy(header + 32, &meta_size, 8);
+    std::memcpy(header + 40, &table_offset, 8);
+    std::memcpy(header + 48, &format, 4);
+
+    std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary);
+    if (ofs.fail())
+        throw std::runtime_error("Error while opening file");
+
+    ofs.write(header, model_file_header_size);
+    ofs.write(meta.data(), meta.size());
+    model_file_pad(ofs, meta_offset + meta.size(), table_offset);
+    uint64_t pos = table_offset;
+
+    if (nlayer > 0)
+    {
+        ofs.write(reinterpret_cast<const char*>(&table[0]), table.size() * sizeof(uint64_t));
+        pos += table.size() * sizeof(uint64_t);
+    }
+
+    std::vector<uint16_t> packed;
+
+    for (uint32_t i = 0; i < nlayer; i++)
+    {
+        model_file_pad(ofs, pos, table[2 * i]);
+        pos = table[2 * i];
+
+        if (params[i].empty())
+        {
+            continue;
+        }
+
+        if (precision == SCALAR_PRECISION)
+        {
+            ofs.write(reinterpret_cast<const char*>(&params[i][0]), params[i].size() * sizeof(Scalar));
+        }
+        else
+        {
+            packed.resize(params[i].size());
+            pack_scalars(&params[i][0], params[i].size(), &packed[0], precision);
+            ofs.write(reinterpret_cast<const char*>(&packed[0]), packed.size() * sizeof(uint16_t));
+        }
+
+        pos += params[i].size() * value_size;
+    }
+
+    if (ofs.fail())
+        throw std::runtime_error("Error while writing file");
+}
+
+///
+/// Map a model file written by write_model_file() into memory, and locate
+/// the parameters of each layer in the mapping, without copying them
+///
+/// \param filename  The filename of the input
+/// \param file      The mapped file, which must stay open while the parameters are used
+/// \param map       The meta information of the model
+/// \param params    Pointers to the serialized parameters of each layer, which
+///                  point to Scalar values with SCALAR_PRECISION, and to 16-bit
+///                  values otherwise
+/// \param sizes     Number of values of the parameters of each layer
+/// \param precision The format in which the parameters are stored
+///
+inline void map_model_file(
+    const std::string& filename, MappedFile& file, std::map<std::string, int>& map,
+    std::vector<const void*>& params, std::vector<int>& sizes, PRECISION& precision
+)
+{
+    file.open(filename);
+    const char* data = static_cast<const char*>(file.data());
+    const uint64_t size = file.size();
+
+    uint32_t version, byte_order, value_size, nlayer, format;
+    uint64_t meta_offset, meta_size, table_offset;
+
+    if (size < model_file_header_size || std::memcmp(data, model_file_magic, 8) != 0)
+        throw std::invalid_argument("[function map_model_file]: Not a model file");
+
+    std::memcpy(&version, data + 8, 4);
+    std::memcpy(&byte_order, data + 12, 4);
+    std::memcpy(&value_size, data + 16, 4);
+    std::memcpy(&nlayer, data + 20, 4);
+    std::memcpy(&meta_offset, data + 24, 8);
+    std::memcpy(&meta_size, data + 32, 8);
+    std::memcpy(&table_offset, data + 40, 8);
+    std::memcpy(&format, data + 48, 4);
+
+    if (version != model_file_version)
+        throw std::invalid_argument("[function map_model_file]: Unsupported model file version");
+    if (byte_order != model_file_byte_order)
+        throw std::invalid_argument("[function map_model_file]: Model file has a different byte order");
+    if (format == SCALAR_PRECISION && value_size != sizeof(Scalar))
+        throw std::invalid_argument("[function map_model_file]: Model file has a different Scalar type");
+    if ((format == FP16_PRECISION || format == BF16_PRECISION) && value_size != sizeof(uint16_t))
+        throw std::invalid_argument("[function map_model_file]: Model file is corrupted");
+    if (format != SCALAR_PRECISION && format != FP16_PRECISION && format != BF16_PRECISION)
+        throw std::invalid_argument("[function map_model_file]: Unsupported parameter format");
+    if (meta_offset > size || meta_size > size - meta_offset ||
+            table_offset > size || uint64_t(nlayer) * 2 * sizeof(uint64_t) > size - table_offset)
+        throw std::invalid_argument("[function map_model_file]: Model file is truncated");
+
+    std::istringstream meta(std::string(data + meta_offset, meta_size));
+    read_map(meta, map);
+
+    precision = PRECISION(format);
+    params.resize(nlayer);
+    sizes.resize(nlayer);
+
+    for (uint32_t i = 0; i < nlayer; i++)
+    {
+        uint64_t entry[2];
+        std::memcpy(entry, data + table_offset + 2 * i * sizeof(uint64_t), sizeof(entry));
+
+        if (entry[0] % model_file_alignment != 0 || entry[0] > size ||
+                entry[1] > (size - entry[0]) / value_size)
+            throw std::invalid_argument("[function map_model_file]: Model file is truncated");
+
+        params[i] = data + entry[0];
+        sizes[i] = int(entry[1]);
+    }
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_MODELFILE_H_ */
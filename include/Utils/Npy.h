@@ -0,0 +1,274 @@
+#ifndef UTILS_NPY_H_
+#define UTILS_NPY_H_
+
+#include <string>    // std::string
+#include <vector>    // std::vector
+#include <cstring>   // std::memcpy, std::memcmp
+#include <cstdlib>   // std::strtoul
+#include <cstddef>   // std::size_t
+#include <stdexcept> // std::invalid_argument
+#include <stdint.h>  // uint16_t, uint32_t, uint64_t
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Description of an array in the NPY format
+// https://numpy.org/doc/stable/reference/generated/numpy.lib.format.html
+struct NpyHeader
+{
+    char                     type;          // Kind of the data type, 'f', 'i', 'u' or 'b'
+    int                      word_size;     // Size of each element in bytes
+    bool                     fortran_order; // Whether the array is stored in column-major order
+    std::vector<std::size_t> shape;
+    std::size_t              data_offset;   // Offset of the data from the start of the NPY data
+};
+
+// Read little-endian integers at possibly unaligned addresses
+inline uint16_t read_le16(const char* p)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return uint16_t(u[0] | (u[1] << 8));
+}
+
+inline uint32_t read_le32(const char* p)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+}
+
+inline uint64_t read_le64(const char* p)
+{
+    return uint64_t(read_le32(p)) | (uint64_t(read_le32(p + 4)) << 32);
+}
+
+// Whether the machine is little-endian
+inline bool little_endian()
+{
+    const uint16_t x = 1;
+    char c;
+    std::memcpy(&c, &x, 1);
+    return c == 1;
+}
+
+// Find the value of a key in the Python dict literal of an NPY header,
+// and return the position right after the colon
+inline std::size_t npy_dict_value(const std::string& dict, const std::string& key)
+{
+    const std::size_t pos = dict.find("'" + key + "'");
+
+    if (pos == std::string::npos)
+        throw std::invalid_argument("[function parse_npy_header]: Key '" + key + "' is missing");
+
+    const std::size_t colon = dict.find(':', pos);
+
+    if (colon == std::string::npos)
+        throw std::invalid_argument("[function parse_npy_header]: Malformed header");
+
+    return colon + 1;
+}
+
+// Parse the header of an NPY file of the given size starting at data
+inline void parse_npy_header(const char* data, std::size_t size, NpyHeader& header)
+{
+    static const char magic[6] = { '\x93', 'N', 'U', 'M', 'P', 'Y' };
+
+    if (size < 10 || std::memcmp(data, magic, 6) != 0)
+        throw std::invalid_argument("[function parse_npy_header]: Not an NPY file");
+
+    // Version 1.0 uses a 2-byte header length, and versions 2.0 and 3.0 use 4 bytes
+    const int major = static_cast<unsigned char>(data[6]);
+    std::size_t dict_start, dict_len;
+
+    if (major == 1)
+    {
+        dict_start = 10;
+        dict_len = read_le16(data + 8);
+    }
+    else if (major == 2 || major == 3)
+    {
+        if (size < 12)
+            throw std::invalid_argument("[function parse_npy_header]: NPY file is truncated");
+
+        dict_start = 12;
+        dict_len = read_le32(data + 8);
+    }
+    else
+    {
+        throw std::invalid_argument("[function parse_npy_header]: Unsupported NPY version");
+    }
+
+    if (dict_len > size - dict_start)
+        throw std::invalid_argument("[function parse_npy_header]: NPY file is truncated");
+
+    const std::string dict(data + dict_start, dict_len);
+    header.data_offset = dict_start + dict_len;
+
+    // Data type, such as '<f8', in which the first character is the byte order
+    std::size_t pos = dict.find('\'', npy_dict_value(dict, "descr"));
+    const std::size_t end = (pos == std::string::npos) ? pos : dict.find('\'', pos + 1);
+
+    if (end == std::string::npos || end - pos < 4)
+        throw std::invalid_argument("[function parse_npy_header]: Unsupported data type");
+
+    const char byte_order = dict[pos + 1];
+    header.type = dict[pos + 2];
+    header.word_size = std::atoi(dict.substr(pos + 3, end - pos - 3).c_str());
+    const bool native = (byte_order == '|' || byte_order == '=' ||
+                         (byte_order == '<') == little_endian());
+
+    if (!native && header.word_size > 1)
+        throw std::invalid_argument("[function parse_npy_header]: Data have a different byte order");
+    if ((header.type != 'f' && header.type != 'i' && header.type != 'u' && header.type != 'b') ||
+            header.word_size <= 0)
+        throw std::invalid_argument("[function parse_npy_header]: Unsupported data type");
+
+    // Memory order
+    pos = dict.find_first_not_of(' ', npy_dict_value(dict, "fortran_order"));
+    header.fortran_order = (dict.compare(pos, 4, "True") == 0);
+
+    // Shape, such as (100, 20) or (100,)
+    pos = dict.find('(', npy_dict_value(dict, "shape"));
+    const std::size_t close = (pos == std::string::npos) ? pos : dict.find(')', pos);
+
+    if (close == std::string::npos)
+        throw std::invalid_argument("[function parse_npy_header]: Malformed shape");
+
+    header.shape.clear();
+
+    for (pos++; pos < close;)
+    {
+        pos = dict.find_first_not_of(", ", pos);
+
+        if (pos >= close)
+        {
+            break;
+        }
+
+        char* num_end;
+        header.shape.push_back(std::strtoul(dict.c_str() + pos, &num_end, 10));
+        pos = num_end - dict.c_str();
+    }
+
+    // Check that the data are complete
+    std::size_t nelem = 1;
+
+    for (std::size_t i = 0; i < header.shape.size(); i++)
+    {
+        nelem *= header.shape[i];
+    }
+
+    if (nelem > (size - header.data_offset) / header.word_size)
+        throw std::invalid_argument("[function parse_npy_header]: NPY file is truncated");
+}
+
+// Find a member of a ZIP archive, such as an NPZ file, of the given size
+// starting at data. Return the offset of its data, and the compression
+// method in method, where 0 means that the member is stored without compression.
+inline std::size_t find_zip_member(const char* data, std::size_t size, const std::string& name,
+                                   int& method)
+{
+    // Locate the end of central directory record, which is followed by a comment
+    // of at most 65535 bytes
+    const std::size_t eocd_size = 22;
+
+    if (size < eocd_size)
+        throw std::invalid_argument("[function find_zip_member]: Not a ZIP file");
+
+    std::size_t eocd = size - eocd_size;
+    const std::size_t search_end = (size > eocd_size + 65535) ? (size - eocd_size - 65535) : 0;
+
+    while (read_le32(data + eocd) != 0x06054b50u)
+    {
+        if (eocd == search_end)
+            throw std::invalid_argument("[function find_zip_member]: Not a ZIP file");
+
+        eocd--;
+    }
+
+    uint64_t nentry = read_le16(data + eocd + 10);
+    uint64_t dir_offset = read_le32(data + eocd + 16);
+
+    // ZIP64 end of central directory, used by large archives
+    if (eocd >= 20 && read_le32(data + eocd - 20) == 0x07064b50u)
+    {
+        const uint64_t eocd64 = read_le64(data + eocd - 20 + 8);
+
+        if (size < 56 || eocd64 > size - 56 || read_le32(data + eocd64) != 0x06064b50u)
+            throw std::invalid_argument("[function find_zip_member]: Corrupted ZIP file");
+
+        nentry = read_le64(data + eocd64 + 32);
+        dir_offset = read_le64(data + eocd64 + 48);
+    }
+
+    // Walk through the central directory
+    uint64_t pos = dir_offset;
+
+    for (uint64_t i = 0; i < nentry; i++)
+    {
+        if (size < 46 || pos > size - 46 || read_le32(data + pos) != 0x02014b50u)
+            throw std::invalid_argument("[function find_zip_member]: Corrupted ZIP file");
+
+        const int entry_method = read_le16(data + pos + 10);
+        const uint32_t compressed32 = read_le32(data + pos + 20);
+        const uint32_t uncompressed32 = read_le32(data + pos + 24);
+        const std::size_t name_len = read_le16(data + pos + 28);
+        const std::size_t extra_len = read_le16(data + pos + 30);
+        const std::size_t comment_len = read_le16(data + pos + 32);
+        uint64_t local = read_le32(data + pos + 42);
+        const uint64_t next = pos + 46 + name_len + extra_len + comment_len;
+
+        if (next > size)
+            throw std::invalid_argument("[function find_zip_member]: Corrupted ZIP file");
+
+        if (std::string(data + pos + 46, name_len) != name)
+        {
+            pos = next;
+            continue;
+        }
+
+        // The ZIP64 extra field contains the 64-bit values of the fields that
+        // are 0xFFFFFFFF, in the order of the sizes and the offset
+        if (local == 0xFFFFFFFFu)
+        {
+            const char* extra = data + pos + 46 + name_len;
+            const char* extra_end = extra + extra_len;
+
+            for (; extra + 4 <= extra_end; extra += 4 + read_le16(extra + 2))
+            {
+                if (read_le16(extra) == 0x0001)
+                {
+                    const int skip = (uncompressed32 == 0xFFFFFFFFu) + (compressed32 == 0xFFFFFFFFu);
+                    if (extra + 4 + 8 * skip + 8 > extra_end)
+                        throw std::invalid_argument("[function find_zip_member]: Corrupted ZIP file");
+                    local = read_le64(extra + 4 + 8 * skip);
+                    break;
+                }
+            }
+        }
+
+        if (size < 30 || local > size - 30 || read_le32(data + local) != 0x04034b50u)
+            throw std::invalid_argument("[function find_zip_member]: Corrupted ZIP file");
+
+        const uint64_t offset = local + 30 + read_le16(data + local + 26) + read_le16(data + local + 28);
+
+        if (offset > size)
+            throw std::invalid_argument("[function find_zip_member]: Corrupted ZIP file");
+
+        method = entry_method;
+        return offset;
+    }
+
+    throw std::invalid_argument("[function find_zip_member]: Member '" + name + "' is not found");
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_NPY_H_ */
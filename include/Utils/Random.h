@@ -2,6 +2,7 @@
 #define UTILS_RANDOM_H_
 
 #include <Eigen/Core>
+#include <vector>
 #include "../Config.h"
 #include "../RNG.h"
 
@@ -15,10 +16,19 @@ namespace internal
 // Shuffle the integer array
 inline void shuffle(int* arr, const int n, RNG& rng)
 {
+    if (n < 2)
+    {
+        return;
+    }
+
+    // Generate all the uniform random numbers at once
+    std::vector<Scalar> u(n - 1);
+    rng.fill_uniform(&u[0], n - 1);
+
     for (int i = n - 1; i > 0; i--)
     {
         // A random non-negative integer <= i
-        const int j = int(rng.rand() * (i + 1));
+        const int j = int(u[n - 1 - i] * (i + 1));
         // Swap arr[i] and arr[j]
         const int tmp = arr[i];
         arr[i] = arr[j];
@@ -26,6 +36,25 @@ inline void shuffle(int* arr, const int n, RNG& rng)
     }
 }
 
+// Copy the observations indexed by id[0], id[1], ..., id[bsize-1] into a mini-batch
+// x_batch and y_batch are only reallocated when their sizes change
+template <typename DerivedX, typename DerivedY, typename XType, typename YType>
+inline void gather_batch(
+    const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+    const int* id, const int bsize,
+    XType& x_batch, YType& y_batch
+)
+{
+    x_batch.resize(x.rows(), bsize);
+    y_batch.resize(y.rows(), bsize);
+
+    for (int j = 0; j < bsize; j++)
+    {
+        x_batch.col(j).noalias() = x.col(id[j]);
+        y_batch.col(j).noalias() = y.col(id[j]);
+    }
+}
+
 template <typename DerivedX, typename DerivedY, typename XType, typename YType>
 inline int create_shuffled_batches(
     const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
@@ -34,8 +63,6 @@ inline int create_shuffled_batches(
 )
 {
     const int nobs = x.cols();
-    const int dimx = x.rows();
-    const int dimy = y.rows();
 
     if (y.cols() != nobs)
     {
@@ -63,16 +90,10 @@ inline int create_shuffled_batches(
     for (int i = 0; i < nbatch; i++)
     {
         const int bsize = (i == nbatch - 1) ? last_batch_size : batch_size;
-        x_batches.push_back(XType(dimx, bsize));
-        y_batches.push_back(YType(dimy, bsize));
+        x_batches.push_back(XType());
+        y_batches.push_back(YType());
         // Copy data
-        const int offset = i * batch_size;
-
-        for (int j = 0; j < bsize; j++)
-        {
-            x_batches[i].col(j).noalias() = x.col(id[offset + j]);
-            y_batches[i].col(j).noalias() = y.col(id[offset + j]);
-        }
+        gather_batch(x, y, id.data() + i * batch_size, bsize, x_batches[i], y_batches[i]);
     }
 
     return nbatch;
@@ -83,23 +104,7 @@ inline void set_normal_random(Scalar* arr, const int n, RNG& rng,
                               const Scalar& mu = Scalar(0),
                               const Scalar& sigma = Scalar(1))
 {
-    // For simplicity we use Box-Muller transform to generate normal random variates
-    const double two_pi = 6.283185307179586476925286766559;
-
-    for (int i = 0; i < n - 1; i += 2)
-    {
-        const double t1 = sigma * std::sqrt(-2 * std::log(rng.rand()));
-        const double t2 = two_pi * rng.rand();
-        arr[i]     = t1 * std::cos(t2) + mu;
-        arr[i + 1] = t1 * std::sin(t2) + mu;
-    }
-
-    if (n % 2 == 1)
-    {
-        const double t1 = sigma * std::sqrt(-2 * std::log(rng.rand()));
-        const double t2 = two_pi * rng.rand();
-        arr[n - 1] = t1 * std::cos(t2) + mu;
-    }
+    rng.fill_normal(arr, n, mu, sigma);
 }
 
 
@@ -0,0 +1,159 @@
+#ifndef UTILS_THREADPOOL_H_
+#define UTILS_THREADPOOL_H_
+
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+///
+/// A fixed-size pool of worker threads that execute tasks in FIFO order.
+/// It is only available when `MDNN_USE_THREADS` is defined, and otherwise
+/// the class is only declared, so that pointers to it can still be stored.
+///
+class ThreadPool;
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#ifdef MDNN_USE_THREADS
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+class ThreadPool
+{
+    private:
+        std::vector<std::thread>          m_workers;
+        std::deque< std::function<void()> > m_tasks;
+        std::mutex                        m_mutex;
+        std::condition_variable           m_cond;
+        bool                              m_stop;
+
+        void worker()
+        {
+#ifdef _OPENMP
+            // The pool provides the parallelism, so the matrix products in the
+            // tasks do not start OpenMP threads of their own. This also keeps
+            // their results independent of the OpenMP thread count
+            omp_set_num_threads(1);
+#endif
+
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cond.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+
+                    // Remaining tasks are still executed when the pool is stopped
+                    if (m_tasks.empty())
+                    {
+                        return;
+                    }
+
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param nthread Number of worker threads.
+        ///
+        explicit ThreadPool(int nthread) :
+            m_stop(false)
+        {
+            for (int i = 0; i < nthread; i++)
+            {
+                m_workers.emplace_back(&ThreadPool::worker, this);
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ///
+        /// Destructor, which finishes the pending tasks and joins the workers
+        ///
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cond.notify_all();
+
+            for (std::size_t i = 0; i < m_workers.size(); i++)
+            {
+                m_workers[i].join();
+            }
+        }
+
+        ///
+        /// Number of worker threads
+        ///
+        int size() const
+        {
+            return m_workers.size();
+        }
+
+        ///
+        /// Add a task to the queue
+        ///
+        /// \param fun A callable object with no arguments.
+        ///
+        /// \return A future that becomes ready when the task finishes, and that
+        ///         rethrows the exception thrown by the task, if any.
+        ///
+        template <typename Fun>
+        std::future<void> submit(Fun fun)
+        {
+            std::shared_ptr< std::packaged_task<void()> > task =
+                std::make_shared< std::packaged_task<void()> >(std::move(fun));
+            std::future<void> res = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tasks.emplace_back([task]() { (*task)(); });
+            }
+            m_cond.notify_one();
+            return res;
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+#endif /* MDNN_USE_THREADS */
+
+
+#endif /* UTILS_THREADPOOL_H_ */
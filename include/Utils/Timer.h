@@ -0,0 +1,43 @@
+#ifndef UTILS_TIMER_H_
+#define UTILS_TIMER_H_
+
+#ifdef _WIN32
+    #include <windows.h>  // QueryPerformanceCounter
+#else
+    #include <time.h>     // clock_gettime
+#endif
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+///
+/// Read a monotonic wall clock
+///
+/// \return        The current time in seconds, relative to an unspecified
+///                starting point
+///
+inline double wall_time()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return double(count.QuadPart) / double(freq.QuadPart);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+#endif
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_TIMER_H_ */